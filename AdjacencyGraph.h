@@ -0,0 +1,122 @@
+//
+//  AdjacencyGraph.h
+//  DungGine
+//
+
+#pragma once
+#include <vector>
+#include <array>
+#include <span>
+#include <utility>
+
+
+namespace dung
+{
+
+  // Immutable room / corridor / door connectivity in compressed sparse row form.
+  // Rooms are identified by their leaf index and corridors and doors by their
+  //   index in the corresponding pool of BSPTree (see BSPTree::get_room_id() etc).
+  class AdjacencyGraph final
+  {
+    // The entries of element i are data[offsets[i] .. offsets[i + 1]).
+    struct CSR
+    {
+      std::vector<int> offsets { 0 };
+      std::vector<int> data;
+
+      std::span<const int> get(int i) const
+      {
+        if (i < 0 || i + 1 >= static_cast<int>(offsets.size()))
+          return {};
+        return { data.data() + offsets[i], data.data() + offsets[i + 1] };
+      }
+
+      // pairs : (element, entry), in any order. Entries keep their relative order per element.
+      void build(int num_elements, const std::vector<std::pair<int, int>>& pairs)
+      {
+        offsets.assign(num_elements + 1, 0);
+        for (const auto& p : pairs)
+          offsets[p.first + 1]++;
+        for (int i = 0; i < num_elements; ++i)
+          offsets[i + 1] += offsets[i];
+        data.resize(pairs.size());
+        auto fill = offsets;
+        for (const auto& p : pairs)
+          data[fill[p.first]++] = p.second;
+      }
+    };
+
+    CSR m_room_corridors;
+    CSR m_room_neighbours; // Aligned with m_room_corridors.
+    CSR m_room_doors;
+    std::vector<std::array<int, 2>> m_corridor_rooms;
+
+  public:
+    // corridor_rooms[corr_id] : The two rooms connected by corridor corr_id.
+    // door_rooms[door_id] : The room that door door_id belongs to or -1.
+    void build(int num_rooms,
+               const std::vector<std::array<int, 2>>& corridor_rooms,
+               const std::vector<int>& door_rooms)
+    {
+      m_corridor_rooms = corridor_rooms;
+
+      std::vector<std::pair<int, int>> room_corr_pairs, room_neighbour_pairs;
+      room_corr_pairs.reserve(2*corridor_rooms.size());
+      room_neighbour_pairs.reserve(2*corridor_rooms.size());
+      for (int corr_id = 0; corr_id < static_cast<int>(corridor_rooms.size()); ++corr_id)
+      {
+        const auto& rooms = corridor_rooms[corr_id];
+        for (int i = 0; i < 2; ++i)
+        {
+          room_corr_pairs.emplace_back(rooms[i], corr_id);
+          room_neighbour_pairs.emplace_back(rooms[i], rooms[1 - i]);
+        }
+      }
+      m_room_corridors.build(num_rooms, room_corr_pairs);
+      m_room_neighbours.build(num_rooms, room_neighbour_pairs);
+
+      std::vector<std::pair<int, int>> room_door_pairs;
+      room_door_pairs.reserve(door_rooms.size());
+      for (int door_id = 0; door_id < static_cast<int>(door_rooms.size()); ++door_id)
+        if (door_rooms[door_id] >= 0)
+          room_door_pairs.emplace_back(door_rooms[door_id], door_id);
+      m_room_doors.build(num_rooms, room_door_pairs);
+    }
+
+    int num_rooms() const { return static_cast<int>(m_room_corridors.offsets.size()) - 1; }
+    int num_corridors() const { return static_cast<int>(m_corridor_rooms.size()); }
+
+    std::span<const int> get_room_corridors(int room_id) const { return m_room_corridors.get(room_id); }
+    // Element i is the room on the other side of corridor get_room_corridors(room_id)[i].
+    std::span<const int> get_room_neighbours(int room_id) const { return m_room_neighbours.get(room_id); }
+    std::span<const int> get_room_doors(int room_id) const { return m_room_doors.get(room_id); }
+    const std::array<int, 2>& get_corridor_rooms(int corr_id) const { return m_corridor_rooms[corr_id]; }
+
+    // Breadth-first traversal over rooms connected by corridors, starting at room_id.
+    // f(room_id, depth) returns false to stop the traversal.
+    template<typename F>
+    void traverse_rooms(int room_id, F&& f, int max_depth = -1) const
+    {
+      if (room_id < 0 || room_id >= num_rooms())
+        return;
+      std::vector<int> depths(num_rooms(), -1);
+      std::vector<int> queue { room_id };
+      depths[room_id] = 0;
+      for (size_t qi = 0; qi < queue.size(); ++qi)
+      {
+        int curr = queue[qi];
+        if (!f(curr, depths[curr]))
+          return;
+        if (max_depth >= 0 && depths[curr] >= max_depth)
+          continue;
+        for (int nb : get_room_neighbours(curr))
+          if (depths[nb] < 0)
+          {
+            depths[nb] = depths[curr] + 1;
+            queue.emplace_back(nb);
+          }
+      }
+    }
+  };
+
+}
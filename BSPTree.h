@@ -8,15 +8,20 @@
 #pragma once
 #include "Door.h"
 #include "Corridor.h"
+#include "SpatialGrid.h"
+#include "AdjacencyGraph.h"
+#include "BinaryStream.h"
+#include "BitPlane.h"
 #include <Termin8or/RC.h>
 #include <Termin8or/ScreenHandler.h>
 #include <Termin8or/Drawing.h>
 #include <Core/Rand.h>
 #include <Core/Math.h>
-#include <Core/bool_vector.h>
 #include <Core/Utils.h>
 #include <array>
 #include <memory>
+#include <queue>
+#include <numeric>
 
 
 namespace dung
@@ -89,24 +94,87 @@ namespace dung
     ttl::Rectangle bb_region;
     ttl::Rectangle bb_leaf_room;
     
-    std::array<std::unique_ptr<BSPNode>, 2> children;
+    // Indices into the node arena of the owning BSPTree. -1 if there is no child.
+    std::array<int, 2> children { -1, -1 };
         
     int level = 0; // root = 0;
     
     std::vector<Door*> doors;
     
-    bool_vector fog_of_war;
-    bool_vector light;
+    // Views into the world-level planes of the owning BSPTree.
+    BitPlaneView fog_of_war;
+    BitPlaneView light;
+    BitPlaneView visible;
     
     // ///////////
     
-    bool is_leaf() const { return !children[0] && !children[1]; }
+    bool is_leaf() const { return children[0] < 0 && children[1] < 0; }
     
-    void generate(ttl::Rectangle bb, int lvl, int min_room_length)
+    bool is_inside_room(const RC& pos, ttl::BBLocation* location = nullptr) const
+    {
+      if (!is_leaf())
+        return false;
+      for (auto* d : doors)
+      {
+        if (d->open_or_no_door() && pos == d->pos)
+        {
+          utils::try_set(location, ttl::BBLocation::Inside);
+          return true;
+        }
+      }
+      utils::try_set(location, bb_leaf_room.find_location_offs(pos, -1, -1, -1, -1));
+      return bb_leaf_room.is_inside_offs(pos, -1);
+    }
+    
+    bool is_in_fog_of_war(const RC& world_pos)
+    {
+      if (!is_leaf())
+        return true;
+      return fog_of_war.get(world_pos);
+    }
+    
+    bool is_in_light(const RC& world_pos)
+    {
+      if (!is_leaf())
+        return false;
+      return light.get(world_pos);
+    }
+  };
+      
+  // //////////////////////////////////////////////////////////////
+
+  class BSPTree final
+  {
+    // Node arena. After generate() the internal nodes come first followed
+    //   by all the leaves, both groups in depth-first order. The root is at index 0.
+    std::vector<BSPNode> m_nodes;
+    int m_first_leaf_idx = 0;
+    std::vector<BSPNode*> m_leaves;
+    int m_min_room_length = 4;
+    
+    std::vector<Corridor> corridors;
+    std::vector<Door> doors;
+    std::vector<Door*> m_door_ptrs;
+    std::map<std::pair<BSPNode*, BSPNode*>, Corridor*> room_corridor_map;
+    AdjacencyGraph m_graph;
+    
+    // Explored, lit and currently visible cells of the whole world.
+    // The fog of war, light and visibility of the rooms and corridors are views into these.
+    BitPlane m_explored;
+    BitPlane m_lit;
+    BitPlane m_visible;
+    
+    static constexpr int c_corridor_grid_bucket_size = 16;
+    
+    // #NOTE: m_nodes grows during the recursion, so nodes are only referred to by index here.
+    void generate_node(int node_idx, ttl::Rectangle bb, int lvl)
     {
-      bb_region = bb;
-      level = lvl;
-      split_fraction = rnd::rand();
+      auto orientation = m_nodes[node_idx].orientation;
+      int size_rows = m_nodes[node_idx].size_rows;
+      int size_cols = m_nodes[node_idx].size_cols;
+      m_nodes[node_idx].bb_region = bb;
+      m_nodes[node_idx].level = lvl;
+      auto split_fraction = m_nodes[node_idx].split_fraction = rnd::rand();
       int split_length_0 = 0;
       int split_length_1 = 0;
       switch (orientation)
@@ -121,35 +189,35 @@ namespace dung
           break;
       };
       
-      auto f_set_ch_size = [&](BSPNode* ch, int split_len)
+      auto f_add_child = [&](int ch_nr, int split_len)
       {
+        int ch_idx = stlutils::sizeI(m_nodes);
+        auto& ch = m_nodes.emplace_back();
+        ch.orientation = static_cast<Orientation>(1 - static_cast<int>(orientation));
         switch (orientation)
         {
           case Orientation::Vertical:
-            ch->size_cols = split_len;
-            ch->size_rows = size_rows;
+            ch.size_cols = split_len;
+            ch.size_rows = size_rows;
             break;
           case Orientation::Horizontal:
-            ch->size_rows = split_len;
-            ch->size_cols = size_cols;
+            ch.size_rows = split_len;
+            ch.size_cols = size_cols;
             break;
         }
+        m_nodes[node_idx].children[ch_nr] = ch_idx;
+        return ch_idx;
       };
     
-      auto child_orientation = static_cast<Orientation>(1 - static_cast<int>(orientation));
-      if (split_length_0 >= min_room_length && split_length_1 >= min_room_length)
+      if (split_length_0 >= m_min_room_length && split_length_1 >= m_min_room_length)
       {
-        auto& ch_0 = children[0] = std::make_unique<BSPNode>();
-        ch_0->orientation = child_orientation;
-        f_set_ch_size(ch_0.get(), split_length_0);
-        int ch0_r_len = children[0]->size_rows;
-        int ch0_c_len = children[0]->size_cols;
+        int ch0_idx = f_add_child(0, split_length_0);
+        int ch0_r_len = m_nodes[ch0_idx].size_rows;
+        int ch0_c_len = m_nodes[ch0_idx].size_cols;
         ttl::Rectangle bb_0 { bb.r, bb.c, ch0_r_len, ch0_c_len };
-        ch_0->generate(bb_0, lvl + 1, min_room_length);
+        generate_node(ch0_idx, bb_0, lvl + 1);
         
-        auto& ch_1 = children[1] = std::make_unique<BSPNode>();
-        ch_1->orientation = child_orientation;
-        f_set_ch_size(ch_1.get(), split_length_1);
+        int ch1_idx = f_add_child(1, split_length_1);
         int ch1_r = 0;
         int ch1_c = 0;
         switch (orientation)
@@ -163,356 +231,762 @@ namespace dung
             ch1_c = bb.c;
             break;
         }
-        int ch1_r_len = children[1]->size_rows;
-        int ch1_c_len = children[1]->size_cols;
+        int ch1_r_len = m_nodes[ch1_idx].size_rows;
+        int ch1_c_len = m_nodes[ch1_idx].size_cols;
         ttl::Rectangle bb_1 { ch1_r, ch1_c, ch1_r_len, ch1_c_len };
-        ch_1->generate(bb_1, lvl + 1, min_room_length);
+        generate_node(ch1_idx, bb_1, lvl + 1);
       }
     }
     
-    template<int NR, int NC>
-    void draw_regions(ScreenHandler<NR, NC>& sh,
-                      int r0, int c0,
-                      const styles::Style& border_style) const
+    // Reorders the arena into internal nodes followed by leaves,
+    //   keeping the depth-first order within each group.
+    void layout_nodes()
     {
-      drawing::draw_box_outline(sh, r0 + bb_region.r, c0 + bb_region.c, bb_region.r_len, bb_region.c_len, drawing::OutlineType::Hash, border_style);
-      
-      if (children[0])
-        children[0]->draw_regions(sh, r0, c0, border_style);
-      if (children[1])
-        children[1]->draw_regions(sh, r0, c0, border_style);
-    }
-    
-    template<int NR, int NC>
-    void draw_rooms(ScreenHandler<NR, NC>& sh,
-                    int r0, int c0,
-                    const styles::Style& room_style) const
-    {
-      if (!bb_leaf_room.is_empty())
+      std::vector<int> internal_idcs, leaf_idcs;
+      std::vector<int> stack { 0 };
+      while (!stack.empty())
       {
-        drawing::draw_box_outline(sh,
-                 r0 + bb_leaf_room.r, c0 + bb_leaf_room.c, bb_leaf_room.r_len, bb_leaf_room.c_len,
-                 drawing::OutlineType::Hash, room_style);
+        int idx = stack.back();
+        stack.pop_back();
+        const auto& node = m_nodes[idx];
+        (node.is_leaf() ? leaf_idcs : internal_idcs).emplace_back(idx);
+        for (int ch_nr = 1; ch_nr >= 0; --ch_nr)
+          if (node.children[ch_nr] >= 0)
+            stack.emplace_back(node.children[ch_nr]);
       }
-                 
-      if (children[0])
-        children[0]->draw_rooms(sh, r0, c0, room_style);
-      if (children[1])
-        children[1]->draw_rooms(sh, r0, c0, room_style);
-    }
-    
-    void print_tree(const std::string& indent = "") const
-    {
-      std::cout << indent << "Level: " << level << std::endl;
-      std::cout << indent << "Orientation: " << (orientation == Orientation::Vertical ? "V" : "H") << std::endl;
-      std::cout << indent << "Size: [" << size_rows << ", " << size_cols << "]" << std::endl;
       
-      auto child_indent = indent + str::rep_char(' ', 2);
-      
-      if (children[0])
-      {
-        std::cout << indent << "Child 0:" << std::endl;
-        children[0]->print_tree(child_indent);
-      }
-      if (children[1])
+      std::vector<int> new_idcs(m_nodes.size(), -1);
+      int new_idx = 0;
+      for (int idx : internal_idcs)
+        new_idcs[idx] = new_idx++;
+      for (int idx : leaf_idcs)
+        new_idcs[idx] = new_idx++;
+        
+      std::vector<BSPNode> nodes(m_nodes.size());
+      for (int idx = 0; idx < stlutils::sizeI(m_nodes); ++idx)
       {
-        std::cout << indent << "Child 1:" << std::endl;
-        children[1]->print_tree(child_indent);
+        auto& node = nodes[new_idcs[idx]] = std::move(m_nodes[idx]);
+        for (auto& ch_idx : node.children)
+          if (ch_idx >= 0)
+            ch_idx = new_idcs[ch_idx];
       }
+      m_nodes = std::move(nodes);
+      m_first_leaf_idx = stlutils::sizeI(internal_idcs);
+      
+      m_leaves.clear();
+      for (int idx = m_first_leaf_idx; idx < stlutils::sizeI(m_nodes); ++idx)
+        m_leaves.emplace_back(&m_nodes[idx]);
     }
     
-    void pad_rooms(int min_room_length, int min_rnd_wall_padding, int max_rnd_wall_padding)
+    void clear()
     {
-      if (is_leaf())
-      {
-        std::array<int, 4> padding_nswe { 0, 0, 0, 0 }; // top, bottom, left, right
-        int num_tries = 0;
-        do
-        {
-          for (int i = 0; i < 4; ++i)
-            padding_nswe[i] = rnd::rand_int(min_rnd_wall_padding, max_rnd_wall_padding);
-          bb_leaf_room = bb_region;
-          bb_leaf_room.r += padding_nswe[0];
-          bb_leaf_room.r_len -= padding_nswe[0] + padding_nswe[1];
-          bb_leaf_room.c += padding_nswe[2];
-          bb_leaf_room.c_len -= padding_nswe[2] + padding_nswe[3];
-          if (num_tries > 20)
-            min_rnd_wall_padding = 0;
-          num_tries++;
-        } while (bb_leaf_room.r_len < min_room_length || bb_leaf_room.c_len < min_room_length);
-        
-        size_t surf_area = bb_leaf_room.r_len * bb_leaf_room.c_len;
-        fog_of_war.resize(surf_area, true);
-        light.resize(surf_area, false);
-      }
-      else
-      {
-        if (children[0])
-          children[0]->pad_rooms(min_room_length, min_rnd_wall_padding, max_rnd_wall_padding);
-        if (children[1])
-          children[1]->pad_rooms(min_room_length, min_rnd_wall_padding, max_rnd_wall_padding);
-      }
+      m_nodes.clear();
+      m_first_leaf_idx = 0;
+      m_leaves.clear();
+      corridors.clear();
+      doors.clear();
+      m_door_ptrs.clear();
+      room_corridor_map.clear();
+      m_graph = {};
+      reset_planes();
     }
     
-    void collect_leaves(std::vector<BSPNode*>& leaves)
+    void reset_planes()
     {
-      if (is_leaf())
-        leaves.emplace_back(this);
-      if (children[0])
-        children[0]->collect_leaves(leaves);
-      if (children[1])
-        children[1]->collect_leaves(leaves);
+      auto world_size = get_world_size();
+      for (auto* plane : { &m_explored, &m_lit, &m_visible })
+        plane->reset(world_size.r, world_size.c);
     }
     
-    bool is_inside_room(const RC& pos, ttl::BBLocation* location = nullptr) const
+    // The views keep pointers to the planes, which is fine since the tree never moves.
+    template<typename RoomOrCorr>
+    void bind_fields(RoomOrCorr& room_or_corr, const ttl::Rectangle& bb)
     {
-      if (!is_leaf())
-        return false;
-      for (auto* d : doors)
-      {
-        if (d->open_or_no_door() && pos == d->pos)
-        {
-          utils::try_set(location, ttl::BBLocation::Inside);
-          return true;
-        }
-      }
-      utils::try_set(location, bb_leaf_room.find_location_offs(pos, -1, -1, -1, -1));
-      return bb_leaf_room.is_inside_offs(pos, -1);
+      room_or_corr.fog_of_war = { &m_explored, bb, true };
+      room_or_corr.light = { &m_lit, bb, false };
+      room_or_corr.visible = { &m_visible, bb, false };
     }
     
-    bool is_in_fog_of_war(const RC& world_pos)
+    // The door pointer list and the adjacency graph, once the doors are final.
+    void build_door_lookups()
     {
-      if (!is_leaf())
-        return true;
-      auto local_pos = world_pos - bb_leaf_room.pos();
-      auto idx = local_pos.r * bb_leaf_room.c_len + local_pos.c;
-      if (math::in_range<int>(idx, 0, stlutils::sizeI(fog_of_war), Range::ClosedOpen))
-        return fog_of_war[idx];
-      return true;
+      m_door_ptrs.clear();
+      for (auto& d : doors)
+        m_door_ptrs.emplace_back(&d);
+      
+      std::vector<std::array<int, 2>> corridor_rooms(corridors.size(), { -1, -1 });
+      for (const auto& cp : room_corridor_map)
+        corridor_rooms[get_corridor_id(cp.second)] = { get_room_id(cp.first.first), get_room_id(cp.first.second) };
+      std::vector<int> door_rooms;
+      door_rooms.reserve(doors.size());
+      for (const auto& d : doors)
+        door_rooms.emplace_back(d.room != nullptr ? get_room_id(d.room) : -1);
+      m_graph.build(stlutils::sizeI(m_leaves), corridor_rooms, door_rooms);
     }
     
-    bool is_in_light(const RC& world_pos)
+    void print_node(int node_idx, const std::string& indent) const
     {
-      if (!is_leaf())
-        return false;
-      auto local_pos = world_pos - bb_leaf_room.pos();
-      auto idx = local_pos.r * bb_leaf_room.c_len + local_pos.c;
-      if (math::in_range<int>(idx, 0, stlutils::sizeI(light), Range::ClosedOpen))
-        return light[idx];
-      return false;
-    }
-  };
+      const auto& node = m_nodes[node_idx];
+      std::cout << indent << "Level: " << node.level << std::endl;
+      std::cout << indent << "Orientation: " << (node.orientation == Orientation::Vertical ? "V" : "H") << std::endl;
+      std::cout << indent << "Size: [" << node.size_rows << ", " << node.size_cols << "]" << std::endl;
       
-  // //////////////////////////////////////////////////////////////
-
-  class BSPTree final
-  {
-    BSPNode m_root;
-    int m_min_room_length = 4;
-    
-    std::vector<std::unique_ptr<Corridor>> corridors;
-    std::vector<std::unique_ptr<Door>> doors;
-    std::map<std::pair<BSPNode*, BSPNode*>, Corridor*> room_corridor_map;
+      auto child_indent = indent + str::rep_char(' ', 2);
+      
+      if (node.children[0] >= 0)
+      {
+        std::cout << indent << "Child 0:" << std::endl;
+        print_node(node.children[0], child_indent);
+      }
+      if (node.children[1] >= 0)
+      {
+        std::cout << indent << "Child 1:" << std::endl;
+        print_node(node.children[1], child_indent);
+      }
+    }
     
   public:
     BSPTree() = default;
     BSPTree(int min_room_length)
       : m_min_room_length(min_room_length)
     {}
+    // The leaves, the room / corridor map and the doors of the rooms and corridors
+    //   point into the arenas of this tree, and the fog of war, light and visible views
+    //   of the rooms and corridors point into its planes, so it can be neither copied nor moved.
+    BSPTree(const BSPTree&) = delete;
+    BSPTree(BSPTree&&) = delete;
+    BSPTree& operator=(const BSPTree&) = delete;
+    BSPTree& operator=(BSPTree&&) = delete;
     
     void generate(int world_size_rows, int world_size_cols,
                   Orientation first_split_orientation)
     {
-      m_root.orientation = first_split_orientation;
-      m_root.size_rows = world_size_rows;
-      m_root.size_cols = world_size_cols;
-      ttl::Rectangle bb { 0, 0, m_root.size_rows, m_root.size_cols };
-      m_root.generate(bb, 0, m_min_room_length);
+      clear();
+      
+      auto& root = m_nodes.emplace_back();
+      root.orientation = first_split_orientation;
+      root.size_rows = world_size_rows;
+      root.size_cols = world_size_cols;
+      ttl::Rectangle bb { 0, 0, root.size_rows, root.size_cols };
+      generate_node(0, bb, 0);
+      layout_nodes();
+      reset_planes();
     }
     
-    std::vector<BSPNode*> fetch_leaves()
+    // View of the leaves, which are stored contiguously in the node arena.
+    const std::vector<BSPNode*>& fetch_leaves() const
     {
-      std::vector<BSPNode*> leaves;
-      m_root.collect_leaves(leaves);
-      return leaves;
+      return m_leaves;
     }
     
     RC get_world_size() const
     {
-      return { m_root.size_rows, m_root.size_cols };
+      if (m_nodes.empty())
+        return { 0, 0 };
+      return { m_nodes[0].size_rows, m_nodes[0].size_cols };
+    }
+    
+    // Descends the regions (which partition the world) down to the leaf whose
+    //   region contains pos. O(depth) instead of testing every leaf.
+    BSPNode* find_leaf(const RC& pos)
+    {
+      if (m_nodes.empty() || !m_nodes[0].bb_region.is_inside(pos))
+        return nullptr;
+      int idx = 0;
+      while (!m_nodes[idx].is_leaf())
+      {
+        int next_idx = -1;
+        for (int ch_idx : m_nodes[idx].children)
+          if (ch_idx >= 0 && m_nodes[ch_idx].bb_region.is_inside(pos))
+          {
+            next_idx = ch_idx;
+            break;
+          }
+        if (next_idx < 0)
+          return nullptr;
+        idx = next_idx;
+      }
+      return &m_nodes[idx];
     }
     
     void pad_rooms(int min_rnd_wall_padding = 1, int max_rnd_wall_padding = 4)
     {
-      m_root.pad_rooms(m_min_room_length, min_rnd_wall_padding, max_rnd_wall_padding);
+      for (auto* leaf : m_leaves)
+      {
+        std::array<int, 4> padding_nswe { 0, 0, 0, 0 }; // top, bottom, left, right
+        int num_tries = 0;
+        int min_padding = min_rnd_wall_padding;
+        auto& bb_leaf_room = leaf->bb_leaf_room;
+        do
+        {
+          for (int i = 0; i < 4; ++i)
+            padding_nswe[i] = rnd::rand_int(min_padding, max_rnd_wall_padding);
+          bb_leaf_room = leaf->bb_region;
+          bb_leaf_room.r += padding_nswe[0];
+          bb_leaf_room.r_len -= padding_nswe[0] + padding_nswe[1];
+          bb_leaf_room.c += padding_nswe[2];
+          bb_leaf_room.c_len -= padding_nswe[2] + padding_nswe[3];
+          if (num_tries > 20)
+            min_padding = 0;
+          num_tries++;
+        } while (bb_leaf_room.r_len < m_min_room_length || bb_leaf_room.c_len < m_min_room_length);
+        
+        bind_fields(*leaf, bb_leaf_room);
+      }
     }
     
     void create_corridors(int min_corridor_half_width = 1)
     {
-      std::vector<BSPNode*> leaves;
-      m_root.collect_leaves(leaves);
+      const auto& leaves = m_leaves;
+      auto num_leaves = stlutils::sizeI(leaves);
+      
+      // Rooms and corridors are bucketed so that the collision tests only
+      //   visit the rectangles near the prospective corridor.
+      SpatialGrid room_grid(get_world_size(), c_corridor_grid_bucket_size);
+      for (int leaf_idx = 0; leaf_idx < num_leaves; ++leaf_idx)
+        room_grid.insert(leaf_idx, leaves[leaf_idx]->bb_leaf_room);
+      SpatialGrid corridor_grid(get_world_size(), c_corridor_grid_bucket_size);
+      for (int corr_idx = 0; corr_idx < stlutils::sizeI(corridors); ++corr_idx)
+        corridor_grid.insert(corr_idx, corridors[corr_idx].bb);
+      
+      // The corridor pool may reallocate while growing,
+      //   so refer to the corridors by index until we're done.
+      std::map<std::pair<BSPNode*, BSPNode*>, int> room_corridor_idcs;
+      for (const auto& cp : room_corridor_map)
+        room_corridor_idcs[cp.first] = static_cast<int>(cp.second - corridors.data());
+      auto f_add_corridor = [&](const auto& key, const ttl::Rectangle& bb, Orientation orientation)
+      {
+        int corr_idx = stlutils::sizeI(corridors);
+        auto& corr = corridors.emplace_back();
+        corr.set_straight(bb, orientation);
+        bind_fields(corr, corr.bb);
+        room_corridor_idcs[key] = corr_idx;
+        corridor_grid.insert(corr_idx, corr.bb);
+      };
       
-      for (auto* leaf_A : leaves)
+      auto f_collides = [&](const ttl::Rectangle& bb_query, const auto& collides_with_bb)
       {
-        for (auto* leaf_B : leaves)
+        if (room_grid.any_of(bb_query, [&](int leaf_idx) { return collides_with_bb(leaves[leaf_idx]->bb_leaf_room); }))
+          return true;
+        return corridor_grid.any_of(bb_query, [&](int corr_idx) { return collides_with_bb(corridors[corr_idx].bb); });
+      };
+    
+      auto try_make_horizontal_corridor = [&](auto* leaf_A, auto* leaf_B)
+      {
+        // Horizontal approach
+        auto bb_A = leaf_A->bb_leaf_room;
+        auto bb_B = leaf_B->bb_leaf_room;
+        if (bb_A.right() > bb_B.left())
+          return false;
+        
+        int c0 = bb_A.right();
+        int c1 = bb_B.left();
+        int r0 = std::max(bb_A.top(), bb_B.top());
+        int r1 = std::min(bb_A.bottom(), bb_B.bottom());
+        if (r0 > r1)
+          return false;
+        if (bb_A.top() < bb_B.top() && bb_A.bottom() - bb_B.top() < 2*min_corridor_half_width)
+          return false;
+        if (bb_B.top() < bb_A.top() && bb_B.bottom() - bb_A.top() < 2*min_corridor_half_width)
+          return false;
+        auto collides_with_bb = [r0, r1, c0, c1](const ttl::Rectangle bb) -> bool
         {
-          if (leaf_A != leaf_B)
+          if (c0 <= bb.left() && bb.right() <= c1)
           {
-          
-            auto try_make_horizontal_corridor = [&](auto* leaf_A, auto* leaf_B)
+            if (bb.top() <= r0 && r1 <= bb.bottom())
+              return true;
+            if (r0 <= bb.top() && bb.top() <= r1)
+              return true;
+            if (r0 <= bb.bottom() && bb.bottom() <= r1)
+              return true;
+          }
+          return false;
+        };
+        // Anything colliding overlaps the span between the two rooms.
+        bool collided = f_collides({ r0, c0, r1 - r0 + 1, c1 - c0 + 1 }, collides_with_bb);
+        if (!collided)
+        {
+          auto key = std::pair { std::min(leaf_A, leaf_B), std::max(leaf_A, leaf_B) };
+          auto it = room_corridor_idcs.find(key);
+          if (it == room_corridor_idcs.end())
+          {
+            f_add_corridor(key, { (r0 + r1)/2 - min_corridor_half_width, c0, 2*min_corridor_half_width + 1, c1 - c0 + 1 }, Orientation::Horizontal);
+            return true;
+          }
+        }
+        return false;
+      };
+      
+      auto try_make_vertical_corridor = [&](auto* leaf_A, auto* leaf_B)
+      {
+        // Horizontal approach
+        auto bb_A = leaf_A->bb_leaf_room;
+        auto bb_B = leaf_B->bb_leaf_room;
+        if (bb_A.bottom() > bb_B.top())
+          return false;
+        
+        int r0 = bb_A.bottom();
+        int r1 = bb_B.top();
+        int c0 = std::max(bb_A.left(), bb_B.left());
+        int c1 = std::min(bb_A.right(), bb_B.right());
+        if (c0 > c1)
+          return false;
+        if (bb_A.left() < bb_B.left() && bb_A.right() - bb_B.left() < 2*min_corridor_half_width)
+          return false;
+        if (bb_B.left() < bb_A.left() && bb_B.right() - bb_A.left() < 2*min_corridor_half_width)
+          return false;
+        auto collides_with_bb = [r0, r1, c0, c1](const ttl::Rectangle bb) -> bool
+        {
+          if (r0 <= bb.top() && bb.bottom() <= r1)
+          {
+            if (bb.left() <= c0 && c1 <= bb.right())
+              return true;
+            if (c0 <= bb.left() && bb.left() <= c1)
+              return true;
+            if (c0 <= bb.right() && bb.right() <= c1)
+              return true;
+          }
+          return false;
+        };
+        // Anything colliding overlaps the span between the two rooms.
+        bool collided = f_collides({ r0, c0, r1 - r0 + 1, c1 - c0 + 1 }, collides_with_bb);
+        if (!collided)
+        {
+          auto key = std::pair { std::min(leaf_A, leaf_B), std::max(leaf_A, leaf_B) };
+          auto it = room_corridor_idcs.find(key);
+          if (it == room_corridor_idcs.end())
+          {
+            f_add_corridor(key, { r0, (c0 + c1)/2 - min_corridor_half_width, r1 - r0 + 1, 2*min_corridor_half_width + 1 }, Orientation::Vertical);
+            return true;
+          }
+        }
+        return false;
+      };
+      
+      // Collects the rooms to the right of (horizontal) or below (vertical)
+      //   leaf_A that overlap it across the corridor direction, in order of
+      //   increasing distance. Once the rooms passed so far cover every
+      //   row (column) of leaf_A, any room further away would have a corridor
+      //   colliding with one of them, so the scan stops there.
+      std::vector<int> scan_stamps(num_leaves, -1);
+      int scan_ctr = 0;
+      std::vector<int> batch;
+      std::vector<char> covered;
+      auto f_collect_candidates = [&](int idx_A, bool horizontal, std::vector<int>& candidates)
+      {
+        auto f_lo_along = [horizontal](const auto& bb) { return horizontal ? bb.left() : bb.top(); };
+        auto f_hi_along = [horizontal](const auto& bb) { return horizontal ? bb.right() : bb.bottom(); };
+        auto f_lo_across = [horizontal](const auto& bb) { return horizontal ? bb.top() : bb.left(); };
+        auto f_hi_across = [horizontal](const auto& bb) { return horizontal ? bb.bottom() : bb.right(); };
+        
+        const auto& bb_A = leaves[idx_A]->bb_leaf_room;
+        int start = f_hi_along(bb_A);
+        int a0 = f_lo_across(bb_A);
+        int a1 = f_hi_across(bb_A);
+        if (a0 > a1)
+          return;
+        covered.assign(a1 - a0 + 1, 0);
+        int num_uncovered = a1 - a0 + 1;
+        // Rooms passed but not yet counted as covering, ordered by their far edge.
+        std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> pending;
+        
+        int stamp = scan_ctr++;
+        int num_buckets_along = horizontal ? room_grid.num_bucket_cols() : room_grid.num_bucket_rows();
+        int b_along_0 = horizontal ? room_grid.to_bucket_col(start) : room_grid.to_bucket_row(start);
+        int bx0 = horizontal ? room_grid.to_bucket_row(a0) : room_grid.to_bucket_col(a0);
+        int bx1 = horizontal ? room_grid.to_bucket_row(a1) : room_grid.to_bucket_col(a1);
+        for (int ba = b_along_0; ba < num_buckets_along; ++ba)
+        {
+          // Only take rooms whose near edge lies in this bucket row/column.
+          batch.clear();
+          for (int bx = bx0; bx <= bx1; ++bx)
+          {
+            for (int idx : horizontal ? room_grid.get_bucket(bx, ba) : room_grid.get_bucket(ba, bx))
             {
-              // Horizontal approach
-              auto bb_A = leaf_A->bb_leaf_room;
-              auto bb_B = leaf_B->bb_leaf_room;
-              if (bb_A.right() > bb_B.left())
-                return false;
-              
-              int c0 = bb_A.right();
-              int c1 = bb_B.left();
-              int r0 = std::max(bb_A.top(), bb_B.top());
-              int r1 = std::min(bb_A.bottom(), bb_B.bottom());
-              if (r0 > r1)
-                return false;
-              if (bb_A.top() < bb_B.top() && bb_A.bottom() - bb_B.top() < 2*min_corridor_half_width)
-                return false;
-              if (bb_B.top() < bb_A.top() && bb_B.bottom() - bb_A.top() < 2*min_corridor_half_width)
-                return false;
-              bool collided = false;
-              auto collides_with_bb = [r0, r1, c0, c1](const ttl::Rectangle bb) -> bool
-              {
-                if (c0 <= bb.left() && bb.right() <= c1)
-                {
-                  if (bb.top() <= r0 && r1 <= bb.bottom())
-                    return true;
-                  if (r0 <= bb.top() && bb.top() <= r1)
-                    return true;
-                  if (r0 <= bb.bottom() && bb.bottom() <= r1)
-                    return true;
-                }
-                return false;
-              };
-              for (auto* leaf_C : leaves)
-              {
-                auto bb_C = leaf_C->bb_leaf_room;
-                collided = collides_with_bb(bb_C);
-                if (collided)
-                  break;
-              }
-              if (!collided)
-              {
-                for (const auto& cp : room_corridor_map)
-                {
-                  auto bb_corr = cp.second->bb;
-                  collided = collides_with_bb(bb_corr);
-                  if (collided)
-                    break;
-                }
-              }
-              if (!collided)
-              {
-                auto key = std::pair { std::min(leaf_A, leaf_B), std::max(leaf_A, leaf_B) };
-                auto it = room_corridor_map.find(key);
-                if (it == room_corridor_map.end())
-                {
-                  auto* corr = corridors.emplace_back(std::make_unique<Corridor>()).get();
-                  corr->bb = { (r0 + r1)/2 - min_corridor_half_width, c0, 2*min_corridor_half_width + 1, c1 - c0 + 1 };
-                  corr->orientation = Orientation::Horizontal;
-                  size_t surf_area = corr->bb.r_len * corr->bb.c_len;
-                  corr->fog_of_war.resize(surf_area, true);
-                  corr->light.resize(surf_area, false);
-                  room_corridor_map[key] = corr;
-                  return true;
-                }
-              }
-              return false;
-            };
-            
-            auto try_make_vertical_corridor = [&](auto* leaf_A, auto* leaf_B)
+              const auto& bb = leaves[idx]->bb_leaf_room;
+              int lo = f_lo_along(bb);
+              if (lo < start || (horizontal ? room_grid.to_bucket_col(lo) : room_grid.to_bucket_row(lo)) != ba)
+                continue;
+              if (f_hi_across(bb) < a0 || f_lo_across(bb) > a1)
+                continue;
+              if (scan_stamps[idx] == stamp)
+                continue;
+              scan_stamps[idx] = stamp;
+              batch.emplace_back(idx);
+            }
+          }
+          std::sort(batch.begin(), batch.end(), [&](int i, int j)
+          {
+            return f_lo_along(leaves[i]->bb_leaf_room) < f_lo_along(leaves[j]->bb_leaf_room);
+          });
+          for (int idx : batch)
+          {
+            const auto& bb = leaves[idx]->bb_leaf_room;
+            int lo = f_lo_along(bb);
+            while (!pending.empty() && pending.top().first <= lo)
             {
-              // Horizontal approach
-              auto bb_A = leaf_A->bb_leaf_room;
-              auto bb_B = leaf_B->bb_leaf_room;
-              if (bb_A.bottom() > bb_B.top())
-                return false;
-              
-              int r0 = bb_A.bottom();
-              int r1 = bb_B.top();
-              int c0 = std::max(bb_A.left(), bb_B.left());
-              int c1 = std::min(bb_A.right(), bb_B.right());
-              if (c0 > c1)
-                return false;
-              if (bb_A.left() < bb_B.left() && bb_A.right() - bb_B.left() < 2*min_corridor_half_width)
-                return false;
-              if (bb_B.left() < bb_A.left() && bb_B.right() - bb_A.left() < 2*min_corridor_half_width)
-                return false;
-              bool collided = false;
-              auto collides_with_bb = [r0, r1, c0, c1](const ttl::Rectangle bb) -> bool
-              {
-                if (r0 <= bb.top() && bb.bottom() <= r1)
-                {
-                  if (bb.left() <= c0 && c1 <= bb.right())
-                    return true;
-                  if (c0 <= bb.left() && bb.left() <= c1)
-                    return true;
-                  if (c0 <= bb.right() && bb.right() <= c1)
-                    return true;
-                }
-                return false;
-              };
-              for (auto* leaf_C : leaves)
-              {
-                auto bb_C = leaf_C->bb_leaf_room;
-                collided = collides_with_bb(bb_C);
-                if (collided)
-                  break;
-              }
-              if (!collided)
-              {
-                for (const auto& cp : room_corridor_map)
+              const auto& bb_C = leaves[pending.top().second]->bb_leaf_room;
+              int x1 = std::min(f_hi_across(bb_C), a1);
+              for (int x = std::max(f_lo_across(bb_C), a0); x <= x1; ++x)
+                if (!covered[x - a0])
                 {
-                  auto bb_corr = cp.second->bb;
-                  collided = collides_with_bb(bb_corr);
-                  if (collided)
-                    break;
+                  covered[x - a0] = 1;
+                  num_uncovered--;
                 }
-              }
-              if (!collided)
-              {
-                auto key = std::pair { std::min(leaf_A, leaf_B), std::max(leaf_A, leaf_B) };
-                auto it = room_corridor_map.find(key);
-                if (it == room_corridor_map.end())
-                {
-                  auto* corr = corridors.emplace_back(std::make_unique<Corridor>()).get();
-                  corr->bb = { r0, (c0 + c1)/2 - min_corridor_half_width, r1 - r0 + 1, 2*min_corridor_half_width + 1 };
-                  corr->orientation = Orientation::Vertical;
-                  size_t surf_area = corr->bb.r_len * corr->bb.c_len;
-                  corr->fog_of_war.resize(surf_area, true);
-                  corr->light.resize(surf_area, false);
-                  room_corridor_map[key] = corr;
-                  return true;
-                }
-              }
-              return false;
-            };
-            
-            if (!try_make_horizontal_corridor(leaf_A, leaf_B))
-              try_make_vertical_corridor(leaf_A, leaf_B);
-
+              pending.pop();
+            }
+            if (num_uncovered == 0)
+              return;
+            if (idx != idx_A)
+              candidates.emplace_back(idx);
+            pending.emplace(f_hi_along(bb), idx);
           }
         }
+      };
+      
+      std::vector<int> candidates;
+      for (int idx_A = 0; idx_A < num_leaves; ++idx_A)
+      {
+        candidates.clear();
+        f_collect_candidates(idx_A, true, candidates);
+        f_collect_candidates(idx_A, false, candidates);
+        // Same visiting order as looping over all leaves,
+        //   since earlier corridors may block later ones.
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        
+        auto* leaf_A = leaves[idx_A];
+        for (int idx_B : candidates)
+        {
+          auto* leaf_B = leaves[idx_B];
+          if (!try_make_horizontal_corridor(leaf_A, leaf_B))
+            try_make_vertical_corridor(leaf_A, leaf_B);
+        }
       }
+      
+      room_corridor_map.clear();
+      for (const auto& ci : room_corridor_idcs)
+        room_corridor_map[ci.first] = &corridors[ci.second];
+    }
+    
+    // Alternative to create_corridors(). Connects the two children of every internal node
+    //   by one corridor between a room on each side of the split, bottom-up, like the
+    //   classic BSP dungeon. The corridors may be bent (L- or Z-shaped) where no straight
+    //   corridor fits.
+    // Normally only rooms whose regions border the split line are considered, so it takes
+    //   O(L log L) time for L leaves on a balanced tree.
+    // Returns false if the rooms could not all be connected, e.g. if two tiny rooms touch
+    //   and have no other neighbours.
+    bool create_sibling_corridors(int min_corridor_half_width = 1)
+    {
+      const int w = min_corridor_half_width;
+      const auto& leaves = m_leaves;
+      auto num_leaves = stlutils::sizeI(leaves);
+      
+      SpatialGrid room_grid(get_world_size(), c_corridor_grid_bucket_size);
+      for (int leaf_idx = 0; leaf_idx < num_leaves; ++leaf_idx)
+        room_grid.insert(leaf_idx, leaves[leaf_idx]->bb_leaf_room);
+      SpatialGrid corridor_grid(get_world_size(), c_corridor_grid_bucket_size);
+      for (int corr_idx = 0; corr_idx < stlutils::sizeI(corridors); ++corr_idx)
+        corridor_grid.insert(corr_idx, corridors[corr_idx].bb);
+      
+      // Union-find over the leaves, so that a room that couldn't be connected to its
+      //   sibling gets connected through the sibling of its parent instead.
+      std::vector<int> component_idcs(num_leaves);
+      std::iota(component_idcs.begin(), component_idcs.end(), 0);
+      auto f_find = [&](int leaf_idx)
+      {
+        while (component_idcs[leaf_idx] != leaf_idx)
+          leaf_idx = component_idcs[leaf_idx] = component_idcs[component_idcs[leaf_idx]];
+        return leaf_idx;
+      };
+      
+      std::map<std::pair<BSPNode*, BSPNode*>, int> room_corridor_idcs;
+      for (const auto& cp : room_corridor_map)
+      {
+        room_corridor_idcs[cp.first] = static_cast<int>(cp.second - corridors.data());
+        component_idcs[f_find(get_room_id(cp.first.first))] = f_find(get_room_id(cp.first.second));
+      }
+      
+      auto f_overlaps = [](const ttl::Rectangle& a, const ttl::Rectangle& b)
+      {
+        return a.left() <= b.right() && b.left() <= a.right() && a.top() <= b.bottom() && b.top() <= a.bottom();
+      };
+      // room_legs : The legs without their cells on the room walls, which must not touch any room.
+      auto f_is_free = [&](std::span<const ttl::Rectangle> legs, std::span<const ttl::Rectangle> room_legs)
+      {
+        for (const auto& bb : room_legs)
+          if (!bb.is_empty() && room_grid.any_of(bb, [&](int leaf_idx) { return f_overlaps(bb, leaves[leaf_idx]->bb_leaf_room); }))
+            return false;
+        for (const auto& bb : legs)
+          if (corridor_grid.any_of(bb, [&](int corr_idx)
+          {
+            for (const auto& leg : corridors[corr_idx].get_legs())
+              if (f_overlaps(bb, leg))
+                return true;
+            return false;
+          }))
+            return false;
+        return true;
+      };
+      
+      // Leaf range of each node. The leaves of a subtree are contiguous since they
+      //   are stored in depth-first order.
+      int num_nodes = stlutils::sizeI(m_nodes);
+      std::vector<std::pair<int, int>> leaf_ranges(num_nodes);
+      for (int idx = num_nodes - 1; idx >= 0; --idx)
+      {
+        const auto& node = m_nodes[idx];
+        if (node.is_leaf())
+          leaf_ranges[idx] = { idx - m_first_leaf_idx, idx - m_first_leaf_idx + 1 };
+        else
+          leaf_ranges[idx] = { leaf_ranges[node.children[0]].first, leaf_ranges[node.children[1]].second };
+      }
+      
+      auto f_is_subtree_connected = [&](int node_idx)
+      {
+        auto [begin, end] = leaf_ranges[node_idx];
+        int root = f_find(begin);
+        for (int leaf_idx = begin + 1; leaf_idx < end; ++leaf_idx)
+          if (f_find(leaf_idx) != root)
+            return false;
+        return true;
+      };
+      
+      std::vector<int> frontier_0, frontier_1;
+      std::vector<std::pair<int, int>> pairs;
+      // Children before parents, so that the short corridors are laid out first.
+      for (int node_idx = m_first_leaf_idx - 1; node_idx >= 0; --node_idx)
+      {
+        const auto& node = m_nodes[node_idx];
+        if (node.children[0] < 0 || node.children[1] < 0)
+          continue;
+        // Vertical split : the children are side by side and are connected along the columns.
+        const bool side_by_side = node.orientation == Orientation::Vertical;
+        auto f_along_lo = [side_by_side](const auto& bb) { return side_by_side ? bb.left() : bb.top(); };
+        auto f_along_hi = [side_by_side](const auto& bb) { return side_by_side ? bb.right() : bb.bottom(); };
+        auto f_across_lo = [side_by_side](const auto& bb) { return side_by_side ? bb.top() : bb.left(); };
+        auto f_across_hi = [side_by_side](const auto& bb) { return side_by_side ? bb.bottom() : bb.right(); };
+        auto f_make_rect = [side_by_side](int al0, int al1, int ac0, int ac1) -> ttl::Rectangle
+        {
+          if (side_by_side)
+            return { ac0, al0, ac1 - ac0 + 1, al1 - al0 + 1 };
+          return { al0, ac0, al1 - al0 + 1, ac1 - ac0 + 1 };
+        };
+        const auto straight_orientation = side_by_side ? Orientation::Horizontal : Orientation::Vertical;
+        
+        // The leaves of each child whose regions are at most max_dist from the split line.
+        const auto& bb_1 = m_nodes[node.children[1]].bb_region;
+        int split = f_along_lo(bb_1);
+        auto f_collect_frontier = [&](int ch_nr, int max_dist, std::vector<int>& frontier)
+        {
+          frontier.clear();
+          auto [begin, end] = leaf_ranges[node.children[ch_nr]];
+          for (int leaf_idx = begin; leaf_idx < end; ++leaf_idx)
+          {
+            const auto& bb_region = leaves[leaf_idx]->bb_region;
+            int dist = ch_nr == 0 ? split - 1 - f_along_hi(bb_region) : f_along_lo(bb_region) - split;
+            if (dist <= max_dist)
+              frontier.emplace_back(leaf_idx);
+          }
+        };
+        
+        // Pairs with the most overlap across the split first.
+        auto f_room_overlap = [&](const std::pair<int, int>& p)
+        {
+          const auto& bb_A = leaves[p.first]->bb_leaf_room;
+          const auto& bb_B = leaves[p.second]->bb_leaf_room;
+          return std::min(f_across_hi(bb_A), f_across_hi(bb_B)) - std::max(f_across_lo(bb_A), f_across_lo(bb_B));
+        };
+        auto f_collect_pairs = [&](int max_dist)
+        {
+          f_collect_frontier(0, max_dist, frontier_0);
+          f_collect_frontier(1, max_dist, frontier_1);
+          pairs.clear();
+          for (int idx_A : frontier_0)
+            for (int idx_B : frontier_1)
+              pairs.emplace_back(idx_A, idx_B);
+          std::stable_sort(pairs.begin(), pairs.end(), [&](const auto& p, const auto& q)
+          {
+            return f_room_overlap(p) > f_room_overlap(q);
+          });
+        };
+        
+        auto f_try_straight = [&](const ttl::Rectangle& bb_A, const ttl::Rectangle& bb_B) -> std::optional<ttl::Rectangle>
+        {
+          int ac0 = std::max(f_across_lo(bb_A), f_across_lo(bb_B));
+          int ac1 = std::min(f_across_hi(bb_A), f_across_hi(bb_B));
+          int al0 = f_along_hi(bb_A);
+          int al1 = f_along_lo(bb_B);
+          if (ac1 - ac0 < 2*w || al1 <= al0)
+            return std::nullopt;
+          int mid = (ac0 + ac1)/2;
+          auto leg = f_make_rect(al0, al1, mid - w, mid + w);
+          std::array<ttl::Rectangle, 1> room_legs { f_make_rect(al0 + 1, al1 - 1, mid - w, mid + w) };
+          if (!f_is_free({ &leg, 1 }, room_legs))
+            return std::nullopt;
+          return leg;
+        };
+        
+        // Out of the wall of bb_from that faces the other child, then turning into
+        //   the wall of bb_to that faces bb_from across the split.
+        // forward : bb_from is in child 0.
+        auto f_try_bent = [&](const ttl::Rectangle& bb_from, const ttl::Rectangle& bb_to, bool forward)
+          -> std::optional<std::array<ttl::Rectangle, 2>>
+        {
+          // The doors are centered on the walls unless the corner doesn't fit then.
+          int m_from_lo = f_across_lo(bb_from) + w;
+          int m_from_hi = f_across_hi(bb_from) - w;
+          int m_to_lo = f_along_lo(bb_to) + w;
+          int m_to_hi = f_along_hi(bb_to) - w;
+          if (m_from_lo > m_from_hi || m_to_lo > m_to_hi)
+            return std::nullopt;
+          int m_from = (m_from_lo + m_from_hi)/2;
+          bool to_after = f_across_lo(bb_to) > m_from_lo + w;
+          if (to_after)
+            m_from = std::min(m_from, f_across_lo(bb_to) - w - 1);
+          else if (f_across_hi(bb_to) < m_from_hi - w)
+            m_from = std::max(m_from, f_across_hi(bb_to) + w + 1);
+          else
+            return std::nullopt;
+          // The corner square must be clear of the wall of bb_from.
+          int m_to = (m_to_lo + m_to_hi)/2;
+          if (forward)
+            m_to = std::max(m_to, f_along_hi(bb_from) + w + 1);
+          else
+            m_to = std::min(m_to, f_along_lo(bb_from) - w - 1);
+          if (m_to < m_to_lo || m_to > m_to_hi)
+            return std::nullopt;
+          int al0 = forward ? f_along_hi(bb_from) : m_to - w;
+          int al1 = forward ? m_to + w : f_along_lo(bb_from);
+          int ac0 = to_after ? m_from - w : f_across_hi(bb_to);
+          int ac1 = to_after ? f_across_lo(bb_to) : m_from + w;
+          std::array<ttl::Rectangle, 2> legs
+          {
+            f_make_rect(al0, al1, m_from - w, m_from + w),
+            f_make_rect(m_to - w, m_to + w, ac0, ac1)
+          };
+          std::array<ttl::Rectangle, 2> room_legs
+          {
+            f_make_rect(forward ? al0 + 1 : al0, forward ? al1 : al1 - 1, m_from - w, m_from + w),
+            f_make_rect(m_to - w, m_to + w, to_after ? ac0 : ac0 + 1, to_after ? ac1 - 1 : ac1)
+          };
+          if (!f_is_free(legs, room_legs))
+            return std::nullopt;
+          return legs;
+        };
+        
+        // Out of the wall of bb_A that faces bb_B, across in the gap between them and
+        //   then into the wall of bb_B that faces bb_A. For rooms that face each other
+        //   but are too offset for a straight corridor.
+        auto f_try_zigzag = [&](const ttl::Rectangle& bb_A, const ttl::Rectangle& bb_B)
+          -> std::optional<std::array<ttl::Rectangle, 3>>
+        {
+          int m_A_lo = f_across_lo(bb_A) + w;
+          int m_A_hi = f_across_hi(bb_A) - w;
+          int m_B_lo = f_across_lo(bb_B) + w;
+          int m_B_hi = f_across_hi(bb_B) - w;
+          // The middle leg must be clear of the walls of both rooms.
+          int m_mid_lo = f_along_hi(bb_A) + w + 1;
+          int m_mid_hi = f_along_lo(bb_B) - w - 1;
+          if (m_A_lo > m_A_hi || m_B_lo > m_B_hi || m_mid_lo > m_mid_hi)
+            return std::nullopt;
+          // As short a middle leg as possible.
+          int m_A = std::clamp((m_B_lo + m_B_hi)/2, m_A_lo, m_A_hi);
+          int m_B = std::clamp(m_A, m_B_lo, m_B_hi);
+          int m_mid = (m_mid_lo + m_mid_hi)/2;
+          int al0 = f_along_hi(bb_A);
+          int al1 = f_along_lo(bb_B);
+          std::array<ttl::Rectangle, 3> legs
+          {
+            f_make_rect(al0, m_mid + w, m_A - w, m_A + w),
+            f_make_rect(m_mid - w, m_mid + w, std::min(m_A, m_B) - w, std::max(m_A, m_B) + w),
+            f_make_rect(m_mid - w, al1, m_B - w, m_B + w)
+          };
+          std::array<ttl::Rectangle, 3> room_legs
+          {
+            f_make_rect(al0 + 1, m_mid + w, m_A - w, m_A + w),
+            legs[1],
+            f_make_rect(m_mid - w, al1 - 1, m_B - w, m_B + w)
+          };
+          if (!f_is_free(legs, room_legs))
+            return std::nullopt;
+          return legs;
+        };
+        
+        auto f_connect = [&](int idx_A, int idx_B)
+        {
+          auto* leaf_A = leaves[idx_A];
+          auto* leaf_B = leaves[idx_B];
+          const auto& bb_A = leaf_A->bb_leaf_room;
+          const auto& bb_B = leaf_B->bb_leaf_room;
+          Corridor corr;
+          if (auto leg = f_try_straight(bb_A, bb_B); leg.has_value())
+            corr.set_straight(leg.value(), straight_orientation);
+          else if (auto legs_AB = f_try_bent(bb_A, bb_B, true); legs_AB.has_value())
+            corr.set_bent(legs_AB.value(), straight_orientation);
+          else if (auto legs_BA = f_try_bent(bb_B, bb_A, false); legs_BA.has_value())
+            corr.set_bent(legs_BA.value(), straight_orientation);
+          else if (auto legs_Z = f_try_zigzag(bb_A, bb_B); legs_Z.has_value())
+            corr.set_bent(legs_Z.value(), straight_orientation);
+          else
+            return false;
+          auto key = std::pair { std::min(leaf_A, leaf_B), std::max(leaf_A, leaf_B) };
+          if (!room_corridor_idcs.contains(key))
+          {
+            int corr_idx = stlutils::sizeI(corridors);
+            auto& new_corr = corridors.emplace_back(corr);
+            bind_fields(new_corr, new_corr.bb);
+            room_corridor_idcs[key] = corr_idx;
+            corridor_grid.insert(corr_idx, new_corr.bb);
+          }
+          component_idcs[f_find(idx_A)] = f_find(idx_B);
+          return true;
+        };
+        
+        // Normally one corridor between the rooms bordering the split line does it.
+        //   If none of them can be connected, e.g. since they are narrow and offset, or if
+        //   a child is still in pieces, widen the search until the whole children are covered.
+        int size_along = f_along_hi(node.bb_region) - f_along_lo(node.bb_region) + 1;
+        bool connected = f_is_subtree_connected(node_idx);
+        for (int max_dist = 0; !connected; max_dist = std::max(2*max_dist, m_min_room_length))
+        {
+          f_collect_pairs(max_dist);
+          for (const auto& [idx_A, idx_B] : pairs)
+          {
+            if (f_find(idx_A) == f_find(idx_B) || !f_connect(idx_A, idx_B))
+              continue;
+            connected = f_is_subtree_connected(node_idx);
+            if (connected)
+              break;
+          }
+          if (max_dist >= size_along)
+            break;
+        }
+      }
+      
+      room_corridor_map.clear();
+      for (const auto& ci : room_corridor_idcs)
+        room_corridor_map[ci.first] = &corridors[ci.second];
+      return num_leaves == 0 || f_is_subtree_connected(0);
     }
     
     void create_doors(int max_num_locked_doors, bool allow_passageways)
     {
       int key_id_ctr = 0;
       int num_locked_doors = 0;
+      // Any doors from an earlier call are replaced, and the door arena is
+      //   reserved up front, so that the door pointers handed out stay valid.
+      doors.clear();
+      for (auto* leaf : m_leaves)
+        leaf->doors.clear();
+      doors.reserve(2*room_corridor_map.size());
       for (auto& cp : room_corridor_map)
       {
         auto* room_0 = cp.first.first;
         auto* room_1 = cp.first.second;
-        auto* door_0 = doors.emplace_back(std::make_unique<Door>()).get();
-        auto* door_1 = doors.emplace_back(std::make_unique<Door>()).get();
+        auto* door_0 = &doors.emplace_back();
+        auto* door_1 = &doors.emplace_back();
         
         if (allow_passageways)
         {
@@ -544,93 +1018,275 @@ namespace dung
         auto* corr = cp.second;
         door_0->corridor = corr;
         door_1->corridor = corr;
-        constexpr auto err_msg = "ERROR in BSPTree::create_doors() : Unable to find a door for room.";
-        switch (corr->orientation)
+        // The door ends on the wall of one of the two rooms.
+        auto f_place_door = [&](Door* door, int door_idx)
         {
-          case Orientation::Horizontal:
+          door->pos = corr->get_door_pos(door_idx);
+          for (auto* room : { room_0, room_1 })
           {
-            auto r_mid = corr->bb.r + corr->bb.r_len / 2;
-            door_0->pos = { r_mid, corr->bb.left() };
-            door_1->pos = { r_mid, corr->bb.right() };
-            
-            if (room_0->bb_leaf_room.right() == corr->bb.left())
+            const auto& bb = room->bb_leaf_room;
+            bool on_wall = bb.is_inside(door->pos)
+              && (door->pos.r == bb.top() || door->pos.r == bb.bottom()
+                  || door->pos.c == bb.left() || door->pos.c == bb.right());
+            if (on_wall)
             {
-              room_0->doors.emplace_back(door_0);
-              door_0->room = room_0;
+              room->doors.emplace_back(door);
+              door->room = room;
+              return;
             }
-            else if (room_1->bb_leaf_room.right() == corr->bb.left())
-            {
-              room_1->doors.emplace_back(door_0);
-              door_0->room = room_1;
-            }
-            else
-              std::cerr << err_msg << std::endl;
-              
-            if (room_0->bb_leaf_room.left() == corr->bb.right())
-            {
-              room_0->doors.emplace_back(door_1);
-              door_1->room = room_0;
-            }
-            else if (room_1->bb_leaf_room.left() == corr->bb.right())
-            {
-              room_1->doors.emplace_back(door_1);
-              door_1->room = room_1;
-            }
-            else
-              std::cerr << err_msg << std::endl;
-            break;
-          }
-          case Orientation::Vertical:
-          {
-            auto c_mid = corr->bb.c + corr->bb.c_len / 2;
-            door_0->pos = { corr->bb.top(), c_mid };
-            door_1->pos = { corr->bb.bottom(), c_mid };
-            
-            if (room_0->bb_leaf_room.bottom() == corr->bb.top())
-            {
-              room_0->doors.emplace_back(door_0);
-              door_0->room = room_0;
-            }
-            else if (room_1->bb_leaf_room.bottom() == corr->bb.top())
-            {
-              room_1->doors.emplace_back(door_0);
-              door_0->room = room_1;
-            }
-            else
-              std::cerr << err_msg << std::endl;
-              
-            if (room_0->bb_leaf_room.top() == corr->bb.bottom())
-            {
-              room_0->doors.emplace_back(door_1);
-              door_1->room = room_0;
-            }
-            else if (room_1->bb_leaf_room.top() == corr->bb.bottom())
-            {
-              room_1->doors.emplace_back(door_1);
-              door_1->room = room_1;
-            }
-            else
-              std::cerr << err_msg << std::endl;
-            break;
           }
-        }
+          std::cerr << "ERROR in BSPTree::create_doors() : Unable to find a door for room." << std::endl;
+        };
+        f_place_door(door_0, 0);
+        f_place_door(door_1, 1);
         corr->doors[0] = door_0;
         corr->doors[1] = door_1;
       }
+      
+      build_door_lookups();
     }
     
-    std::map<std::pair<BSPNode*, BSPNode*>, Corridor*> get_room_corridor_map() const
+    const std::map<std::pair<BSPNode*, BSPNode*>, Corridor*>& get_room_corridor_map() const
     {
       return room_corridor_map;
     }
     
-    std::vector<Door*> fetch_doors() const
+    const std::vector<Door*>& fetch_doors() const
     {
-      std::vector<Door*> doors_raw;
-      doors_raw.reserve(doors.size());
-      for (const auto& d : doors)
-        doors_raw.emplace_back(d.get());
-      return doors_raw;
+      return m_door_ptrs;
+    }
+    
+    // Room / corridor / door connectivity. Valid after create_doors().
+    const AdjacencyGraph& get_adjacency_graph() const
+    {
+      return m_graph;
+    }
+    
+    // Dense ids : the index of the room among the leaves and the index of
+    //   the corridor / door in its pool.
+    int get_room_id(const BSPNode* room) const
+    {
+      return room != nullptr && room->is_leaf() ? static_cast<int>(room - &m_nodes[m_first_leaf_idx]) : -1;
+    }
+    int get_corridor_id(const Corridor* corr) const
+    {
+      return corr != nullptr ? static_cast<int>(corr - corridors.data()) : -1;
+    }
+    int get_door_id(const Door* door) const
+    {
+      return door != nullptr ? static_cast<int>(door - doors.data()) : -1;
+    }
+    int get_num_rooms() const { return stlutils::sizeI(m_leaves); }
+    int get_num_corridors() const { return stlutils::sizeI(corridors); }
+    BSPNode* fetch_room(int room_id) { return m_leaves[room_id]; }
+    Corridor* fetch_corridor(int corr_id) { return &corridors[corr_id]; }
+    Door* fetch_door(int door_id) { return &doors[door_id]; }
+    
+    BitPlane& fetch_explored_plane() { return m_explored; }
+    BitPlane& fetch_lit_plane() { return m_lit; }
+    BitPlane& fetch_visible_plane() { return m_visible; }
+    const BitPlane& get_explored_plane() const { return m_explored; }
+    const BitPlane& get_lit_plane() const { return m_lit; }
+    const BitPlane& get_visible_plane() const { return m_visible; }
+    
+    // Memory held by the explored, lit and visible planes.
+    BitPlaneMemoryStats calc_field_memory_stats() const
+    {
+      BitPlaneMemoryStats stats;
+      for (const auto* plane : { &m_explored, &m_lit, &m_visible })
+        stats.add(*plane);
+      return stats;
+    }
+    
+    // Nodes, corridors, doors and the room / corridor map with all pointers stored as ids.
+    // Fog of war and light are not stored.
+    void write_snapshot(BinaryWriter& writer) const
+    {
+      writer.write<int32_t>(m_min_room_length);
+      writer.write<int32_t>(m_first_leaf_idx);
+      
+      writer.write(static_cast<uint32_t>(m_nodes.size()));
+      for (const auto& node : m_nodes)
+      {
+        writer.write<int32_t>(static_cast<int32_t>(node.orientation));
+        writer.write<float>(node.split_fraction);
+        writer.write<int32_t>(node.size_rows);
+        writer.write<int32_t>(node.size_cols);
+        writer.write_rect(node.bb_region);
+        writer.write_rect(node.bb_leaf_room);
+        writer.write<int32_t>(node.children[0]);
+        writer.write<int32_t>(node.children[1]);
+        writer.write<int32_t>(node.level);
+      }
+      
+      writer.write(static_cast<uint32_t>(corridors.size()));
+      for (const auto& corr : corridors)
+      {
+        writer.write<int32_t>(corr.num_legs);
+        for (const auto& leg : corr.get_legs())
+          writer.write_rect(leg);
+        writer.write<int32_t>(static_cast<int32_t>(corr.orientation));
+        writer.write<int32_t>(get_door_id(corr.doors[0]));
+        writer.write<int32_t>(get_door_id(corr.doors[1]));
+      }
+      
+      writer.write(static_cast<uint32_t>(doors.size()));
+      for (const auto& door : doors)
+      {
+        writer.write_rc(door.pos);
+        writer.write<bool>(door.is_door);
+        writer.write<bool>(door.is_open);
+        writer.write<bool>(door.is_locked);
+        writer.write<int32_t>(door.key_id);
+        writer.write<int32_t>(get_room_id(door.room));
+        writer.write<int32_t>(get_corridor_id(door.corridor));
+      }
+      
+      writer.write(static_cast<uint32_t>(room_corridor_map.size()));
+      for (const auto& cp : room_corridor_map)
+      {
+        writer.write<int32_t>(get_room_id(cp.first.first));
+        writer.write<int32_t>(get_room_id(cp.first.second));
+        writer.write<int32_t>(get_corridor_id(cp.second));
+      }
+    }
+    
+    // Replaces the whole tree. Returns false if the data is truncated or inconsistent,
+    //   in which case the tree is left empty.
+    bool read_snapshot(BinaryReader& reader)
+    {
+      clear();
+      
+      auto f_fail = [this](const char* err_msg)
+      {
+        std::cerr << "ERROR in BSPTree::read_snapshot() : " << err_msg << std::endl;
+        clear();
+        return false;
+      };
+      
+      int32_t min_room_length = 0;
+      int32_t first_leaf_idx = 0;
+      reader.read(min_room_length);
+      reader.read(first_leaf_idx);
+      
+      uint32_t num_nodes = 0;
+      if (!reader.read_count(num_nodes, 60))
+        return f_fail("Truncated nodes.");
+      m_nodes.resize(num_nodes);
+      for (auto& node : m_nodes)
+      {
+        int32_t orientation = 0;
+        reader.read(orientation);
+        node.orientation = static_cast<Orientation>(orientation);
+        reader.read(node.split_fraction);
+        reader.read(node.size_rows);
+        reader.read(node.size_cols);
+        reader.read_rect(node.bb_region);
+        reader.read_rect(node.bb_leaf_room);
+        reader.read(node.children[0]);
+        reader.read(node.children[1]);
+        reader.read(node.level);
+        for (int ch_idx : node.children)
+          if (ch_idx >= static_cast<int>(num_nodes))
+            return f_fail("Invalid child index.");
+      }
+      if (!reader.ok() || num_nodes == 0 || first_leaf_idx < 0 || first_leaf_idx >= static_cast<int>(num_nodes))
+        return f_fail("Invalid nodes.");
+      m_min_room_length = min_room_length;
+      m_first_leaf_idx = first_leaf_idx;
+      reset_planes();
+      for (int idx = m_first_leaf_idx; idx < stlutils::sizeI(m_nodes); ++idx)
+      {
+        auto& leaf = m_nodes[idx];
+        if (!leaf.is_leaf())
+          return f_fail("Internal node among the leaves.");
+        m_leaves.emplace_back(&leaf);
+        bind_fields(leaf, leaf.bb_leaf_room);
+      }
+      
+      uint32_t num_corridors = 0;
+      if (!reader.read_count(num_corridors, 32))
+        return f_fail("Truncated corridors.");
+      corridors.resize(num_corridors);
+      std::vector<std::array<int32_t, 2>> corridor_door_ids(num_corridors);
+      for (int corr_idx = 0; corr_idx < static_cast<int>(num_corridors); ++corr_idx)
+      {
+        auto& corr = corridors[corr_idx];
+        int32_t num_legs = 0;
+        int32_t orientation = 0;
+        std::array<ttl::Rectangle, 3> legs;
+        reader.read(num_legs);
+        if (num_legs < 1 || num_legs > 3)
+          return f_fail("Invalid number of corridor legs.");
+        for (int leg_idx = 0; leg_idx < num_legs; ++leg_idx)
+          reader.read_rect(legs[leg_idx]);
+        reader.read(orientation);
+        if (num_legs == 1)
+          corr.set_straight(legs[0], static_cast<Orientation>(orientation));
+        else
+          corr.set_bent({ legs.data(), static_cast<size_t>(num_legs) }, static_cast<Orientation>(orientation));
+        reader.read(corridor_door_ids[corr_idx][0]);
+        reader.read(corridor_door_ids[corr_idx][1]);
+        bind_fields(corr, corr.bb);
+      }
+      
+      uint32_t num_doors = 0;
+      if (!reader.read_count(num_doors, 23))
+        return f_fail("Truncated doors.");
+      doors.resize(num_doors);
+      for (auto& door : doors)
+      {
+        int32_t room_id = -1;
+        int32_t corr_id = -1;
+        reader.read_rc(door.pos);
+        reader.read(door.is_door);
+        reader.read(door.is_open);
+        reader.read(door.is_locked);
+        reader.read(door.key_id);
+        reader.read(room_id);
+        reader.read(corr_id);
+        if (room_id >= get_num_rooms() || corr_id >= get_num_corridors())
+          return f_fail("Invalid door room or corridor.");
+        // Same order as create_doors() added them to the rooms.
+        if (room_id >= 0)
+        {
+          door.room = fetch_room(room_id);
+          door.room->doors.emplace_back(&door);
+        }
+        if (corr_id >= 0)
+          door.corridor = fetch_corridor(corr_id);
+      }
+      for (int corr_idx = 0; corr_idx < static_cast<int>(num_corridors); ++corr_idx)
+        for (int i = 0; i < 2; ++i)
+        {
+          auto door_id = corridor_door_ids[corr_idx][i];
+          if (door_id < 0 || door_id >= static_cast<int>(num_doors))
+            return f_fail("Invalid corridor door.");
+          corridors[corr_idx].doors[i] = fetch_door(door_id);
+        }
+      
+      uint32_t num_pairs = 0;
+      if (!reader.read_count(num_pairs, 12))
+        return f_fail("Truncated room / corridor map.");
+      for (uint32_t pair_idx = 0; pair_idx < num_pairs; ++pair_idx)
+      {
+        int32_t room_id_0 = -1;
+        int32_t room_id_1 = -1;
+        int32_t corr_id = -1;
+        reader.read(room_id_0);
+        reader.read(room_id_1);
+        reader.read(corr_id);
+        if (room_id_0 < 0 || room_id_0 >= get_num_rooms()
+            || room_id_1 < 0 || room_id_1 >= get_num_rooms()
+            || corr_id < 0 || corr_id >= get_num_corridors())
+          return f_fail("Invalid room / corridor map entry.");
+        room_corridor_map[{ fetch_room(room_id_0), fetch_room(room_id_1) }] = fetch_corridor(corr_id);
+      }
+      if (!reader.ok())
+        return f_fail("Truncated data.");
+      
+      build_door_lookups();
+      return true;
     }
     
     template<int NR, int NC>
@@ -638,7 +1294,11 @@ namespace dung
                       int r0 = 0, int c0 = 0,
                       const styles::Style& border_style = { Color::Black, Color::Yellow }) const
     {
-      m_root.draw_regions(sh, r0, c0, border_style);
+      for (const auto& node : m_nodes)
+      {
+        const auto& bb_region = node.bb_region;
+        drawing::draw_box_outline(sh, r0 + bb_region.r, c0 + bb_region.c, bb_region.r_len, bb_region.c_len, drawing::OutlineType::Hash, border_style);
+      }
     }
     
     template<int NR, int NC>
@@ -646,7 +1306,16 @@ namespace dung
                     int r0 = 0, int c0 = 0,
                     const styles::Style& room_style = { Color::White, Color::DarkRed }) const
     {
-      m_root.draw_rooms(sh, r0, c0, room_style);
+      for (const auto* leaf : m_leaves)
+      {
+        const auto& bb_leaf_room = leaf->bb_leaf_room;
+        if (!bb_leaf_room.is_empty())
+        {
+          drawing::draw_box_outline(sh,
+                   r0 + bb_leaf_room.r, c0 + bb_leaf_room.c, bb_leaf_room.r_len, bb_leaf_room.c_len,
+                   drawing::OutlineType::Hash, room_style);
+        }
+      }
     }
     
     template<int NR, int NC>
@@ -657,15 +1326,24 @@ namespace dung
     {
       for (const auto& corr : room_corridor_map)
       {
-        const auto& bb = corr.second->bb;
-        drawing::draw_box_outline(sh, r0 + bb.r, c0 + bb.c, bb.r_len, bb.c_len, drawing::OutlineType::Hash, corridor_outline_style);
-        drawing::draw_box(sh, r0 + bb.r, c0 + bb.c, bb.r_len, bb.c_len, corridor_fill_style);
+        const auto* corridor = corr.second;
+        // The first drawn character of a cell stays. For bent corridors, the insides
+        //   go first so that the walls of one leg don't cut across the other leg.
+        if (corridor->is_bent())
+          for (const auto& bb : corridor->get_legs())
+            drawing::draw_box(sh, r0 + bb.r, c0 + bb.c, bb.r_len, bb.c_len, corridor_fill_style);
+        for (const auto& bb : corridor->get_legs())
+        {
+          drawing::draw_box_outline(sh, r0 + bb.r, c0 + bb.c, bb.r_len, bb.c_len, drawing::OutlineType::Hash, corridor_outline_style);
+          drawing::draw_box(sh, r0 + bb.r, c0 + bb.c, bb.r_len, bb.c_len, corridor_fill_style);
+        }
       }
     }
     
     void print_tree() const
     {
-      m_root.print_tree();
+      if (!m_nodes.empty())
+        print_node(0, "");
     }
   };
   
@@ -0,0 +1,199 @@
+//
+//  BinaryStream.h
+//  DungGine
+//
+
+#pragma once
+#include <Termin8or/RC.h>
+#include <Termin8or/Rectangle.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+
+namespace dung
+{
+
+  // Native-endian binary serialization of trivially copyable values, vectors of them and strings.
+  // Vectors and strings are stored as a 32 bit element count followed by the elements.
+  class BinaryWriter final
+  {
+    std::vector<char> m_buffer;
+
+  public:
+    template<typename T>
+    void write(const T& val)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      const auto* bytes = reinterpret_cast<const char*>(&val);
+      m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    void write_vector(const std::vector<T>& vec)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      write(static_cast<uint32_t>(vec.size()));
+      const auto* bytes = reinterpret_cast<const char*>(vec.data());
+      m_buffer.insert(m_buffer.end(), bytes, bytes + vec.size()*sizeof(T));
+    }
+
+    // Appends what another writer wrote, without a count.
+    void write_bytes(const std::vector<char>& bytes)
+    {
+      m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+    }
+
+    void write_string(const std::string& str)
+    {
+      write(static_cast<uint32_t>(str.size()));
+      m_buffer.insert(m_buffer.end(), str.begin(), str.end());
+    }
+
+    void write_rc(const RC& pos)
+    {
+      write<int32_t>(pos.r);
+      write<int32_t>(pos.c);
+    }
+
+    void write_rect(const ttl::Rectangle& bb)
+    {
+      write<int32_t>(bb.r);
+      write<int32_t>(bb.c);
+      write<int32_t>(bb.r_len);
+      write<int32_t>(bb.c_len);
+    }
+
+    const std::vector<char>& get_buffer() const { return m_buffer; }
+    size_t size() const { return m_buffer.size(); }
+    // Keeps the capacity, for reuse as a scratch buffer.
+    void clear() { m_buffer.clear(); }
+
+    bool save(const std::string& file_path) const
+    {
+      std::ofstream file { file_path, std::ios::binary };
+      if (!file)
+      {
+        std::cerr << "ERROR in BinaryWriter::save() : Unable to open \"" << file_path << "\" for writing!" << std::endl;
+        return false;
+      }
+      file.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+      return static_cast<bool>(file);
+    }
+
+    // Saves to a temporary file that then replaces file_path, so that a crash
+    //   while saving leaves the old file intact.
+    bool save_replace(const std::string& file_path) const
+    {
+      const auto tmp_path = file_path + ".tmp";
+      if (!save(tmp_path))
+        return false;
+      std::error_code ec;
+      std::filesystem::rename(tmp_path, file_path, ec);
+      if (ec)
+      {
+        std::cerr << "ERROR in BinaryWriter::save_replace() : Unable to replace \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+      return true;
+    }
+  };
+
+  // Reads what BinaryWriter wrote, e.g. straight out of a MappedFile.
+  // Reading past the end fails and leaves the reader failed, so a sequence of reads
+  //   can be checked once with ok().
+  class BinaryReader final
+  {
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_offs = 0;
+    bool m_ok = true;
+
+    bool can_read(size_t num_bytes)
+    {
+      if (m_ok && num_bytes > m_size - m_offs)
+        m_ok = false;
+      return m_ok;
+    }
+
+  public:
+    BinaryReader(const unsigned char* data, size_t size)
+      : m_data(data)
+      , m_size(size)
+    {}
+
+    template<typename T>
+    bool read(T& val)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      if (!can_read(sizeof(T)))
+        return false;
+      std::memcpy(&val, m_data + m_offs, sizeof(T));
+      m_offs += sizeof(T);
+      return true;
+    }
+
+    // Reads an element count and checks that the elements could fit in the rest of the
+    //   data, assuming each takes at least min_elem_size bytes.
+    bool read_count(uint32_t& count, size_t min_elem_size)
+    {
+      if (!read(count))
+        return false;
+      return can_read(static_cast<size_t>(count)*min_elem_size);
+    }
+
+    template<typename T>
+    bool read_vector(std::vector<T>& vec)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      uint32_t count = 0;
+      if (!read_count(count, sizeof(T)))
+        return false;
+      vec.resize(count);
+      if (count > 0)
+        std::memcpy(vec.data(), m_data + m_offs, count*sizeof(T));
+      m_offs += count*sizeof(T);
+      return true;
+    }
+
+    bool read_string(std::string& str)
+    {
+      uint32_t count = 0;
+      if (!read_count(count, 1))
+        return false;
+      str.assign(reinterpret_cast<const char*>(m_data + m_offs), count);
+      m_offs += count;
+      return true;
+    }
+
+    bool read_rc(RC& pos)
+    {
+      int32_t r = 0, c = 0;
+      read(r);
+      read(c);
+      pos = { r, c };
+      return m_ok;
+    }
+
+    bool read_rect(ttl::Rectangle& bb)
+    {
+      int32_t r = 0, c = 0, r_len = 0, c_len = 0;
+      read(r);
+      read(c);
+      read(r_len);
+      read(c_len);
+      bb = { r, c, r_len, c_len };
+      return m_ok;
+    }
+
+    bool ok() const { return m_ok; }
+    size_t tell() const { return m_offs; }
+    bool at_end() const { return m_offs == m_size; }
+  };
+
+}
@@ -0,0 +1,380 @@
+//
+//  BitPlane.h
+//  DungGine
+//
+
+#pragma once
+#include <Termin8or/Rectangle.h>
+#include <Core/bool_vector.h>
+#include <Core/StlUtils.h>
+#include <array>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace dung
+{
+
+  // One bit per world cell, e.g. explored, lit or visible.
+  // The cells are stored in tiles of 64 x 64 cells with one 64-bit word per tile row.
+  // A tile is only allocated once one of its cells is set, and is freed again when
+  //   a clear leaves it empty, so unexplored parts of the world cost no memory.
+  // The rectangle operations work on whole words. Full tile rows are plain loops over
+  //   the 64 words of a tile, which the compiler vectorizes.
+  class BitPlane final
+  {
+  public:
+    static constexpr int c_tile_size = 64;
+
+  private:
+    using Tile = std::array<uint64_t, c_tile_size>;
+    std::vector<std::unique_ptr<Tile>> m_tiles;
+    int m_num_rows = 0;
+    int m_num_cols = 0;
+    int m_num_tile_rows = 0;
+    int m_num_tile_cols = 0;
+
+    // Bits c0 .. c1 (inclusive) of a word.
+    static uint64_t span_mask(int c0, int c1)
+    {
+      uint64_t hi = c1 >= 63 ? ~uint64_t(0) : (uint64_t(1) << (c1 + 1)) - 1;
+      return hi & (~uint64_t(0) << c0);
+    }
+
+    std::unique_ptr<Tile>& tile_at(int tr, int tc) { return m_tiles[tr * m_num_tile_cols + tc]; }
+    const Tile* find_tile(int tr, int tc) const { return m_tiles[tr * m_num_tile_cols + tc].get(); }
+
+    Tile& fetch_tile(int tr, int tc)
+    {
+      auto& tile = tile_at(tr, tc);
+      if (tile == nullptr)
+      {
+        tile = std::make_unique<Tile>();
+        tile->fill(0);
+      }
+      return *tile;
+    }
+
+    // The 64 cells of row r from column c on, with cell c in bit 0.
+    //   Cells to the right of the plane are 0.
+    uint64_t get_word(int r, int c) const
+    {
+      int tr = r / c_tile_size, tc = c / c_tile_size;
+      int row = r % c_tile_size, offs = c % c_tile_size;
+      uint64_t word = 0;
+      if (const auto* tile = find_tile(tr, tc); tile != nullptr)
+        word = (*tile)[row] >> offs;
+      if (offs > 0 && tc + 1 < m_num_tile_cols)
+        if (const auto* tile = find_tile(tr, tc + 1); tile != nullptr)
+          word |= (*tile)[row] << (c_tile_size - offs);
+      return word;
+    }
+
+    // The inverse of get_word(), but only sets cells. Only allocates tiles that get cells set.
+    void or_word(int r, int c, uint64_t word)
+    {
+      int tr = r / c_tile_size, tc = c / c_tile_size;
+      int row = r % c_tile_size, offs = c % c_tile_size;
+      if (auto lo = word << offs; lo != 0)
+        fetch_tile(tr, tc)[row] |= lo;
+      if (offs > 0)
+        if (auto hi = word >> (c_tile_size - offs); hi != 0)
+          fetch_tile(tr, tc + 1)[row] |= hi;
+    }
+
+    void free_if_empty(int tr, int tc)
+    {
+      auto& tile = tile_at(tr, tc);
+      if (tile == nullptr)
+        return;
+      uint64_t any = 0;
+      for (auto word : *tile)
+        any |= word;
+      if (any == 0)
+        tile.reset();
+    }
+
+    // Clips bb to the plane. Returns false if nothing is left.
+    bool clip(const ttl::Rectangle& bb, int& r0, int& c0, int& r1, int& c1) const
+    {
+      r0 = std::max(bb.top(), 0);
+      c0 = std::max(bb.left(), 0);
+      r1 = std::min(bb.bottom(), m_num_rows - 1);
+      c1 = std::min(bb.right(), m_num_cols - 1);
+      return r0 <= r1 && c0 <= c1;
+    }
+
+    // Calls func(tr, tc, row_begin, row_end, mask) for each tile overlapped by bb,
+    //   with the local rows [row_begin, row_end) and the column mask within the tile.
+    template<typename Lambda>
+    void for_each_tile(const ttl::Rectangle& bb, Lambda func) const
+    {
+      int r0 = 0, c0 = 0, r1 = 0, c1 = 0;
+      if (!clip(bb, r0, c0, r1, c1))
+        return;
+      for (int tr = r0 / c_tile_size; tr <= r1 / c_tile_size; ++tr)
+      {
+        int tile_r0 = tr * c_tile_size;
+        int row_begin = std::max(r0 - tile_r0, 0);
+        int row_end = std::min(r1 - tile_r0, c_tile_size - 1) + 1;
+        for (int tc = c0 / c_tile_size; tc <= c1 / c_tile_size; ++tc)
+        {
+          int tile_c0 = tc * c_tile_size;
+          auto mask = span_mask(std::max(c0 - tile_c0, 0), std::min(c1 - tile_c0, c_tile_size - 1));
+          func(tr, tc, row_begin, row_end, mask);
+        }
+      }
+    }
+
+  public:
+    // Frees all tiles.
+    void reset(int num_rows, int num_cols)
+    {
+      m_num_rows = std::max(num_rows, 0);
+      m_num_cols = std::max(num_cols, 0);
+      m_num_tile_rows = (m_num_rows + c_tile_size - 1) / c_tile_size;
+      m_num_tile_cols = (m_num_cols + c_tile_size - 1) / c_tile_size;
+      m_tiles.clear();
+      m_tiles.resize(static_cast<size_t>(m_num_tile_rows) * m_num_tile_cols);
+    }
+
+    void clear()
+    {
+      for (auto& tile : m_tiles)
+        tile.reset();
+    }
+
+    int num_rows() const { return m_num_rows; }
+    int num_cols() const { return m_num_cols; }
+
+    bool is_inside(int r, int c) const
+    {
+      return 0 <= r && r < m_num_rows && 0 <= c && c < m_num_cols;
+    }
+
+    bool get(int r, int c) const
+    {
+      if (!is_inside(r, c))
+        return false;
+      const auto* tile = find_tile(r / c_tile_size, c / c_tile_size);
+      return tile != nullptr && (((*tile)[r % c_tile_size] >> (c % c_tile_size)) & 1u) != 0;
+    }
+    bool get(const RC& pos) const { return get(pos.r, pos.c); }
+
+    void set(int r, int c, bool val)
+    {
+      fill_rect({ r, c, 1, 1 }, val);
+    }
+
+    // Sets or clears cells c0 .. c1 (inclusive) of row r.
+    void fill_span(int r, int c0, int c1, bool val)
+    {
+      fill_rect({ r, c0, 1, c1 - c0 + 1 }, val);
+    }
+
+    void fill_rect(const ttl::Rectangle& bb, bool val)
+    {
+      for_each_tile(bb, [&](int tr, int tc, int row_begin, int row_end, uint64_t mask)
+      {
+        if (val)
+        {
+          auto& tile = fetch_tile(tr, tc);
+          for (int row = row_begin; row < row_end; ++row)
+            tile[row] |= mask;
+        }
+        else if (auto* tile = tile_at(tr, tc).get(); tile != nullptr)
+        {
+          for (int row = row_begin; row < row_end; ++row)
+            (*tile)[row] &= ~mask;
+          free_if_empty(tr, tc);
+        }
+      });
+    }
+
+    // The number of set cells within bb.
+    int count_rect(const ttl::Rectangle& bb) const
+    {
+      int num_set = 0;
+      for_each_tile(bb, [&](int tr, int tc, int row_begin, int row_end, uint64_t mask)
+      {
+        const auto* tile = find_tile(tr, tc);
+        if (tile == nullptr)
+          return;
+        for (int row = row_begin; row < row_end; ++row)
+          num_set += std::popcount((*tile)[row] & mask);
+      });
+      return num_set;
+    }
+
+    int count() const
+    {
+      int num_set = 0;
+      for (const auto& tile : m_tiles)
+        if (tile != nullptr)
+          for (auto word : *tile)
+            num_set += std::popcount(word);
+      return num_set;
+    }
+
+    bool any_rect(const ttl::Rectangle& bb) const { return count_rect(bb) > 0; }
+
+    // The number of words that copy_words() uses for bb.
+    static int num_words(const ttl::Rectangle& bb)
+    {
+      return bb.r_len * ((bb.c_len + c_tile_size - 1) / c_tile_size);
+    }
+
+    // Copies the cells within bb, which must lie within the plane, row by row with
+    //   (bb.c_len + 63) / 64 words per row and the leftmost cell of a row in bit 0.
+    void copy_words(const ttl::Rectangle& bb, std::vector<uint64_t>& words) const
+    {
+      words.assign(num_words(bb), 0);
+      auto* word = words.data();
+      for (int r = bb.top(); r <= bb.bottom(); ++r)
+        for (int c = bb.left(); c <= bb.right(); c += c_tile_size)
+          *word++ = get_word(r, c) & span_mask(0, std::min(bb.right() - c, c_tile_size - 1));
+    }
+
+    // Replaces the cells within bb with words copied by copy_words().
+    void set_words(const ttl::Rectangle& bb, const std::vector<uint64_t>& words)
+    {
+      if (stlutils::sizeI(words) != num_words(bb))
+        return;
+      fill_rect(bb, false);
+      const auto* word = words.data();
+      for (int r = bb.top(); r <= bb.bottom(); ++r)
+        for (int c = bb.left(); c <= bb.right(); c += c_tile_size)
+          or_word(r, c, *word++ & span_mask(0, std::min(bb.right() - c, c_tile_size - 1)));
+    }
+
+    int num_tiles() const { return stlutils::sizeI(m_tiles); }
+    int num_allocated_tiles() const
+    {
+      return static_cast<int>(std::count_if(m_tiles.begin(), m_tiles.end(),
+                                            [](const auto& tile) { return tile != nullptr; }));
+    }
+    size_t num_allocated_bytes() const { return num_allocated_tiles() * sizeof(Tile); }
+    size_t num_bytes_if_allocated() const { return m_tiles.size() * sizeof(Tile); }
+  };
+
+  // The cells of a plane within the bounding box of a room or corridor, indexed
+  //   row-major like a field of size bb.r_len * bb.c_len.
+  // An inverted view reads and writes the complement, e.g. the fog of war of a room
+  //   is an inverted view into the explored plane.
+  class BitPlaneView final
+  {
+    BitPlane* m_plane = nullptr;
+    ttl::Rectangle m_bb;
+    bool m_inverted = false;
+
+  public:
+    BitPlaneView() = default;
+    BitPlaneView(BitPlane* plane, const ttl::Rectangle& bb, bool inverted)
+      : m_plane(plane)
+      , m_bb(bb)
+      , m_inverted(inverted)
+    {}
+
+    // The same plane within another rectangle, e.g. one leg of a bent corridor.
+    BitPlaneView sub_view(const ttl::Rectangle& bb) const { return { m_plane, bb, m_inverted }; }
+
+    int size() const { return m_plane != nullptr ? m_bb.r_len * m_bb.c_len : 0; }
+    const ttl::Rectangle& get_bb() const { return m_bb; }
+    // The value of cells that have never been set, e.g. true (fogged) for the fog of war.
+    bool get_default() const { return m_inverted; }
+    bool is_default() const { return m_plane == nullptr || !m_plane->any_rect(m_bb); }
+
+    bool operator[](int idx) const
+    {
+      return get(m_bb.r + idx / m_bb.c_len, m_bb.c + idx % m_bb.c_len);
+    }
+
+    // World coordinates. Cells outside of the view have the default value.
+    bool get(int r, int c) const
+    {
+      if (m_plane == nullptr || !m_bb.is_inside({ r, c }))
+        return m_inverted;
+      return m_plane->get(r, c) != m_inverted;
+    }
+    bool get(const RC& world_pos) const { return get(world_pos.r, world_pos.c); }
+
+    void set(int idx, bool val)
+    {
+      if (m_plane != nullptr)
+        m_plane->set(m_bb.r + idx / m_bb.c_len, m_bb.c + idx % m_bb.c_len, val != m_inverted);
+    }
+
+    // Local row r, local columns c0 .. c1 (inclusive), clipped to the view.
+    void fill_span(int r, int c0, int c1, bool val)
+    {
+      if (m_plane == nullptr || r < 0 || r >= m_bb.r_len)
+        return;
+      c0 = std::max(c0, 0);
+      c1 = std::min(c1, m_bb.c_len - 1);
+      if (c0 <= c1)
+        m_plane->fill_span(m_bb.r + r, m_bb.c + c0, m_bb.c + c1, val != m_inverted);
+    }
+
+    // Filling with the default value may free tiles.
+    void fill(bool val)
+    {
+      if (m_plane != nullptr)
+        m_plane->fill_rect(m_bb, val != m_inverted);
+    }
+
+    // The number of cells that are true in this view.
+    int count() const
+    {
+      int num_set = m_plane != nullptr ? m_plane->count_rect(m_bb) : 0;
+      return m_inverted ? size() - num_set : num_set;
+    }
+
+    // The cells of the view a word at a time, see BitPlane::copy_words().
+    //   A set bit is a cell without the default value, also in an inverted view.
+    int num_words() const { return m_plane != nullptr ? BitPlane::num_words(m_bb) : 0; }
+    void copy_words(std::vector<uint64_t>& words) const
+    {
+      if (m_plane != nullptr)
+        m_plane->copy_words(m_bb, words);
+      else
+        words.clear();
+    }
+    void set_words(const std::vector<uint64_t>& words)
+    {
+      if (m_plane != nullptr)
+        m_plane->set_words(m_bb, words);
+    }
+
+    // For functions that take a row-major field, e.g. the drawing functions.
+    void copy_to(bool_vector& cells) const
+    {
+      cells.resize(size(), false);
+      for (int r = 0; r < m_bb.r_len; ++r)
+        for (int c = 0; c < m_bb.c_len; ++c)
+          cells[r * m_bb.c_len + c] = get(m_bb.r + r, m_bb.c + c);
+    }
+  };
+
+  struct BitPlaneMemoryStats
+  {
+    int num_tiles = 0;
+    int num_allocated_tiles = 0;
+    // Bytes of tile storage.
+    size_t allocated_bytes = 0;
+    // What allocating every tile up front would take.
+    size_t eager_bytes = 0;
+
+    void add(const BitPlane& plane)
+    {
+      num_tiles += plane.num_tiles();
+      num_allocated_tiles += plane.num_allocated_tiles();
+      allocated_bytes += plane.num_allocated_bytes();
+      eager_bytes += plane.num_bytes_if_allocated();
+    }
+  };
+
+}
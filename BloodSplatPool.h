@@ -0,0 +1,104 @@
+//
+//  BloodSplatPool.h
+//  DungGine
+//
+
+#pragma once
+#include "PlayerBase.h"
+#include <Core/StlUtils.h>
+#include <vector>
+
+
+namespace dung
+{
+
+  // Fixed capacity storage for the blood splats of the PC and all NPCs.
+  // When full, the oldest splat is recycled for the new one.
+  // The splats never move in memory (until the capacity is changed), so they can
+  //   be referred to by pointer, e.g. from ObjectIndex.
+  // Only splats that are still drifting on a liquid are updated. Splats on dry land
+  //   and splats that have run out of life time are static decals.
+  class BloodSplatPool final
+  {
+    std::vector<BloodSplat> m_splats;
+    int m_capacity = 500;
+    int m_oldest_idx = 0;
+    // Indices of the splats that still need updating.
+    std::vector<int> m_active_idcs;
+    std::vector<bool> m_is_active;
+
+  public:
+    explicit BloodSplatPool(int capacity = 500)
+    {
+      set_capacity(capacity);
+    }
+
+    // Removes all splats.
+    void set_capacity(int capacity)
+    {
+      m_capacity = std::max(capacity, 1);
+      m_splats.clear();
+      m_splats.shrink_to_fit();
+      m_splats.reserve(m_capacity);
+      m_oldest_idx = 0;
+      m_active_idcs.clear();
+      m_is_active.assign(m_capacity, false);
+    }
+
+    int get_capacity() const { return m_capacity; }
+    int size() const { return stlutils::sizeI(m_splats); }
+    bool full() const { return size() == m_capacity; }
+
+    // The splat that the next add() will recycle when the pool is full.
+    BloodSplat& get_oldest() { return m_splats[m_oldest_idx]; }
+
+    BloodSplat& add(const BloodSplat& bs)
+    {
+      int idx = 0;
+      if (full())
+      {
+        idx = m_oldest_idx;
+        m_splats[idx] = bs;
+        m_oldest_idx = (m_oldest_idx + 1) % m_capacity;
+      }
+      else
+      {
+        idx = size();
+        m_splats.emplace_back(bs);
+      }
+      if (!m_is_active[idx])
+      {
+        m_is_active[idx] = true;
+        m_active_idcs.emplace_back(idx);
+      }
+      return m_splats[idx];
+    }
+
+    // Updates the drifting splats and retires the ones that have come to rest.
+    void update(float curr_time)
+    {
+      for (int i = 0; i < stlutils::sizeI(m_active_idcs);)
+      {
+        int idx = m_active_idcs[i];
+        auto& bs = m_splats[idx];
+        bs.update(curr_time);
+        if (is_wet(bs.terrain) && bs.alive)
+          ++i;
+        else
+        {
+          m_is_active[idx] = false;
+          m_active_idcs[i] = m_active_idcs.back();
+          m_active_idcs.pop_back();
+        }
+      }
+    }
+
+    int num_active() const { return stlutils::sizeI(m_active_idcs); }
+
+    auto begin() { return m_splats.begin(); }
+    auto end() { return m_splats.end(); }
+    auto begin() const { return m_splats.begin(); }
+    auto end() const { return m_splats.end(); }
+  };
+
+}
@@ -7,9 +7,12 @@
 
 #pragma once
 #include "Orientation.h"
+#include "BitPlane.h"
 #include <Core/Utils.h>
+#include <Core/StlUtils.h>
 #include <Termin8or/Rectangle.h>
-#include <Core/bool_vector.h>
+#include <array>
+#include <span>
 
 
 namespace dung
@@ -19,15 +22,93 @@ namespace dung
 
   struct Corridor
   {
+    // The whole corridor. For a bent corridor, the bounding box of its legs.
     ttl::Rectangle bb;
+    // Of the first leg.
     Orientation orientation = Orientation::Vertical;
+    // A straight corridor has one leg, which is bb. A bent corridor has two (L-shaped)
+    //   or three (Z-shaped) legs of alternating orientation, where consecutive legs
+    //   share a corner square.
+    std::array<ttl::Rectangle, 3> legs;
+    int num_legs = 1;
+    // Straight: doors[0] at the top / left end.
+    // Bent: doors[0] at the open end of the first leg and doors[1] at the open end of the last leg.
     std::array<Door*, 2> doors;
     
-    bool_vector fog_of_war;
-    bool_vector light;
+    // Views into the world-level planes of the owning BSPTree.
+    BitPlaneView fog_of_war;
+    BitPlaneView light;
+    BitPlaneView visible;
+    
+    void set_straight(const ttl::Rectangle& leg, Orientation leg_orientation)
+    {
+      bb = leg;
+      orientation = leg_orientation;
+      legs = { leg, leg, leg };
+      num_legs = 1;
+    }
+    
+    // Two or three legs. Each leg is perpendicular to the previous one and overlaps
+    //   one of its ends by a square.
+    void set_bent(std::span<const ttl::Rectangle> bent_legs, Orientation leg_0_orientation)
+    {
+      num_legs = std::min(stlutils::sizeI(bent_legs), static_cast<int>(legs.size()));
+      int r1 = 0, c1 = 0;
+      for (int leg_idx = 0; leg_idx < num_legs; ++leg_idx)
+      {
+        const auto& leg = bent_legs[leg_idx];
+        legs[leg_idx] = leg;
+        bb.r = leg_idx == 0 ? leg.top() : std::min(bb.r, leg.top());
+        bb.c = leg_idx == 0 ? leg.left() : std::min(bb.c, leg.left());
+        r1 = leg_idx == 0 ? leg.bottom() : std::max(r1, leg.bottom());
+        c1 = leg_idx == 0 ? leg.right() : std::max(c1, leg.right());
+      }
+      bb.r_len = r1 - bb.r + 1;
+      bb.c_len = c1 - bb.c + 1;
+      orientation = leg_0_orientation;
+    }
+    
+    bool is_bent() const { return num_legs > 1; }
+    std::span<const ttl::Rectangle> get_legs() const { return { legs.data(), static_cast<size_t>(num_legs) }; }
+    
+    Orientation get_leg_orientation(int leg_idx) const
+    {
+      return leg_idx % 2 == 0 ? orientation : static_cast<Orientation>(1 - static_cast<int>(orientation));
+    }
+    
+    // The leg that doors[door_idx] is at the end of.
+    int get_door_leg_idx(int door_idx) const
+    {
+      return door_idx == 0 ? 0 : num_legs - 1;
+    }
+    
+    // Whether the door of the first or last leg is at its top / left end.
+    bool is_door_at_low_end(int leg_idx) const
+    {
+      if (!is_bent())
+        return leg_idx == 0;
+      // The other end is the corner, which the neighbouring leg covers.
+      const auto& leg = legs[leg_idx];
+      const auto& other = legs[leg_idx == 0 ? 1 : leg_idx - 1];
+      return get_leg_orientation(leg_idx) == Orientation::Horizontal ?
+        other.left() != leg.left() : other.top() != leg.top();
+    }
+    
+    // Where doors[door_idx] goes, in the middle of the end of its leg.
+    RC get_door_pos(int door_idx) const
+    {
+      int leg_idx = get_door_leg_idx(door_idx);
+      const auto& leg = legs[leg_idx];
+      bool low_end = is_bent() ? is_door_at_low_end(leg_idx) : door_idx == 0;
+      if (get_leg_orientation(leg_idx) == Orientation::Horizontal)
+        return { leg.r + leg.r_len / 2, low_end ? leg.left() : leg.right() };
+      return { low_end ? leg.top() : leg.bottom(), leg.c + leg.c_len / 2 };
+    }
     
     bool is_inside_corridor(const RC& pos, ttl::BBLocation* location = nullptr) const
     {
+      if (is_bent())
+        return is_inside_bent_corridor(pos, location);
       switch (orientation)
       {
         case Orientation::Vertical:
@@ -67,22 +148,54 @@ namespace dung
       }
     }
     
+    // Each leg is walled at its corner ends, so that the union of their insides is the L or Z.
+    bool is_inside_bent_corridor(const RC& pos, ttl::BBLocation* location) const
+    {
+      std::array<ttl::BBLocation, 3> leg_locations;
+      for (int leg_idx = 0; leg_idx < num_legs; ++leg_idx)
+      {
+        const auto& leg = legs[leg_idx];
+        int lo_offs = -1;
+        int hi_offs = -1;
+        if (leg_idx == 0 || leg_idx == num_legs - 1)
+        {
+          int door_offs = doors[leg_idx == 0 ? 0 : 1]->open_or_no_door() ? 0 : -1;
+          (is_door_at_low_end(leg_idx) ? lo_offs : hi_offs) = door_offs;
+        }
+        bool inside = false;
+        if (get_leg_orientation(leg_idx) == Orientation::Vertical)
+        {
+          leg_locations[leg_idx] = leg.find_location_offs(pos, lo_offs, hi_offs, -1, -1);
+          inside = leg.is_inside_offs(pos, lo_offs, hi_offs, -1, -1);
+        }
+        else
+        {
+          leg_locations[leg_idx] = leg.find_location_offs(pos, -1, -1, lo_offs, hi_offs);
+          inside = leg.is_inside_offs(pos, -1, -1, lo_offs, hi_offs);
+        }
+        if (inside)
+        {
+          utils::try_set(location, leg_locations[leg_idx]);
+          return true;
+        }
+      }
+      // Outside : relative to the first leg that pos is on the wall of, if any.
+      int wall_leg_idx = 0;
+      for (int leg_idx = num_legs - 1; leg_idx >= 0; --leg_idx)
+        if (legs[leg_idx].is_inside(pos))
+          wall_leg_idx = leg_idx;
+      utils::try_set(location, leg_locations[wall_leg_idx]);
+      return false;
+    }
+    
     bool is_in_fog_of_war(const RC& world_pos)
     {
-      auto local_pos = world_pos - bb.pos();
-      auto idx = local_pos.r * bb.c_len + local_pos.c;
-      if (math::in_range<int>(idx, 0, stlutils::sizeI(fog_of_war), Range::ClosedOpen))
-        return fog_of_war[idx];
-      return true;
+      return fog_of_war.get(world_pos);
     }
     
     bool is_in_light(const RC& world_pos)
     {
-      auto local_pos = world_pos - bb.pos();
-      auto idx = local_pos.r * bb.c_len + local_pos.c;
-      if (math::in_range<int>(idx, 0, stlutils::sizeI(light), Range::ClosedOpen))
-        return light[idx];
-      return false;
+      return light.get(world_pos);
     }
   };
 
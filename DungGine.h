@@ -18,12 +18,24 @@
 #include "Globals.h"
 #include "DungGineListener.h"
 #include "Inventory.h"
+#include "SlotMap.h"
+#include "ObjectIndex.h"
+#include "BloodSplatPool.h"
+#include "PlacementEngine.h"
+#include "DungeonSnapshot.h"
+#include "SaveGame.h"
+#include "MappedFile.h"
 #include "Keyboard.h"
+#include "FieldStencil.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
 #include <Termin8or/Keyboard.h>
 #include <Termin8or/MessageHandler.h>
 #include <Core/FolderHelper.h>
 #include <Core/events/EventBroadcaster.h>
 #include <Core/Utils.h>
+#include <future>
+#include <chrono>
 
 using namespace utils::literals;
 
@@ -34,6 +46,7 @@ namespace dung
 
   class DungGine final : public EventBroadcaster<DungGineListener>
   {
+    BSPTree* m_bsp_tree = nullptr;
     std::unique_ptr<Environment> m_environment;
     
     bool m_use_per_room_lat_long_for_sun_dir = true;
@@ -47,11 +60,15 @@ namespace dung
     float m_sun_minutes_per_year = 120.f;
     float m_sun_year_t_offs = 0.f;
     float m_t_solar_period = 0.f;
+    float m_t_season_period = 0.f;
     
     bool debug = false;
     
     PC m_player;
     std::vector<NPC> all_npcs;
+    // Runs the NPC updates. Each NPC draws from its own RandStream, seeded when placed,
+    //   so the result is the same for any number of threads.
+    ThreadPool m_npc_thread_pool;
     
     std::unique_ptr<ScreenHelper> m_screen_helper;
     
@@ -59,19 +76,119 @@ namespace dung
     
     std::unique_ptr<Keyboard> m_keyboard;
     
-    std::vector<Key> all_keys;
+    SlotMap<Key> all_keys;
     // Lamps illuminate items and NPCs. If you've already discovered an item or
     //   NPC using a lamp (and after FOW been cleared),
     //   then they will still be visible when the room is not lit.
     // Lamps will not work in surface level rooms.
-    std::vector<Lamp> all_lamps;
-    std::vector<std::unique_ptr<Weapon>> all_weapons;
-    std::vector<Potion> all_potions;
-    std::vector<std::unique_ptr<Armour>> all_armour;
+    SlotMap<Lamp> all_lamps;
+    SlotMap<std::unique_ptr<Weapon>> all_weapons;
+    SlotMap<Potion> all_potions;
+    SlotMap<std::unique_ptr<Armour>> all_armour;
+    
+    BloodSplatPool m_blood_splat_pool;
+    
+    PlacementEngine m_placement_engine;
+    
+    // The items on the ground and the blood splats by room / corridor and by cell.
+    ObjectIndex m_object_index;
+    // The room and corridor of the PC at the last clear_field(). Objects elsewhere
+    //   have already been cleared.
+    const BSPNode* m_field_room = nullptr;
+    const Corridor* m_field_corridor = nullptr;
+    
+    // What the light and FOW fields were computed from. They are only recomputed
+    //   when any of these change or when blood splats are drifting.
+    struct FieldInputs
+    {
+      RC pos;
+      float los_r = 0.f;
+      float los_c = 0.f;
+      const BSPNode* room = nullptr;
+      const Corridor* corridor = nullptr;
+      bool use_fog_of_war = false;
+      float fow_radius = 0.f;
+      const Lamp* lamp = nullptr;
+      float lamp_radius = 0.f;
+      float lamp_angle_deg = 0.f;
+      Lamp::LightType lamp_light_type = Lamp::LightType::Isotropic;
+      unsigned int objects_version = 0;
+      
+      bool operator==(const FieldInputs& other) const = default;
+    };
+    std::optional<FieldInputs> m_field_inputs;
     
     std::unique_ptr<MessageHandler> message_handler;
     bool use_fog_of_war = false;
     
+    // Light and FOW shapes, reused between frames.
+    FieldStencilCache m_field_stencils;
+    
+    // Keys, lamps, weapons, potions and armour, see for_each_item_store().
+    static constexpr int c_num_item_stores = 5;
+    // What the last save wrote, so that autosave() can write only what has changed since.
+    struct Checkpoint
+    {
+      std::string file_path;
+      uint64_t save_id = 0;
+      size_t file_size = 0;
+      // Per item store. The handles and record hashes by checkpoint index and
+      //   the checkpoint indices by slot index (-1 for free slots).
+      std::array<std::vector<SlotHandle>, c_num_item_stores> item_handles;
+      std::array<std::vector<uint64_t>, c_num_item_stores> item_hashes;
+      std::array<std::vector<int>, c_num_item_stores> item_idcs;
+      std::vector<uint64_t> npc_hashes;
+      std::vector<uint64_t> door_hashes;
+    };
+    // Shared with the autosave thread that writes a delta against it.
+    std::shared_ptr<const Checkpoint> m_checkpoint;
+    // The size of the last delta written against the checkpoint.
+    size_t m_delta_size = 0;
+    // Rooms and corridors whose fog of war may have changed since the checkpoint, by id.
+    std::vector<bool> m_fow_dirty_rooms;
+    std::vector<bool> m_fow_dirty_corridors;
+    // The tree and the environment of a save. They only change when a dungeon is loaded
+    //   or styled, apart from the door states that the runtime block overrides, so they
+    //   are serialized once and shared with the autosave thread.
+    std::shared_ptr<const std::vector<char>> m_dungeon_bytes;
+    // What a save writes, copied on the frame so that the autosave thread can serialize and
+    //   hash it while the game goes on. Named like the members of the engine, so that
+    //   for_each_item_store() and write_snapshot_objects() take either.
+    // The weapons and armour are copied as Weapon and Armour, which hold all that is saved.
+    struct SaveState
+    {
+      Latitude latitude = Latitude::NorthernHemisphere;
+      Longitude longitude = Longitude::F;
+      float sun_minutes_per_day = 0.f;
+      float sun_minutes_per_year = 0.f;
+      float t_solar_period = 0.f;
+      float t_season_period = 0.f;
+      bool use_per_room_lat_long_for_sun_dir = true;
+      PC m_player;
+      // Per item store, whether the carried items are selected in the inventory,
+      //   in the order of the handles in m_player.
+      std::array<std::vector<bool>, c_num_item_stores> selected_items;
+      std::vector<Door> doors;
+      // The fog of war by room and corridor id.
+      std::vector<std::pair<int, savegame::FieldCopy>> room_fow;
+      std::vector<std::pair<int, savegame::FieldCopy>> corridor_fow;
+      SlotMap<Key> all_keys;
+      SlotMap<Lamp> all_lamps;
+      SlotMap<std::unique_ptr<Weapon>> all_weapons;
+      SlotMap<Potion> all_potions;
+      SlotMap<std::unique_ptr<Armour>> all_armour;
+      std::vector<NPC> all_npcs;
+    };
+    // What the autosave thread reports back. A full save comes with its checkpoint.
+    struct SaveResult
+    {
+      bool ok = false;
+      std::shared_ptr<const Checkpoint> checkpoint;
+      size_t delta_size = 0;
+    };
+    // The save being written in the background. Destroying it waits for the write.
+    std::future<SaveResult> m_autosave_future;
+    
     const std::vector<std::string> c_fight_strings { "(", "#", ")", "%", "*" };
     const std::vector<Color> c_fight_colors { Color::Red, Color::Yellow, Color::Blue, Color::Magenta, Color::White, Color::Black, Color::LightGray, Color::DarkGray };
     enum class FightDir { NW, W, SW, S, SE, E, NE, N, NUM_ITEMS };
@@ -90,19 +207,41 @@ namespace dung
       m_t_solar_period = std::fmod(m_sun_day_t_offs + (real_time_s / 60.f) / m_sun_minutes_per_day, 1.f);
       m_sun_dir = m_solar_motion.get_solar_direction(m_latitude, m_longitude, m_season, m_t_solar_period);
       
-      float t_season_period = std::fmod(m_sun_year_t_offs + (real_time_s / 60.f) / m_sun_minutes_per_year, 1.f);
-      m_season = static_cast<Season>(math::roundI(7*t_season_period));
+      m_t_season_period = std::fmod(m_sun_year_t_offs + (real_time_s / 60.f) / m_sun_minutes_per_year, 1.f);
+      m_season = static_cast<Season>(math::roundI(7*m_t_season_period));
+    }
+    
+    static Item* get_item_ptr(Item& item) { return &item; }
+    static const Item* get_item_ptr(const Item& item) { return &item; }
+    template<typename T>
+    static Item* get_item_ptr(std::unique_ptr<T>& item) { return item.get(); }
+    template<typename T>
+    static const Item* get_item_ptr(const std::unique_ptr<T>& item) { return item.get(); }
+    
+    // Creates the inventory groups in the order they are listed.
+    void init_inventory()
+    {
+      m_inventory->fetch_group("Lamps:")->fetch_subgroup(0);
+      m_inventory->fetch_group("Keys:")->fetch_subgroup(0);
+      m_inventory->fetch_group("Weapons:")->fetch_subgroup(0)->set_title("Melee:");
+      m_inventory->fetch_group("Potions:")->fetch_subgroup(0);
+      auto* armour_group = m_inventory->fetch_group("Armour:");
+      armour_group->fetch_subgroup(ARMOUR_Shield)->set_title("Shields:");
+      armour_group->fetch_subgroup(ARMOUR_Gambeson)->set_title("Gambesons:");
+      armour_group->fetch_subgroup(ARMOUR_ChainMailleHauberk)->set_title("Chain-Maille Hauberks:");
+      armour_group->fetch_subgroup(ARMOUR_PlatedBodyArmour)->set_title("Plated Body Armour:");
+      armour_group->fetch_subgroup(ARMOUR_PaddedCoif)->set_title("Padded Coifs:");
+      armour_group->fetch_subgroup(ARMOUR_ChainMailleCoif)->set_title("Chain-Maille Coifs:");
+      armour_group->fetch_subgroup(ARMOUR_Helmet)->set_title("Helmets:");
     }
     
+    // Adds inventory rows for the items picked up since the last call.
+    // Rows of dropped or consumed items are removed where that happens,
+    //   and PC::curr_tot_inv_weight is kept up to date by PC::on_item_picked_up() / on_item_removed().
     void update_inventory()
     {
-      auto num_inv_keys = stlutils::sizeI(m_player.key_idcs);
-      auto num_inv_lamps = stlutils::sizeI(m_player.lamp_idcs);
-      auto num_inv_wpns = stlutils::sizeI(m_player.weapon_idcs);
-      auto num_inv_potions = stlutils::sizeI(m_player.potion_idcs);
-      auto num_inv_armour = stlutils::sizeI(m_player.armour_idcs);
-      
-      m_player.curr_tot_inv_weight = 0.f;
+      if (m_player.inv_items_added.empty())
+        return;
       
       auto f_format_item_str = [](std::string& item_str, float weight, float price, int hp)
       {
@@ -127,188 +266,144 @@ namespace dung
         }
       };
       
-      auto* keys_group = m_inventory->fetch_group("Keys:");
-      auto* keys_subgroup = keys_group->fetch_subgroup(0);
-      for (int inv_key_idx = 0; inv_key_idx < num_inv_keys; ++inv_key_idx)
-      {
-        auto key_idx = m_player.key_idcs[inv_key_idx];
-        auto& key = all_keys[key_idx];
-        std::string item_str = "  Key:" + std::to_string(key.key_id);
-        f_format_item_str(item_str, key.weight, key.price, 0);
-        if (keys_subgroup->find_item(&key) == nullptr)
-          keys_subgroup->add_item(item_str, &key);
-        m_player.curr_tot_inv_weight += key.weight;
-      }
-      
-      auto* lamps_group = m_inventory->fetch_group("Lamps:");
-      auto* lamps_subgroup = lamps_group->fetch_subgroup(0);
-      for (int inv_lamp_idx = 0; inv_lamp_idx < num_inv_lamps; ++inv_lamp_idx)
-      {
-        auto lamp_idx = m_player.lamp_idcs[inv_lamp_idx];
-        auto& lamp = all_lamps[lamp_idx];
-        auto lamp_type = lamp.get_type_str();
-        str::to_upper(lamp_type[0]);
-        std::string item_str = "  "s + lamp_type + ":" + std::to_string(lamp_idx);
-        f_format_item_str(item_str, lamp.weight, lamp.price, 0);
-        if (lamps_subgroup->find_item(&lamp) == nullptr)
-          lamps_subgroup->add_item(item_str, &lamp);
-        m_player.curr_tot_inv_weight += lamp.weight;
-      }
-      
-      auto* weapons_group = m_inventory->fetch_group("Weapons:");
-      auto* weapons_subgroup_melee = weapons_group->fetch_subgroup(0);
-      weapons_subgroup_melee->set_title("Melee:");
-      for (int inv_wpn_idx = 0; inv_wpn_idx < num_inv_wpns; ++inv_wpn_idx)
-      {
-        auto wpn_idx = m_player.weapon_idcs[inv_wpn_idx];
-        auto& weapon = all_weapons[wpn_idx];
-        std::string item_str = "  ";
-        if (dynamic_cast<Sword*>(weapon.get()) != nullptr)
-          item_str += "Sword";
-        else if (dynamic_cast<Dagger*>(weapon.get()) != nullptr)
-          item_str += "Dagger";
-        else if (dynamic_cast<Flail*>(weapon.get()) != nullptr)
-          item_str += "Flail";
-        else
-          item_str += "<Weapon>";
-        item_str += ":";
-        item_str += std::to_string(wpn_idx);
-        f_format_item_str(item_str, weapon->weight, weapon->price, weapon->damage);
-        if (weapons_subgroup_melee->find_item(weapon.get()) == nullptr)
-          weapons_subgroup_melee->add_item(item_str, weapon.get());
-        m_player.curr_tot_inv_weight += weapon->weight;
-      }
-      
-      auto* potions_group = m_inventory->fetch_group("Potions:");
-      auto* potions_subgroup = potions_group->fetch_subgroup(0);
-      for (int inv_pot_idx = 0; inv_pot_idx < num_inv_potions; ++inv_pot_idx)
-      {
-        auto pot_idx = m_player.potion_idcs[inv_pot_idx];
-        auto& potion = all_potions[pot_idx];
-        std::string item_str = "  Potion:" + std::to_string(pot_idx);
-        f_format_item_str(item_str, potion.weight, potion.price, 0);
-        if (potions_subgroup->find_item(&potion) == nullptr)
-          potions_subgroup->add_item(item_str, &potion);
-        m_player.curr_tot_inv_weight += potion.weight;
-      }
+      auto f_add_row = [](InvSubGroup* subgroup, const std::string& item_str, Item* item)
+      {
+        if (subgroup != nullptr && subgroup->find_item(item) == nullptr)
+          subgroup->add_item(item_str, item);
+      };
       
-      auto* armour_group = m_inventory->fetch_group("Armour:");
-      auto* armour_subgroup_shields = armour_group->fetch_subgroup(ARMOUR_Shield);
-      armour_subgroup_shields->set_title("Shields:");
-      auto* armour_subgroup_gambesons = armour_group->fetch_subgroup(ARMOUR_Gambeson);
-      armour_subgroup_gambesons->set_title("Gambesons:");
-      auto* armour_subgroup_chainmaillehauberks = armour_group->fetch_subgroup(ARMOUR_ChainMailleHauberk);
-      armour_subgroup_chainmaillehauberks->set_title("Chain-Maille Hauberks:");
-      auto* armour_subgroup_platedbodyarmour = armour_group->fetch_subgroup(ARMOUR_PlatedBodyArmour);
-      armour_subgroup_platedbodyarmour->set_title("Plated Body Armour:");
-      auto* armour_subgroup_paddedcoifs = armour_group->fetch_subgroup(ARMOUR_PaddedCoif);
-      armour_subgroup_paddedcoifs->set_title("Padded Coifs:");
-      auto* armour_subgroup_chainmaillecoifs = armour_group->fetch_subgroup(ARMOUR_ChainMailleCoif);
-      armour_subgroup_chainmaillecoifs->set_title("Chain-Maille Coifs:");
-      auto* armour_subgroup_helmets = armour_group->fetch_subgroup(ARMOUR_Helmet);
-      armour_subgroup_helmets->set_title("Helmets:");
-      for (int inv_a_idx = 0; inv_a_idx < num_inv_armour; ++inv_a_idx)
-      {
-        auto a_idx = m_player.armour_idcs[inv_a_idx];
-        const auto& armour = all_armour[a_idx];
-        std::string item_str = "  ";
-        InvSubGroup* armour_subgroup = nullptr;
-        if (dynamic_cast<Shield*>(armour.get()) != nullptr)
-        {
-          item_str += "Shield";
-          armour_subgroup = armour_subgroup_shields;
-        }
-        else if (dynamic_cast<Gambeson*>(armour.get()) != nullptr)
-        {
-          item_str += "Gambeson";
-          armour_subgroup = armour_subgroup_gambesons;
-        }
-        else if (dynamic_cast<ChainMailleHauberk*>(armour.get()) != nullptr)
+      for (auto* item : m_player.inv_items_added)
+      {
+        if (auto* key = dynamic_cast<Key*>(item); key != nullptr)
         {
-          item_str += "C.M.H.";
-          armour_subgroup = armour_subgroup_chainmaillehauberks;
+          std::string item_str = "  Key:" + std::to_string(key->key_id);
+          f_format_item_str(item_str, key->weight, key->price, 0);
+          f_add_row(m_inventory->fetch_group("Keys:")->fetch_subgroup(0), item_str, key);
         }
-        else if (dynamic_cast<PlatedBodyArmour*>(armour.get()) != nullptr)
+        else if (auto* lamp = dynamic_cast<Lamp*>(item); lamp != nullptr)
         {
-          item_str += "P.B.A.";
-          armour_subgroup = armour_subgroup_platedbodyarmour;
+          auto lamp_idx = find_handle_if(m_player.lamp_handles, all_lamps, [lamp](const auto& o) { return &o == lamp; }).idx;
+          auto lamp_type = lamp->get_type_str();
+          str::to_upper(lamp_type[0]);
+          std::string item_str = "  "s + lamp_type + ":" + std::to_string(lamp_idx);
+          f_format_item_str(item_str, lamp->weight, lamp->price, 0);
+          f_add_row(m_inventory->fetch_group("Lamps:")->fetch_subgroup(0), item_str, lamp);
         }
-        else if (dynamic_cast<PaddedCoif*>(armour.get()) != nullptr)
+        else if (auto* weapon = dynamic_cast<Weapon*>(item); weapon != nullptr)
         {
-          item_str += "P. Coif";
-          armour_subgroup = armour_subgroup_paddedcoifs;
+          auto wpn_idx = find_handle_if(m_player.weapon_handles, all_weapons, [weapon](const auto& o) { return o.get() == weapon; }).idx;
+          std::string item_str = "  ";
+          if (dynamic_cast<Sword*>(weapon) != nullptr)
+            item_str += "Sword";
+          else if (dynamic_cast<Dagger*>(weapon) != nullptr)
+            item_str += "Dagger";
+          else if (dynamic_cast<Flail*>(weapon) != nullptr)
+            item_str += "Flail";
+          else
+            item_str += "<Weapon>";
+          item_str += ":";
+          item_str += std::to_string(wpn_idx);
+          f_format_item_str(item_str, weapon->weight, weapon->price, weapon->damage);
+          f_add_row(m_inventory->fetch_group("Weapons:")->fetch_subgroup(0), item_str, weapon);
         }
-        else if (dynamic_cast<ChainMailleCoif*>(armour.get()) != nullptr)
+        else if (auto* potion = dynamic_cast<Potion*>(item); potion != nullptr)
         {
-          item_str += "C.M. Coif";
-          armour_subgroup = armour_subgroup_chainmaillecoifs;
+          auto pot_idx = find_handle_if(m_player.potion_handles, all_potions, [potion](const auto& o) { return &o == potion; }).idx;
+          std::string item_str = "  Potion:" + std::to_string(pot_idx);
+          f_format_item_str(item_str, potion->weight, potion->price, 0);
+          f_add_row(m_inventory->fetch_group("Potions:")->fetch_subgroup(0), item_str, potion);
         }
-        else if (dynamic_cast<Helmet*>(armour.get()) != nullptr)
+        else if (auto* armour = dynamic_cast<Armour*>(item); armour != nullptr)
         {
-          item_str += "Helmet";
-          armour_subgroup = armour_subgroup_helmets;
+          auto a_idx = find_handle_if(m_player.armour_handles, all_armour, [armour](const auto& o) { return o.get() == armour; }).idx;
+          auto* armour_group = m_inventory->fetch_group("Armour:");
+          std::string item_str = "  ";
+          InvSubGroup* armour_subgroup = nullptr;
+          if (dynamic_cast<Shield*>(armour) != nullptr)
+          {
+            item_str += "Shield";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_Shield);
+          }
+          else if (dynamic_cast<Gambeson*>(armour) != nullptr)
+          {
+            item_str += "Gambeson";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_Gambeson);
+          }
+          else if (dynamic_cast<ChainMailleHauberk*>(armour) != nullptr)
+          {
+            item_str += "C.M.H.";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_ChainMailleHauberk);
+          }
+          else if (dynamic_cast<PlatedBodyArmour*>(armour) != nullptr)
+          {
+            item_str += "P.B.A.";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_PlatedBodyArmour);
+          }
+          else if (dynamic_cast<PaddedCoif*>(armour) != nullptr)
+          {
+            item_str += "P. Coif";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_PaddedCoif);
+          }
+          else if (dynamic_cast<ChainMailleCoif*>(armour) != nullptr)
+          {
+            item_str += "C.M. Coif";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_ChainMailleCoif);
+          }
+          else if (dynamic_cast<Helmet*>(armour) != nullptr)
+          {
+            item_str += "Helmet";
+            armour_subgroup = armour_group->fetch_subgroup(ARMOUR_Helmet);
+          }
+          else
+            item_str += "<Armour>";
+          item_str += ":";
+          item_str += std::to_string(a_idx);
+          f_format_item_str(item_str, armour->weight, armour->price, armour->protection);
+          f_add_row(armour_subgroup, item_str, armour);
         }
-        else
-          item_str += "<Armour>";
-        item_str += ":";
-        item_str += std::to_string(a_idx);
-        f_format_item_str(item_str, armour->weight, armour->price, armour->protection);
-        if (armour_subgroup != nullptr)
-          if (armour_subgroup->find_item(armour.get()) == nullptr)
-            armour_subgroup->add_item(item_str, armour.get());
-        m_player.curr_tot_inv_weight += armour->weight;
       }
+      m_player.inv_items_added.clear();
     }
     
     template<typename Lambda>
     void clear_field(Lambda get_field_ptr, bool clear_val)
     {
-      for (auto& key : all_keys)
-        *get_field_ptr(&key) = clear_val;
-        
-      for (auto& lamp : all_lamps)
-        *get_field_ptr(&lamp) = clear_val;
-      
-      for (auto& weapon : all_weapons)
-        *get_field_ptr(weapon.get()) = clear_val;
-        
-      for (auto& potion : all_potions)
-        *get_field_ptr(&potion) = clear_val;
-      
-      for (auto& armour : all_armour)
-        *get_field_ptr(armour.get()) = clear_val;
-        
-      for (auto& bs : m_player.blood_splats)
-        *get_field_ptr(&bs) = clear_val;
-        
-      for (auto& npc : all_npcs)
-        for (auto& bs : npc.blood_splats)
-          *get_field_ptr(&bs) = clear_val;
+      // update_field() only reaches the objects in the room and corridor of the PC.
+      auto f_clear_bucket = [&](const ObjectIndex::Bucket* bucket)
+      {
+        if (bucket == nullptr)
+          return;
+        for (auto* item : bucket->items)
+          *get_field_ptr(item) = clear_val;
+        for (auto* bs : bucket->blood_splats)
+          *get_field_ptr(bs) = clear_val;
+      };
+      f_clear_bucket(m_object_index.fetch_room_bucket(m_field_room));
+      f_clear_bucket(m_object_index.fetch_corridor_bucket(m_field_corridor));
+      if (m_field_room != m_player.curr_room)
+        f_clear_bucket(m_object_index.fetch_room_bucket(m_player.curr_room));
+      if (m_field_corridor != m_player.curr_corridor)
+        f_clear_bucket(m_object_index.fetch_corridor_bucket(m_player.curr_corridor));
+      m_field_room = m_player.curr_room;
+      m_field_corridor = m_player.curr_corridor;
         
       // #NOTE: fog_of_war and light vars set by NPC class itself.
       //for (auto& npc : all_npcs)
       //  *get_field_ptr(&npc) = clear_val;
       
-      ttl::Rectangle bb;
-      bool_vector* field = nullptr;
-      
+      // Clearing to the default value frees the plane tiles that become empty.
       if (m_player.curr_corridor != nullptr)
       {
-        bb = m_player.curr_corridor->bb;
-        field = get_field_ptr(m_player.curr_corridor);
-        
         auto* door_0 = m_player.curr_corridor->doors[0];
         auto* door_1 = m_player.curr_corridor->doors[1];
-        stlutils::memset(*field, clear_val);
+        get_field_ptr(m_player.curr_corridor)->fill(clear_val);
         
         *get_field_ptr(door_0) = clear_val;
         *get_field_ptr(door_1) = clear_val;
       }
       if (m_player.curr_room != nullptr)
       {
-        bb = m_player.curr_room->bb_leaf_room;
-        field = get_field_ptr(m_player.curr_room);
-        stlutils::memset(*field, clear_val);
+        get_field_ptr(m_player.curr_room)->fill(clear_val);
         
         for (auto* door : m_player.curr_room->doors)
           *get_field_ptr(door) = clear_val;
@@ -322,76 +417,43 @@ namespace dung
     {
       const auto c_fow_dist = radius; //2.3f;
       
-      auto f_normalize_angle = [](float& ang)
-      {
-        while (ang < 0.f)
-          ang += math::c_2pi;
-        while (ang >= math::c_2pi)
-          ang -= math::c_2pi;
-      };
+      // An item is inside the cone of a directional light if the angle between
+      //   the look direction and the direction to the item is at most angle_deg / 2,
+      //   i.e. if dot(dir, v) >= |v| * cos(angle / 2). No trig per item.
+      auto dir_r = m_player.los_r;
+      auto dir_c = m_player.los_c;
+      math::normalize(dir_r, dir_c);
+      const float cos_half_angle = std::cos(math::deg2rad(angle_deg*0.5f));
       
       auto f_set_item_field = [&](auto& obj)
       {
-        if (m_player.curr_room == obj.curr_room || m_player.curr_corridor == obj.curr_corridor)
-          if (distance(obj.pos, curr_pos) <= radius)
+        if (distance(obj.pos, curr_pos) <= radius)
+        {
+          if (src_type == Lamp::LightType::Directional)
           {
-            if (src_type == Lamp::LightType::Directional)
-            {
-              // #FIXME: Move parts into math functions for better reuse.
-              // Rotating dir vector CW and CCW using a rotation matrix.
-              auto a = math::deg2rad(angle_deg*0.5f);
-              auto dir_r = m_player.los_r;
-              auto dir_c = m_player.los_c;
-              auto Clo = std::cos(-a);
-              auto Slo = std::sin(-a);
-              auto Chi = std::cos(+a);
-              auto Shi = std::sin(+a);
-              math::normalize(dir_r, dir_c);
-              float dir_lo_r = (dir_r*Clo - dir_c*Slo);
-              float dir_lo_c = dir_r*Slo + dir_c*Clo;
-              float dir_hi_r = (dir_r*Chi - dir_c*Shi);
-              float dir_hi_c = dir_r*Shi + dir_c*Chi;
-    
-              float lo_angle_rad = std::atan2(-dir_lo_r, dir_lo_c);
-              float hi_angle_rad = std::atan2(-dir_hi_r, dir_hi_c);
-              f_normalize_angle(lo_angle_rad);
-              f_normalize_angle(hi_angle_rad);
-              if (lo_angle_rad > hi_angle_rad)
-                hi_angle_rad += math::c_2pi;
-                
-              float curr_angle_rad = static_cast<float>(std::atan2(-(obj.pos.r - curr_pos.r), obj.pos.c - curr_pos.c));
-              f_normalize_angle(curr_angle_rad);
-              if (curr_angle_rad < lo_angle_rad)
-                curr_angle_rad += math::c_2pi;
-              if (math::in_range<float>(curr_angle_rad, lo_angle_rad, hi_angle_rad, Range::Closed))
-                *get_field_ptr(&obj) = set_val;
-            }
-            else
+            float v_r = static_cast<float>(obj.pos.r - curr_pos.r);
+            float v_c = static_cast<float>(obj.pos.c - curr_pos.c);
+            float dot = dir_r*v_r + dir_c*v_c;
+            if (dot >= std::sqrt(v_r*v_r + v_c*v_c)*cos_half_angle)
               *get_field_ptr(&obj) = set_val;
           }
+          else
+            *get_field_ptr(&obj) = set_val;
+        }
       };
       
-      for (auto& key : all_keys)
-        f_set_item_field(key);
-          
-      for (auto& lamp : all_lamps)
-        f_set_item_field(lamp);
-          
-      for (auto& weapon : all_weapons)
-        f_set_item_field(*weapon);
-          
-      for (auto& potion : all_potions)
-        f_set_item_field(potion);
-          
-      for (auto& armour : all_armour)
-        f_set_item_field(*armour);
-        
-      for (auto& bs : m_player.blood_splats)
-        f_set_item_field(bs);
-        
-      for (auto& npc : all_npcs)
-        for (auto& bs : npc.blood_splats)
-          f_set_item_field(bs);
+      // Only the objects sharing a room or corridor with the PC.
+      auto f_set_bucket_field = [&](const ObjectIndex::Bucket* bucket)
+      {
+        if (bucket == nullptr)
+          return;
+        for (auto* item : bucket->items)
+          f_set_item_field(*item);
+        for (auto* bs : bucket->blood_splats)
+          f_set_item_field(*bs);
+      };
+      f_set_bucket_field(m_object_index.fetch_room_bucket(m_player.curr_room));
+      f_set_bucket_field(m_object_index.fetch_corridor_bucket(m_player.curr_corridor));
       
       // #NOTE: fog_of_war and light vars set by NPC class itself.
       //for (auto& npc : all_npcs)
@@ -401,7 +463,7 @@ namespace dung
       ttl::Rectangle bb;
       RC local_pos;
       RC size;
-      bool_vector* field = nullptr;
+      BitPlaneView* field = nullptr;
       
       auto set_field = [&](const RC& p)
       {
@@ -418,29 +480,30 @@ namespace dung
         // idx = 0 .. 14
         // r = 2, c = 4 => idx = r * c_len + c = 2*5 + 4 = 14.
         int idx = p.r * size.c + p.c;
-        if (0 <= idx && idx < static_cast<int>(field->size()))
-          (*field)[idx] = set_val;
+        if (0 <= idx && idx < field->size())
+          field->set(idx, set_val);
       };
       
+      const FieldStencil* stencil = nullptr;
+      switch (src_type)
+      {
+        case Lamp::LightType::Isotropic:
+          stencil = &m_field_stencils.get_circle(radius, globals::px_aspect);
+          break;
+        case Lamp::LightType::Directional:
+          stencil = &m_field_stencils.get_arc(radius, angle_deg, m_player.los_r, m_player.los_c, globals::px_aspect);
+          break;
+        case Lamp::LightType::NUM_ITEMS:
+          break;
+      }
+      
       auto update_rect_field = [&]() // #FIXME: FHXFTW
       {
         local_pos = curr_pos - bb.pos();
         size = bb.size();
         
-        std::vector<RC> positions;
-        switch (src_type)
-        {
-          case Lamp::LightType::Isotropic:
-            positions = drawing::filled_circle_positions(local_pos, radius, globals::px_aspect);
-            break;
-          case Lamp::LightType::Directional:
-            positions = drawing::filled_arc_positions(local_pos, radius, math::deg2rad(angle_deg), m_player.los_r, m_player.los_c, globals::px_aspect);
-            break;
-          case Lamp::LightType::NUM_ITEMS:
-            break;
-        }
-        for (const auto& pos : positions)
-          set_field(pos);
+        if (stencil != nullptr && field != nullptr)
+          stencil->apply(*field, local_pos, set_val);
         
         int r_room = -1;
         int c_room = -1;
@@ -459,12 +522,17 @@ namespace dung
       
       if (m_player.curr_corridor != nullptr && m_player.curr_corridor->is_inside_corridor(curr_pos))
       {
-        bb = m_player.curr_corridor->bb;
-        field = get_field_ptr(m_player.curr_corridor);
-        
         auto* door_0 = m_player.curr_corridor->doors[0];
         auto* door_1 = m_player.curr_corridor->doors[1];
-        update_rect_field();
+        // One leg at a time, so that a bent corridor doesn't reach around its corner.
+        for (const auto& leg : m_player.curr_corridor->get_legs())
+        {
+          bb = leg;
+          auto leg_field = get_field_ptr(m_player.curr_corridor)->sub_view(leg);
+          field = &leg_field;
+          update_rect_field();
+        }
+        field = nullptr;
         
         if (distance(door_0->pos, curr_pos) <= c_fow_dist)
           *get_field_ptr(door_0) = set_val;
@@ -483,40 +551,35 @@ namespace dung
       }
     }
     
-    void set_visibilities(float fow_radius, const RC& pc_pos)
+    // The cells within the FOW radius of the PC in its room and corridor.
+    void update_visible_field(const RC& curr_pos, float fow_radius)
     {
-      const auto c_fow_radius_sq = math::sq(fow_radius);
-    
-      auto f_calc_night = [&](const auto& obj) -> bool
+      m_bsp_tree->fetch_visible_plane().clear();
+      const auto& stencil = m_field_stencils.get_circle(fow_radius, globals::px_aspect);
+      if (m_player.curr_corridor != nullptr && m_player.curr_corridor->is_inside_corridor(curr_pos))
       {
-        bool is_night = false;
-        if (m_use_per_room_lat_long_for_sun_dir)
+        for (const auto& leg : m_player.curr_corridor->get_legs())
         {
-          auto f_set_night = [&](const RoomStyle& rs)
-          {
-            if (m_solar_motion.get_solar_direction(rs.latitude, rs.longitude, m_season, m_t_solar_period) == SolarDirection::Nadir)
-              is_night = true;
-          };
-          
-          auto room_style = m_environment->find_room_style(obj.curr_room);
-          if (room_style.has_value())
-            f_set_night(room_style.value());
-          else
-          {
-            auto corr_style = m_environment->find_corridor_style(obj.curr_corridor);
-            if (corr_style.has_value())
-              f_set_night(corr_style.value());
-          }
+          auto leg_visible = m_player.curr_corridor->visible.sub_view(leg);
+          stencil.apply(leg_visible, curr_pos - leg.pos(), true);
         }
-        else
-          is_night = m_sun_dir == SolarDirection::Nadir;
-        
-        return is_night;
+      }
+      if (m_player.curr_room != nullptr && m_player.curr_room->is_inside_room(curr_pos))
+        stencil.apply(m_player.curr_room->visible, curr_pos - m_player.curr_room->bb_leaf_room.pos(), true);
+    }
+    
+    void set_visibilities()
+    {
+      auto f_calc_night = [&](const auto& obj) -> bool
+      {
+        return m_environment->is_night(obj.curr_room, obj.curr_corridor);
       };
       
-      auto f_fow_near = [&pc_pos, c_fow_radius_sq](const auto& obj) -> bool
+      // Only objects seen by the PC, i.e. not those behind a wall.
+      const auto& visible = m_bsp_tree->get_visible_plane();
+      auto f_fow_near = [&visible](const auto& obj) -> bool
       {
-        return distance_squared(obj.pos, pc_pos) <= c_fow_radius_sq;
+        return visible.get(obj.pos);
       };
             
       for (auto& key : all_keys)
@@ -537,12 +600,8 @@ namespace dung
       for (auto& npc : all_npcs)
         npc.set_visibility(use_fog_of_war, f_fow_near(npc), f_calc_night(npc));
         
-      for (auto& bs : m_player.blood_splats)
+      for (auto& bs : m_blood_splat_pool)
         bs.set_visibility(use_fog_of_war, f_calc_night(bs));
-      
-      for (auto& npc : all_npcs)
-        for (auto& bs : npc.blood_splats)
-          bs.set_visibility(use_fog_of_war, f_calc_night(bs));
     }
     
     template<int NR, int NC>
@@ -599,10 +658,38 @@ namespace dung
       tb_strength.draw(sh, tb_args);
     }
     
+    // Random room cell obeying rule. Tries the square of half side near_half_size
+    //   around near_pos first, if given.
+    std::optional<PlacementEngine::Placement> sample_placement(PlacementRule rule,
+                                                              std::optional<RC> near_pos = std::nullopt,
+                                                              int near_half_size = 0)
+    {
+      if (!m_placement_engine.is_built())
+        m_placement_engine.build(*m_environment);
+      if (near_pos.has_value())
+      {
+        auto placement = m_placement_engine.sample_room_cell_near(rule, near_pos.value(), near_half_size);
+        if (placement.has_value())
+          return placement;
+      }
+      return m_placement_engine.sample_room_cell(rule);
+    }
+    
+    void add_blood_splat(const BloodSplat& bs)
+    {
+      if (m_blood_splat_pool.full())
+        m_object_index.remove_blood_splat(&m_blood_splat_pool.get_oldest());
+      m_object_index.add_blood_splat(&m_blood_splat_pool.add(bs));
+    }
+    
     void update_fighting(float real_time_s)
     {
       if (m_player.health > 0)
       {
+        // The player's armour class and damage only change with the inventory selection.
+        int player_ac = m_player.calc_armour_class(m_inventory.get());
+        int player_damage = m_player.calc_melee_damage(m_inventory.get());
+        
         for (auto& npc : all_npcs)
         {
           if (npc.health > 0 && npc.state == State::Fight)
@@ -619,9 +706,6 @@ namespace dung
             // NPC attack roll.
             int npc_attack_roll = rnd::dice(20) + npc.thac0 + npc.get_melee_attack_bonus() - blind_attack_penalty;
         
-            // Calculate the player's total armor class.
-            int player_ac = m_player.calc_armour_class(m_inventory.get());
-        
             // Determine if NPC hits the player.
             // e.g. d12 + 1 + (2 + 10/2) >= (10 + 10/2).
             // d12 + 8 >= 15.
@@ -629,8 +713,8 @@ namespace dung
             {
               // NPC hits the player
               int damage = 1; // Default damage for fists
-              if (npc.weapon_idx != -1)
-                damage = f_calc_damage(all_weapons[npc.weapon_idx].get(), npc.get_melee_damage_bonus());
+              if (const auto* weapon = all_weapons.get(npc.weapon_handle); weapon != nullptr)
+                damage = f_calc_damage(weapon->get(), npc.get_melee_damage_bonus());
         
               // Apply damage to the player
               bool was_alive = m_player.health > 0;
@@ -646,7 +730,6 @@ namespace dung
             
             // Roll a d20 for the player's attack roll (if the NPC is visible).
             // If invisible, then roll a d32 instead.
-            const auto* weapon = m_player.get_selected_melee_weapon(m_inventory.get());
             int player_attack_roll = rnd::dice(20) + m_player.thac0 + m_player.get_melee_attack_bonus() - blind_attack_penalty;
             int npc_ac = npc.calc_armour_class();
             
@@ -654,7 +737,7 @@ namespace dung
             if (player_attack_roll >= npc_ac)
             {
               // PC hits the NPC.
-              int damage = f_calc_damage(weapon, m_player.get_melee_damage_bonus());
+              int damage = player_damage;
               
               // Apply damage to the NPC.
               bool was_alive = npc.health > 0;
@@ -816,13 +899,14 @@ namespace dung
               f_render_fight(&m_player, npc_scr_pos, offs);
               if (do_update_fight && rnd::one_in(npc.visible ? 20 : 28))
               {
-                auto& bs = m_player.blood_splats.emplace_back(m_environment.get(), m_player.pos + offs, rnd::dice(4), sim_time_s, offs);
+                BloodSplat bs { m_environment.get(), m_player.pos + offs, rnd::dice(4), sim_time_s, offs };
                 bs.curr_room = m_player.curr_room;
                 bs.curr_corridor = m_player.curr_corridor;
                 if (m_player.is_inside_curr_room())
                   bs.is_underground = m_environment->is_underground(m_player.curr_room);
                 else if (m_player.is_inside_curr_corridor())
                   bs.is_underground = m_environment->is_underground(m_player.curr_corridor);
+                add_blood_splat(bs);
               }
             }
             if (npc.visible)
@@ -835,10 +919,11 @@ namespace dung
                 f_render_fight(&npc, pc_scr_pos, offs);
                 if (do_update_fight && rnd::one_in(npc.visible ? 20 : 28))
                 {
-                  auto& bs = npc.blood_splats.emplace_back(m_environment.get(), npc.pos + offs, rnd::dice(4), sim_time_s, offs);
+                  BloodSplat bs { m_environment.get(), npc.pos + offs, rnd::dice(4), sim_time_s, offs };
                   bs.curr_room = npc.curr_room;
                   bs.curr_corridor = npc.curr_corridor;
                   bs.is_underground = npc.is_underground;
+                  add_blood_splat(bs);
                 }
               }
             }
@@ -847,6 +932,593 @@ namespace dung
       }
     }
     
+    // Calls func(store_idx, slot_map, pc_handles) for each item store, in save order,
+    //   together with the handles of the items from it that the PC carries.
+    template<typename Self, typename Lambda>
+    static void for_each_item_store(Self& self, Lambda func)
+    {
+      func(0, self.all_keys, self.m_player.key_handles);
+      func(1, self.all_lamps, self.m_player.lamp_handles);
+      func(2, self.all_weapons, self.m_player.weapon_handles);
+      func(3, self.all_potions, self.m_player.potion_handles);
+      func(4, self.all_armour, self.m_player.armour_handles);
+    }
+    
+    void write_item_record(BinaryWriter& writer, const Key& key) const { snapshot::write_key(writer, *m_bsp_tree, key); }
+    void write_item_record(BinaryWriter& writer, const Lamp& lamp) const { snapshot::write_lamp(writer, *m_bsp_tree, lamp); }
+    void write_item_record(BinaryWriter& writer, const std::unique_ptr<Weapon>& weapon) const { snapshot::write_weapon(writer, *m_bsp_tree, *weapon); }
+    void write_item_record(BinaryWriter& writer, const Potion& potion) const { snapshot::write_potion(writer, *m_bsp_tree, potion); }
+    void write_item_record(BinaryWriter& writer, const std::unique_ptr<Armour>& armour) const { snapshot::write_armour(writer, *m_bsp_tree, *armour); }
+    
+    bool read_item_record(BinaryReader& reader, Key& key) { return snapshot::read_key(reader, *m_bsp_tree, key); }
+    bool read_item_record(BinaryReader& reader, Lamp& lamp) { return snapshot::read_lamp(reader, *m_bsp_tree, lamp); }
+    bool read_item_record(BinaryReader& reader, Potion& potion) { return snapshot::read_potion(reader, *m_bsp_tree, potion); }
+    // Weapons and armour are replaced, since the stored type may differ.
+    template<typename T>
+    bool read_item_record(BinaryReader& reader, std::unique_ptr<T>& item)
+    {
+      std::unique_ptr<T> stored_item;
+      if constexpr (std::is_same_v<T, Weapon>)
+        stored_item = snapshot::read_weapon(reader, *m_bsp_tree);
+      else
+        stored_item = snapshot::read_armour(reader, *m_bsp_tree);
+      if (stored_item == nullptr)
+        return false;
+      item = std::move(stored_item);
+      return true;
+    }
+    
+    // weapon_idcs : The checkpoint indices of the weapons by slot index.
+    void write_npc_record(BinaryWriter& writer, const NPC& npc, const SlotMap<std::unique_ptr<Weapon>>& weapons,
+                          const std::vector<int>& weapon_idcs) const
+    {
+      int weapon_idx = -1;
+      if (weapons.contains(npc.weapon_handle) && npc.weapon_handle.idx < weapon_idcs.size())
+        weapon_idx = weapon_idcs[npc.weapon_handle.idx];
+      snapshot::write_npc(writer, *m_bsp_tree, npc, weapon_idx);
+      savegame::write_npc_state(writer, npc);
+    }
+    
+    bool read_npc_record(BinaryReader& reader, NPC& npc)
+    {
+      int weapon_idx = -1;
+      if (!snapshot::read_npc(reader, *m_bsp_tree, npc, weapon_idx))
+        return false;
+      npc.weapon_handle = all_weapons.get_handle(weapon_idx);
+      return savegame::read_npc_state(reader, npc);
+    }
+    
+    // The items by the order in which they are saved, and the hashes of all records
+    //   that autosave() compares against.
+    Checkpoint make_checkpoint(const SaveState& state) const
+    {
+      Checkpoint checkpoint;
+      BinaryWriter record;
+      for_each_item_store(state, [&](int store_idx, const auto& slot_map, const auto&)
+      {
+        auto& handles = checkpoint.item_handles[store_idx];
+        auto& hashes = checkpoint.item_hashes[store_idx];
+        auto& idcs = checkpoint.item_idcs[store_idx];
+        idcs.assign(slot_map.num_slots(), -1);
+        for (auto it = slot_map.begin(); it != slot_map.end(); ++it)
+        {
+          idcs[it.handle().idx] = stlutils::sizeI(handles);
+          handles.emplace_back(it.handle());
+          record.clear();
+          write_item_record(record, *it);
+          hashes.emplace_back(savegame::hash_bytes(record.get_buffer()));
+        }
+      });
+      for (const auto& npc : state.all_npcs)
+      {
+        record.clear();
+        write_npc_record(record, npc, state.all_weapons, checkpoint.item_idcs[2]);
+        checkpoint.npc_hashes.emplace_back(savegame::hash_bytes(record.get_buffer()));
+      }
+      for (const auto& door : state.doors)
+      {
+        record.clear();
+        savegame::write_door_state(record, door);
+        checkpoint.door_hashes.emplace_back(savegame::hash_bytes(record.get_buffer()));
+      }
+      return checkpoint;
+    }
+    
+    // Copies what a save writes. With only_dirty_fow, only the fog of war of the rooms
+    //   and corridors that may have changed since the checkpoint, as a delta writes.
+    // The fog of war is copied a word at a time.
+    SaveState make_save_state(bool only_dirty_fow) const
+    {
+      SaveState state;
+      state.latitude = m_latitude;
+      state.longitude = m_longitude;
+      state.sun_minutes_per_day = m_sun_minutes_per_day;
+      state.sun_minutes_per_year = m_sun_minutes_per_year;
+      state.t_solar_period = m_t_solar_period;
+      state.t_season_period = m_t_season_period;
+      state.use_per_room_lat_long_for_sun_dir = m_use_per_room_lat_long_for_sun_dir;
+      state.m_player = m_player;
+      for_each_item_store(*this, [&](int store_idx, const auto& slot_map, const auto& pc_handles)
+      {
+        for (const auto& handle : pc_handles)
+        {
+          const auto* item = slot_map.get(handle);
+          state.selected_items[store_idx].emplace_back(item != nullptr && m_inventory->is_selected(get_item_ptr(*item)));
+        }
+      });
+      
+      const auto& doors = m_bsp_tree->fetch_doors();
+      state.doors.reserve(doors.size());
+      for (const auto* door : doors)
+        state.doors.emplace_back(*door);
+      
+      auto f_copy_fow = [only_dirty_fow](int num_ids, const std::vector<bool>& dirty, auto fetch, auto& fow)
+      {
+        for (int id = 0; id < num_ids; ++id)
+          if (!only_dirty_fow || (id < stlutils::sizeI(dirty) && dirty[id]))
+            fow.emplace_back(id, savegame::copy_field(fetch(id)->fog_of_war));
+      };
+      f_copy_fow(m_bsp_tree->get_num_rooms(), m_fow_dirty_rooms,
+                 [this](int id) { return m_bsp_tree->fetch_room(id); }, state.room_fow);
+      f_copy_fow(m_bsp_tree->get_num_corridors(), m_fow_dirty_corridors,
+                 [this](int id) { return m_bsp_tree->fetch_corridor(id); }, state.corridor_fow);
+      
+      state.all_keys = all_keys;
+      state.all_lamps = all_lamps;
+      state.all_weapons = all_weapons.transform([](const auto& weapon) { return std::make_unique<Weapon>(*weapon); });
+      state.all_potions = all_potions;
+      state.all_armour = all_armour.transform([](const auto& armour) { return std::make_unique<Armour>(*armour); });
+      // NPCs can be copied but not assigned.
+      state.all_npcs.reserve(all_npcs.size());
+      for (const auto& npc : all_npcs)
+        state.all_npcs.emplace_back(npc);
+      return state;
+    }
+    
+    void mark_fow_dirty(const BSPNode* room, const Corridor* corr)
+    {
+      auto f_mark = [](std::vector<bool>& dirty, int id, int num_ids)
+      {
+        if (id < 0)
+          return;
+        if (stlutils::sizeI(dirty) < num_ids)
+          dirty.resize(num_ids, false);
+        dirty[id] = true;
+      };
+      f_mark(m_fow_dirty_rooms, m_bsp_tree->get_room_id(room), m_bsp_tree->get_num_rooms());
+      f_mark(m_fow_dirty_corridors, m_bsp_tree->get_corridor_id(corr), m_bsp_tree->get_num_corridors());
+    }
+    
+    // The body of a dungeon snapshot, see save_dungeon_snapshot(), is the tree and
+    //   the environment followed by the items and NPCs.
+    void write_dungeon(BinaryWriter& writer) const
+    {
+      m_bsp_tree->write_snapshot(writer);
+      m_environment->write_snapshot(writer);
+    }
+    
+    // self : The engine or a SaveState.
+    template<typename Self>
+    void write_snapshot_objects(BinaryWriter& writer, const Self& self) const
+    {
+      writer.write(static_cast<uint32_t>(self.all_keys.size()));
+      for (const auto& key : self.all_keys)
+        snapshot::write_key(writer, *m_bsp_tree, key);
+      writer.write(static_cast<uint32_t>(self.all_lamps.size()));
+      for (const auto& lamp : self.all_lamps)
+        snapshot::write_lamp(writer, *m_bsp_tree, lamp);
+      // The NPCs refer to their weapons by the order in which they are stored.
+      std::vector<int> weapon_idcs(self.all_weapons.num_slots(), -1);
+      int weapon_idx = 0;
+      writer.write(static_cast<uint32_t>(self.all_weapons.size()));
+      for (auto it = self.all_weapons.begin(); it != self.all_weapons.end(); ++it)
+      {
+        weapon_idcs[it.handle().idx] = weapon_idx++;
+        snapshot::write_weapon(writer, *m_bsp_tree, **it);
+      }
+      writer.write(static_cast<uint32_t>(self.all_potions.size()));
+      for (const auto& potion : self.all_potions)
+        snapshot::write_potion(writer, *m_bsp_tree, potion);
+      writer.write(static_cast<uint32_t>(self.all_armour.size()));
+      for (const auto& armour : self.all_armour)
+        snapshot::write_armour(writer, *m_bsp_tree, *armour);
+      writer.write(static_cast<uint32_t>(self.all_npcs.size()));
+      for (const auto& npc : self.all_npcs)
+        snapshot::write_npc(writer, *m_bsp_tree, npc,
+                            self.all_weapons.contains(npc.weapon_handle) ? weapon_idcs[npc.weapon_handle.idx] : -1);
+    }
+    
+    // The body of a dungeon snapshot, see load_dungeon_snapshot().
+    // The item stores start over empty, so the slot index of an item is its stored order.
+    bool read_dungeon_snapshot(BinaryReader& reader, BSPTree* bsp_tree)
+    {
+      auto f_fail = [](const std::string& err_msg)
+      {
+        std::cerr << "ERROR in DungGine::read_dungeon_snapshot() : " << err_msg << std::endl;
+        return false;
+      };
+      
+      if (!bsp_tree->read_snapshot(reader))
+        return false;
+      load_dungeon(bsp_tree);
+      if (!m_environment->read_snapshot(reader))
+        return false;
+      m_placement_engine.invalidate();
+      
+      all_keys = {};
+      all_lamps = {};
+      all_weapons = {};
+      all_potions = {};
+      all_armour = {};
+      all_npcs.clear();
+      
+      // Carried items are not in the object index.
+      auto f_add_item = [this](auto& slot_map, auto item)
+      {
+        auto handle = slot_map.insert(std::move(item));
+        auto* item_ptr = get_item_ptr(*slot_map.get(handle));
+        if (!item_ptr->picked_up)
+          m_object_index.add_item(item_ptr, handle);
+        return handle;
+      };
+      
+      uint32_t num_items = 0;
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated keys.");
+      for (uint32_t key_idx = 0; key_idx < num_items; ++key_idx)
+      {
+        Key key;
+        if (!snapshot::read_key(reader, *bsp_tree, key))
+          return f_fail("Invalid key.");
+        f_add_item(all_keys, key);
+      }
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated lamps.");
+      for (uint32_t lamp_idx = 0; lamp_idx < num_items; ++lamp_idx)
+      {
+        Lamp lamp;
+        if (!snapshot::read_lamp(reader, *bsp_tree, lamp))
+          return f_fail("Invalid lamp.");
+        f_add_item(all_lamps, lamp);
+      }
+      std::vector<SlotHandle> weapon_handles;
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated weapons.");
+      for (uint32_t wpn_idx = 0; wpn_idx < num_items; ++wpn_idx)
+      {
+        auto weapon = snapshot::read_weapon(reader, *bsp_tree);
+        if (weapon == nullptr)
+          return f_fail("Invalid weapon.");
+        weapon_handles.emplace_back(f_add_item(all_weapons, std::move(weapon)));
+      }
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated potions.");
+      for (uint32_t pot_idx = 0; pot_idx < num_items; ++pot_idx)
+      {
+        Potion potion;
+        if (!snapshot::read_potion(reader, *bsp_tree, potion))
+          return f_fail("Invalid potion.");
+        f_add_item(all_potions, potion);
+      }
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated armour.");
+      for (uint32_t a_idx = 0; a_idx < num_items; ++a_idx)
+      {
+        auto armour = snapshot::read_armour(reader, *bsp_tree);
+        if (armour == nullptr)
+          return f_fail("Invalid armour.");
+        f_add_item(all_armour, std::move(armour));
+      }
+      if (!reader.read_count(num_items, 1))
+        return f_fail("Truncated NPCs.");
+      all_npcs.reserve(num_items);
+      for (uint32_t npc_idx = 0; npc_idx < num_items; ++npc_idx)
+      {
+        NPC npc;
+        int weapon_idx = -1;
+        if (!snapshot::read_npc(reader, *bsp_tree, npc, weapon_idx))
+          return f_fail("Invalid NPC.");
+        if (0 <= weapon_idx && weapon_idx < stlutils::sizeI(weapon_handles))
+          npc.weapon_handle = weapon_handles[weapon_idx];
+        all_npcs.emplace_back(npc);
+      }
+      return true;
+    }
+    
+    // The runtime block of a save game, see SaveGame.h : The sun, the PC, fog of war, doors,
+    //   items, NPCs and the carried items. With only_changes, the fog of war in state, which
+    //   is that of the dirty rooms and corridors, and the doors, items and NPCs whose records
+    //   differ from the checkpoint. Without, all fog of war, doors and NPCs but no items,
+    //   since the dungeon snapshot before it holds them.
+    // Runs on the autosave thread, so it only reads state and the layout of the tree.
+    void write_runtime_state(BinaryWriter& writer, const SaveState& state, const Checkpoint& checkpoint,
+                             bool only_changes) const
+    {
+      writer.write<int32_t>(static_cast<int32_t>(state.latitude));
+      writer.write<int32_t>(static_cast<int32_t>(state.longitude));
+      writer.write<float>(state.sun_minutes_per_day);
+      writer.write<float>(state.sun_minutes_per_year);
+      writer.write<float>(state.t_solar_period);
+      writer.write<float>(state.t_season_period);
+      writer.write<bool>(state.use_per_room_lat_long_for_sun_dir);
+      
+      savegame::write_pc(writer, *m_bsp_tree, state.m_player);
+      
+      for (const auto* fow : { &state.room_fow, &state.corridor_fow })
+      {
+        writer.write(static_cast<uint32_t>(fow->size()));
+        for (const auto& [id, field] : *fow)
+        {
+          writer.write<int32_t>(id);
+          savegame::write_field(writer, field);
+        }
+      }
+      
+      BinaryWriter record;
+      auto f_changed = [&record](uint64_t checkpoint_hash)
+      {
+        return savegame::hash_bytes(record.get_buffer()) != checkpoint_hash;
+      };
+      
+      std::vector<int> door_ids;
+      for (int door_id = 0; door_id < stlutils::sizeI(state.doors); ++door_id)
+      {
+        record.clear();
+        savegame::write_door_state(record, state.doors[door_id]);
+        if (!only_changes || f_changed(checkpoint.door_hashes[door_id]))
+          door_ids.emplace_back(door_id);
+      }
+      writer.write(static_cast<uint32_t>(door_ids.size()));
+      for (int door_id : door_ids)
+      {
+        writer.write<int32_t>(door_id);
+        savegame::write_door_state(writer, state.doors[door_id]);
+      }
+      
+      // Items that have been removed since the checkpoint are stored as absent.
+      for_each_item_store(state, [&](int store_idx, const auto& slot_map, const auto&)
+      {
+        const auto& handles = checkpoint.item_handles[store_idx];
+        std::vector<int> item_idcs;
+        if (only_changes)
+          for (int item_idx = 0; item_idx < stlutils::sizeI(handles); ++item_idx)
+          {
+            const auto* item = slot_map.get(handles[item_idx]);
+            if (item != nullptr)
+            {
+              record.clear();
+              write_item_record(record, *item);
+            }
+            if (item == nullptr || f_changed(checkpoint.item_hashes[store_idx][item_idx]))
+              item_idcs.emplace_back(item_idx);
+          }
+        writer.write(static_cast<uint32_t>(item_idcs.size()));
+        for (int item_idx : item_idcs)
+        {
+          const auto* item = slot_map.get(handles[item_idx]);
+          writer.write<int32_t>(item_idx);
+          writer.write<bool>(item != nullptr);
+          if (item != nullptr)
+            write_item_record(writer, *item);
+        }
+      });
+      
+      const auto& weapon_idcs = checkpoint.item_idcs[2];
+      std::vector<int> npc_idcs;
+      for (int npc_idx = 0; npc_idx < stlutils::sizeI(state.all_npcs); ++npc_idx)
+      {
+        record.clear();
+        write_npc_record(record, state.all_npcs[npc_idx], state.all_weapons, weapon_idcs);
+        if (!only_changes || f_changed(checkpoint.npc_hashes[npc_idx]))
+          npc_idcs.emplace_back(npc_idx);
+      }
+      writer.write(static_cast<uint32_t>(npc_idcs.size()));
+      for (int npc_idx : npc_idcs)
+      {
+        writer.write<int32_t>(npc_idx);
+        write_npc_record(writer, state.all_npcs[npc_idx], state.all_weapons, weapon_idcs);
+      }
+      
+      // Carried items and whether they are selected in the inventory.
+      for_each_item_store(state, [&](int store_idx, const auto& slot_map, const auto& pc_handles)
+      {
+        const auto& idcs = checkpoint.item_idcs[store_idx];
+        const auto& selected_items = state.selected_items[store_idx];
+        std::vector<std::pair<int, bool>> carried;
+        for (int handle_idx = 0; handle_idx < stlutils::sizeI(pc_handles); ++handle_idx)
+        {
+          const auto& handle = pc_handles[handle_idx];
+          if (slot_map.contains(handle) && handle.idx < idcs.size())
+            carried.emplace_back(idcs[handle.idx], selected_items[handle_idx]);
+        }
+        writer.write(static_cast<uint32_t>(carried.size()));
+        for (const auto& [item_idx, selected] : carried)
+        {
+          writer.write<int32_t>(item_idx);
+          writer.write<bool>(selected);
+        }
+      });
+    }
+    
+    // Applies a runtime block on top of the dungeon read by read_dungeon_snapshot(),
+    //   whose slot indices are the checkpoint indices.
+    // selected_items : The carried items that are selected in the inventory.
+    bool read_runtime_state(BinaryReader& reader, std::vector<Item*>& selected_items)
+    {
+      int32_t latitude = 0, longitude = 0;
+      reader.read(latitude);
+      reader.read(longitude);
+      reader.read(m_sun_minutes_per_day);
+      reader.read(m_sun_minutes_per_year);
+      // Offsets for real time zero. Shifted by load_game().
+      reader.read(m_sun_day_t_offs);
+      reader.read(m_sun_year_t_offs);
+      reader.read(m_use_per_room_lat_long_for_sun_dir);
+      m_latitude = static_cast<Latitude>(latitude);
+      m_longitude = static_cast<Longitude>(longitude);
+      
+      if (!savegame::read_pc(reader, *m_bsp_tree, m_player))
+        return false;
+      
+      auto f_read_fow = [&reader](int num_ids, auto fetch)
+      {
+        uint32_t count = 0;
+        if (!reader.read_count(count, 9))
+          return false;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+          int32_t id = -1;
+          if (!reader.read(id) || id < 0 || id >= num_ids
+              || !savegame::read_field(reader, fetch(id)->fog_of_war))
+            return false;
+        }
+        return true;
+      };
+      if (!f_read_fow(m_bsp_tree->get_num_rooms(), [this](int id) { return m_bsp_tree->fetch_room(id); })
+          || !f_read_fow(m_bsp_tree->get_num_corridors(), [this](int id) { return m_bsp_tree->fetch_corridor(id); }))
+        return false;
+      
+      const auto& doors = m_bsp_tree->fetch_doors();
+      uint32_t count = 0;
+      if (!reader.read_count(count, 7))
+        return false;
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        int32_t door_id = -1;
+        if (!reader.read(door_id) || door_id < 0 || door_id >= stlutils::sizeI(doors)
+            || !savegame::read_door_state(reader, *doors[door_id]))
+          return false;
+      }
+      
+      bool ok = true;
+      for_each_item_store(*this, [&](int, auto& slot_map, auto&)
+      {
+        if (!ok || !reader.read_count(count, 5))
+        {
+          ok = false;
+          return;
+        }
+        for (uint32_t i = 0; i < count && ok; ++i)
+        {
+          int32_t item_idx = -1;
+          bool present = false;
+          reader.read(item_idx);
+          reader.read(present);
+          auto handle = slot_map.get_handle(item_idx);
+          if (!reader.ok() || !handle.is_valid())
+            ok = false;
+          else if (!present)
+            slot_map.erase(handle);
+          else
+            ok = read_item_record(reader, *slot_map.get(handle));
+        }
+      });
+      if (!ok || !reader.read_count(count, 5))
+        return false;
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        int32_t npc_idx = -1;
+        if (!reader.read(npc_idx) || npc_idx < 0 || npc_idx >= stlutils::sizeI(all_npcs)
+            || !read_npc_record(reader, all_npcs[npc_idx]))
+          return false;
+      }
+      
+      m_player.inv_items_added.clear();
+      selected_items.clear();
+      for_each_item_store(*this, [&](int, auto& slot_map, auto& pc_handles)
+      {
+        pc_handles.clear();
+        if (!ok || !reader.read_count(count, 5))
+        {
+          ok = false;
+          return;
+        }
+        for (uint32_t i = 0; i < count && ok; ++i)
+        {
+          int32_t item_idx = -1;
+          bool selected = false;
+          reader.read(item_idx);
+          reader.read(selected);
+          auto handle = slot_map.get_handle(item_idx);
+          if (!reader.ok() || !handle.is_valid())
+          {
+            ok = false;
+            break;
+          }
+          auto* item = get_item_ptr(*slot_map.get(handle));
+          pc_handles.emplace_back(handle);
+          m_player.inv_items_added.emplace_back(item);
+          if (selected)
+            selected_items.emplace_back(item);
+        }
+      });
+      return ok;
+    }
+    
+    // Writes the complete state, which becomes the new checkpoint, here or in the background.
+    //   Only the copy of the state is taken here, the rest runs on the autosave thread.
+    bool write_save_game(const std::string& file_path, bool in_background)
+    {
+      if (m_dungeon_bytes == nullptr)
+      {
+        BinaryWriter writer;
+        write_dungeon(writer);
+        m_dungeon_bytes = std::make_shared<const std::vector<char>>(writer.get_buffer());
+      }
+      // Tells saves apart without drawing from the global rnd state.
+      static uint64_t save_ctr = 0;
+      auto save_id = RandStream::make_seed(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()),
+                                           ++save_ctr);
+      
+      // Until the save is written there is no checkpoint to write deltas against.
+      m_checkpoint.reset();
+      m_delta_size = 0;
+      auto f_save = [this, file_path, save_id, dungeon_bytes = m_dungeon_bytes, state = make_save_state(false)]()
+      {
+        auto checkpoint = std::make_shared<Checkpoint>(make_checkpoint(state));
+        checkpoint->file_path = file_path;
+        checkpoint->save_id = save_id;
+        
+        savegame::SaveHeader header;
+        header.save_id = save_id;
+        BinaryWriter writer;
+        writer.write(header);
+        writer.write_bytes(*dungeon_bytes);
+        write_snapshot_objects(writer, state);
+        write_runtime_state(writer, state, *checkpoint, false);
+        checkpoint->file_size = writer.size();
+        
+        SaveResult result;
+        if (!writer.save_replace(file_path))
+          return result;
+        // The delta of the previous checkpoint no longer applies.
+        std::error_code ec;
+        std::filesystem::remove(file_path + ".delta", ec);
+        result.ok = true;
+        result.checkpoint = std::move(checkpoint);
+        return result;
+      };
+      m_fow_dirty_rooms.assign(m_bsp_tree->get_num_rooms(), false);
+      m_fow_dirty_corridors.assign(m_bsp_tree->get_num_corridors(), false);
+      
+      if (in_background)
+      {
+        m_autosave_future = std::async(std::launch::async, std::move(f_save));
+        return true;
+      }
+      return finish_save(f_save());
+    }
+    
+    // Takes over the checkpoint of a full save or the size of a delta.
+    bool finish_save(SaveResult result)
+    {
+      if (result.checkpoint != nullptr)
+        m_checkpoint = std::move(result.checkpoint);
+      else if (result.ok)
+        m_delta_size = result.delta_size;
+      return result.ok;
+    }
+    
   public:
     DungGine(const std::string& exe_folder, bool use_fow, DungGineTextureParams texture_params = {})
       : message_handler(std::make_unique<MessageHandler>())
@@ -856,21 +1528,35 @@ namespace dung
       m_environment = std::make_unique<Environment>();
       m_environment->load_textures(exe_folder, texture_params);
       m_inventory = std::make_unique<Inventory>();
+      init_inventory();
       m_keyboard = std::make_unique<Keyboard>(m_environment.get(), m_inventory.get(), message_handler.get(),
                                               m_player,
                                               all_keys, all_lamps, all_weapons, all_potions, all_armour,
                                               all_npcs,
+                                              m_object_index,
                                               tbd, debug);
     }
     
     void load_dungeon(BSPTree* bsp_tree)
     {
+      // The autosave thread reads the tree. A new dungeon starts without a checkpoint.
+      wait_for_autosave();
+      m_checkpoint.reset();
+      m_dungeon_bytes.reset();
+      m_bsp_tree = bsp_tree;
       m_environment->load_dungeon(bsp_tree);
+      m_object_index.reset(bsp_tree);
+      m_placement_engine.reset(bsp_tree);
+      m_field_room = nullptr;
+      m_field_corridor = nullptr;
+      m_field_inputs.reset();
     }
     
     void style_dungeon()
     {
       m_environment->style_dungeon(m_latitude, m_longitude);
+      m_placement_engine.invalidate();
+      m_dungeon_bytes.reset();
     }
     
     void set_player_character(char ch) { m_player.character = ch; }
@@ -885,26 +1571,42 @@ namespace dung
       else
         m_player.pos = world_size / 2;
         
-      m_player.last_pos = m_player.pos;
+      m_player.rand_stream.seed(static_cast<uint64_t>(rnd::rand_int(0, 1'000'000'000)));
       
+      // Spawn in the corridor at the start position if there is one,
+      //   otherwise in a random cell of the corridor closest to it.
       const auto& room_corridor_map = m_environment->get_room_corridor_map();
-      
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      do
+      Corridor* corridor = nullptr;
+      float min_dist_sq = 0.f;
+      for (const auto& cp : room_corridor_map)
       {
-        for (const auto& cp : room_corridor_map)
-          if (cp.second->is_inside_corridor(m_player.pos))
-          {
-            m_player.is_spawned = true;
-            m_player.curr_corridor = cp.second;
-            m_screen_helper->focus_on_world_pos_mid_screen(m_player.pos);
-            return true;
-          }
-        m_player.pos += { rnd::rand_int(-2, +2), rnd::rand_int(-2, +2) };
-        m_player.pos = m_player.pos.clamp(0, world_size.r, 0, world_size.c);
-      } while (++num_iters < c_max_num_iters);
-      return false;
+        if (cp.second->is_inside_corridor(m_player.pos))
+        {
+          corridor = cp.second;
+          break;
+        }
+        float dist_sq = distance_squared(cp.second->bb.center(), m_player.pos);
+        if (corridor == nullptr || dist_sq < min_dist_sq)
+        {
+          corridor = cp.second;
+          min_dist_sq = dist_sq;
+        }
+      }
+      if (corridor == nullptr)
+        return false;
+      if (!corridor->is_inside_corridor(m_player.pos))
+      {
+        auto pos = PlacementEngine::sample_corridor_cell(corridor);
+        if (!pos.has_value())
+          return false;
+        m_player.pos = pos.value();
+      }
+      
+      m_player.last_pos = m_player.pos;
+      m_player.is_spawned = true;
+      m_player.curr_corridor = corridor;
+      m_screen_helper->focus_on_world_pos_mid_screen(m_player.pos);
+      return true;
     }
     
     // Randomizes the starting direction of the sun and the starting season.
@@ -932,52 +1634,31 @@ namespace dung
       
       m_sun_minutes_per_day = minutes_per_day;
       m_sun_day_t_offs = math::clamp(sun_day_t_offs, 0.f, 1.f);
+      m_t_solar_period = m_sun_day_t_offs;
+      m_t_season_period = m_sun_year_t_offs;
       m_sun_dir = m_solar_motion.get_solar_direction(m_latitude, m_longitude, m_season, m_sun_day_t_offs);
       m_use_per_room_lat_long_for_sun_dir = use_per_room_lat_long_for_sun_dir;
     }
     
     bool place_keys(bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
       const auto& door_vec = m_environment->fetch_doors();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryLand : PlacementRule::Anywhere;
       for (auto* d : door_vec)
       {
         if (d->is_locked)
         {
           Key key;
           key.key_id = d->key_id;
-          do
-          {
-            key.pos =
-            {
-              rnd::rand_int(0, world_size.r),
-              rnd::rand_int(0, world_size.c)
-            };
-            
-            BSPNode* room = nullptr;
-            valid_pos = m_environment->is_inside_any_room(key.pos, &room);
-            if (only_place_on_dry_land &&
-                room != nullptr &&
-                !is_dry(m_environment->get_terrain(key.pos)))
-            {
-              valid_pos = false;
-            }
-          } while (num_iters++ < c_max_num_iters && !valid_pos);
-          
-          BSPNode* leaf = nullptr;
-          if (!m_environment->is_inside_any_room(key.pos, &leaf))
+          auto placement = sample_placement(rule);
+          if (!placement.has_value())
             return false;
+          key.pos = placement->pos;
+          key.curr_room = placement->room;
+          key.is_underground = m_environment->is_underground(placement->room);
             
-          if (leaf != nullptr)
-          {
-            key.curr_room = leaf;
-            key.is_underground = m_environment->is_underground(leaf);
-          }
-            
-          all_keys.emplace_back(key);
+          auto handle = all_keys.insert(key);
+          m_object_index.add_item(all_keys.get(handle), handle);
         }
       }
       return true;
@@ -985,10 +1666,7 @@ namespace dung
     
     bool place_lamps(int num_torches, int num_lanterns, int num_magic_lamps, bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryLand : PlacementRule::Anywhere;
       const int num_lamps = num_torches + num_lanterns + num_magic_lamps;
       int ctr_torches = 0;
       int ctr_lanterns = 0;
@@ -1004,55 +1682,25 @@ namespace dung
         else if (ctr_magic_lamps++ < num_magic_lamps)
           lamp_type = Lamp::LampType::MagicLamp;
         lamp.init_rand(lamp_type);
-        do
-        {
-          if (lamp_idx == 0 && num_iters < 50)
-          {
-            lamp.pos =
-            {
-              rnd::rand_int(m_player.pos.r - 20, m_player.pos.r + 20),
-              rnd::rand_int(m_player.pos.c - 20, m_player.pos.c + 20)
-            };
-          }
-          else
-          {
-            lamp.pos =
-            {
-              rnd::rand_int(0, world_size.r),
-              rnd::rand_int(0, world_size.c)
-            };
-          }
-          BSPNode* room = nullptr;
-          valid_pos = m_environment->is_inside_any_room(lamp.pos, &room);
-          if (only_place_on_dry_land &&
-              room != nullptr &&
-              !is_dry(m_environment->get_terrain(lamp.pos)))
-          {
-            valid_pos = false;
-          }
-        } while (num_iters++ < c_max_num_iters && !valid_pos);
-        
-        BSPNode* leaf = nullptr;
-        if (!m_environment->is_inside_any_room(lamp.pos, &leaf))
+        // Try to place the first lamp close to the PC.
+        auto placement = lamp_idx == 0 ?
+          sample_placement(rule, m_player.pos, 20) :
+          sample_placement(rule);
+        if (!placement.has_value())
           return false;
-          
-        if (leaf != nullptr)
-        {
-          lamp.curr_room = leaf;
-          lamp.is_underground = m_environment->is_underground(leaf);
-        }
+        lamp.pos = placement->pos;
+        lamp.curr_room = placement->room;
+        lamp.is_underground = m_environment->is_underground(placement->room);
         
-        all_lamps.emplace_back(lamp);
+        auto handle = all_lamps.insert(lamp);
+        m_object_index.add_item(all_lamps.get(handle), handle);
       }
       return true;
     }
     
     bool place_weapons(int num_weapons, bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryLand : PlacementRule::Anywhere;
       for (int wpn_idx = 0; wpn_idx < num_weapons; ++wpn_idx)
       {
         std::unique_ptr<Weapon> weapon;
@@ -1064,85 +1712,41 @@ namespace dung
           // Error:
           default: return false;
         }
-        do
-        {
-          weapon->pos =
-          {
-            rnd::rand_int(0, world_size.r),
-            rnd::rand_int(0, world_size.c)
-          };
-          BSPNode* room = nullptr;
-          valid_pos = m_environment->is_inside_any_room(weapon->pos, &room);
-          if (only_place_on_dry_land &&
-              room != nullptr &&
-              !is_dry(m_environment->get_terrain(weapon->pos)))
-          {
-            valid_pos = false;
-          }
-        } while (num_iters++ < c_max_num_iters && !valid_pos);
-        
-        BSPNode* leaf = nullptr;
-        if (!m_environment->is_inside_any_room(weapon->pos, &leaf))
+        auto placement = sample_placement(rule);
+        if (!placement.has_value())
           return false;
-          
-        if (leaf != nullptr)
-        {
-          weapon->curr_room = leaf;
-          weapon->is_underground = m_environment->is_underground(leaf);
-        }
+        weapon->pos = placement->pos;
+        weapon->curr_room = placement->room;
+        weapon->is_underground = m_environment->is_underground(placement->room);
         
-        all_weapons.emplace_back(weapon.release());
+        auto handle = all_weapons.emplace(weapon.release());
+        m_object_index.add_item(all_weapons.get(handle)->get(), handle);
       }
       return true;
     }
     
     bool place_potions(int num_potions, bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryLand : PlacementRule::Anywhere;
       for (int pot_idx = 0; pot_idx < num_potions; ++pot_idx)
       {
         Potion potion;
-        do
-        {
-          potion.pos =
-          {
-            rnd::rand_int(0, world_size.r),
-            rnd::rand_int(0, world_size.c)
-          };
-          BSPNode* room = nullptr;
-          valid_pos = m_environment->is_inside_any_room(potion.pos, &room);
-          if (only_place_on_dry_land &&
-              room != nullptr &&
-              !is_dry(m_environment->get_terrain(potion.pos)))
-          {
-            valid_pos = false;
-          }
-        } while (num_iters++ < c_max_num_iters && !valid_pos);
-        
-        BSPNode* leaf = nullptr;
-        if (!m_environment->is_inside_any_room(potion.pos, &leaf))
+        auto placement = sample_placement(rule);
+        if (!placement.has_value())
           return false;
-          
-        if (leaf != nullptr)
-        {
-          potion.curr_room = leaf;
-          potion.is_underground = m_environment->is_underground(leaf);
-        }
+        potion.pos = placement->pos;
+        potion.curr_room = placement->room;
+        potion.is_underground = m_environment->is_underground(placement->room);
         
-        all_potions.emplace_back(potion);
+        auto handle = all_potions.insert(potion);
+        m_object_index.add_item(all_potions.get(handle), handle);
       }
       return true;
     }
     
     bool place_armour(int num_armour, bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryLand : PlacementRule::Anywhere;
       for (int a_idx = 0; a_idx < num_armour; ++a_idx)
       {
         std::unique_ptr<Armour> armour;
@@ -1158,89 +1762,248 @@ namespace dung
           // Error:
           default: return false;
         }
-        do
-        {
-          armour->pos =
-          {
-            rnd::rand_int(0, world_size.r),
-            rnd::rand_int(0, world_size.c)
-          };
-          BSPNode* room = nullptr;
-          valid_pos = m_environment->is_inside_any_room(armour->pos, &room);
-          if (only_place_on_dry_land &&
-              room != nullptr &&
-              !is_dry(m_environment->get_terrain(armour->pos)))
-          {
-            valid_pos = false;
-          }
-        } while (num_iters++ < c_max_num_iters && !valid_pos);
-        
-        BSPNode* leaf = nullptr;
-        if (!m_environment->is_inside_any_room(armour->pos, &leaf))
+        auto placement = sample_placement(rule);
+        if (!placement.has_value())
           return false;
-          
-        if (leaf != nullptr)
-        {
-          armour->curr_room = leaf;
-          armour->is_underground = m_environment->is_underground(leaf);
-        }
+        armour->pos = placement->pos;
+        armour->curr_room = placement->room;
+        armour->is_underground = m_environment->is_underground(placement->room);
         
-        all_armour.emplace_back(armour.release());
+        auto handle = all_armour.emplace(armour.release());
+        m_object_index.add_item(all_armour.get(handle)->get(), handle);
       }
       return true;
     }
     
     bool place_npcs(int num_npcs, bool only_place_on_dry_land)
     {
-      const auto world_size = m_environment->get_world_size();
-      const int c_max_num_iters = 1e5_i;
-      int num_iters = 0;
-      bool valid_pos = false;
+      const auto rule = only_place_on_dry_land ? PlacementRule::DryWalkable : PlacementRule::Anywhere;
+      const auto base_seed = static_cast<uint64_t>(rnd::rand_int(0, 1'000'000'000));
       for (int npc_idx = 0; npc_idx < num_npcs; ++npc_idx)
       {
         NPC npc;
+        npc.rand_stream.seed(RandStream::make_seed(base_seed, all_npcs.size()));
         npc.npc_class = rnd::rand_enum<Class>();
         npc.npc_race = rnd::rand_enum<Race>();
-        do
-        {
-          npc.pos =
-          {
-            rnd::rand_int(0, world_size.r),
-            rnd::rand_int(0, world_size.c)
-          };
-          BSPNode* room = nullptr;
-          valid_pos = m_environment->is_inside_any_room(npc.pos, &room);
-          if (only_place_on_dry_land &&
-              room != nullptr)
-          {
-            if (!is_dry(m_environment->get_terrain(npc.pos)))
-              valid_pos = false;
-            else if (!m_environment->allow_move_to(npc.pos.r, npc.pos.c))
-              valid_pos = false;
-          }
-        } while (num_iters++ < c_max_num_iters && !valid_pos);
-        
-        BSPNode* leaf = nullptr;
-        if (!m_environment->is_inside_any_room(npc.pos, &leaf))
+        auto placement = sample_placement(rule);
+        if (!placement.has_value())
           return false;
-          
-        if (leaf != nullptr)
-        {
-          npc.curr_room = leaf;
-          npc.is_underground = m_environment->is_underground(leaf);
-          npc.init(all_weapons);
-        }
+        npc.pos = placement->pos;
+        npc.curr_room = placement->room;
+        npc.is_underground = m_environment->is_underground(placement->room);
+        npc.init(all_weapons);
+        // The NPC carries its weapon.
+        if (auto* weapon = all_weapons.get(npc.weapon_handle); weapon != nullptr)
+          m_object_index.remove_item(weapon->get());
         
         all_npcs.emplace_back(npc);
       }
       return true;
     }
     
+    // Writes the loaded and styled dungeon together with the placed items and NPCs
+    //   (but not the PC) to a binary snapshot file, see DungeonSnapshot.h.
+    bool save_dungeon_snapshot(const std::string& file_path) const
+    {
+      if (m_bsp_tree == nullptr)
+      {
+        std::cerr << "ERROR in DungGine::save_dungeon_snapshot() : No dungeon loaded!" << std::endl;
+        return false;
+      }
+      BinaryWriter writer;
+      writer.write(snapshot::SnapshotHeader {});
+      write_dungeon(writer);
+      write_snapshot_objects(writer, *this);
+      return writer.save(file_path);
+    }
+    
+    // Instead of load_dungeon(), style_dungeon() and the place_*() functions
+    //   other than place_player(). Overwrites bsp_tree with the stored tree.
+    // The file is memory mapped and read in place.
+    bool load_dungeon_snapshot(BSPTree* bsp_tree, const std::string& file_path)
+    {
+      MappedFile file { file_path };
+      BinaryReader reader { file.data(), file.size() };
+      snapshot::SnapshotHeader header;
+      if (!file.is_open() || !snapshot::read_header(reader, header))
+      {
+        std::cerr << "ERROR in DungGine::load_dungeon_snapshot() : Unable to read \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+      return read_dungeon_snapshot(reader, bsp_tree);
+    }
+    
+    // Writes the dungeon and the complete runtime state to a save file, see SaveGame.h:
+    //   The PC and its inventory, the NPCs, doors, fog of war, lamp burn times and the sun.
+    //   Blood splats and messages are not saved.
+    // The save becomes the checkpoint that autosave() writes deltas against.
+    bool save_game(const std::string& file_path)
+    {
+      if (m_bsp_tree == nullptr)
+      {
+        std::cerr << "ERROR in DungGine::save_game() : No dungeon loaded!" << std::endl;
+        return false;
+      }
+      wait_for_autosave();
+      return write_save_game(file_path, false);
+    }
+    
+    // Writes what has changed since the checkpoint to file_path + ".delta" on a background
+    //   thread: The fog of war of the rooms and corridors the PC has been in and the items,
+    //   NPCs and doors whose state differs. The delta replaces the previous one.
+    // Writes a full save instead, also in the background, when there is no checkpoint for
+    //   file_path or when the last delta had grown to half the size of the checkpoint.
+    // Only copying the state happens here. Serializing, comparing against the checkpoint
+    //   and writing happen on the autosave thread, which reads the layout of the tree,
+    //   so the tree must stay as it is until wait_for_autosave().
+    // Returns false without saving while the previous autosave is still being written.
+    bool autosave(const std::string& file_path)
+    {
+      if (m_bsp_tree == nullptr)
+      {
+        std::cerr << "ERROR in DungGine::autosave() : No dungeon loaded!" << std::endl;
+        return false;
+      }
+      if (m_autosave_future.valid()
+          && m_autosave_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+      // A failed save leaves no checkpoint on disk to apply deltas to.
+      if (!wait_for_autosave())
+        m_checkpoint.reset();
+      // Each delta holds all changes since the checkpoint, so they only grow.
+      if (m_checkpoint == nullptr || m_checkpoint->file_path != file_path
+          || m_delta_size > m_checkpoint->file_size / 2)
+        return write_save_game(file_path, true);
+      
+      m_autosave_future = std::async(std::launch::async,
+                                     [this, file_path, checkpoint = m_checkpoint, state = make_save_state(true)]()
+      {
+        savegame::DeltaHeader header;
+        header.save_id = checkpoint->save_id;
+        BinaryWriter writer;
+        writer.write(header);
+        write_runtime_state(writer, state, *checkpoint, true);
+        SaveResult result;
+        result.ok = writer.save_replace(file_path + ".delta");
+        result.delta_size = writer.size();
+        return result;
+      });
+      return true;
+    }
+    
+    // Blocks until the autosave being written, if any, is done. Returns false if it failed.
+    bool wait_for_autosave()
+    {
+      if (!m_autosave_future.valid())
+        return true;
+      return finish_save(m_autosave_future.get());
+    }
+    
+    // Instead of load_dungeon(), style_dungeon(), configure_sun() and the place_*() functions.
+    //   Overwrites bsp_tree with the stored tree and applies the autosave delta, if any.
+    // real_time_s : The time of the next update(). The sun continues from where it was saved.
+    bool load_game(BSPTree* bsp_tree, const std::string& file_path, const RC& screen_size,
+                   double real_time_s = 0.)
+    {
+      auto f_fail = [](const std::string& err_msg)
+      {
+        std::cerr << "ERROR in DungGine::load_game() : " << err_msg << std::endl;
+        return false;
+      };
+      
+      wait_for_autosave();
+      m_checkpoint.reset();
+      
+      MappedFile file { file_path };
+      BinaryReader reader { file.data(), file.size() };
+      savegame::SaveHeader header;
+      if (!file.is_open() || !snapshot::read_header(reader, header))
+        return f_fail("Unable to read \"" + file_path + "\"!");
+      if (!read_dungeon_snapshot(reader, bsp_tree))
+        return false;
+      std::vector<Item*> selected_items;
+      if (!read_runtime_state(reader, selected_items))
+        return f_fail("Invalid runtime state in \"" + file_path + "\"!");
+      
+      // A delta left over from an older save is ignored.
+      MappedFile delta_file { file_path + ".delta" };
+      BinaryReader delta_reader { delta_file.data(), delta_file.size() };
+      savegame::DeltaHeader delta_header;
+      bool has_delta = delta_file.is_open()
+        && snapshot::read_header(delta_reader, delta_header)
+        && delta_header.save_id == header.save_id;
+      if (has_delta && !read_runtime_state(delta_reader, selected_items))
+        return f_fail("Invalid autosave delta \"" + file_path + ".delta\"!");
+      
+      m_blood_splat_pool.set_capacity(m_blood_splat_pool.get_capacity());
+      m_object_index.reset(bsp_tree);
+      for_each_item_store(*this, [this](int, auto& slot_map, auto&)
+      {
+        for (auto it = slot_map.begin(); it != slot_map.end(); ++it)
+          if (auto* item = get_item_ptr(*it); !item->picked_up)
+            m_object_index.add_item(item, it.handle());
+      });
+      // Keeps the stored death time.
+      for (auto& npc : all_npcs)
+        if (npc.health <= 0)
+          npc.trg_death.once();
+      
+      m_inventory->clear();
+      init_inventory();
+      update_inventory();
+      for (auto* item : selected_items)
+        m_inventory->select_item(item);
+      
+      auto f_offs = [real_time_s](float t_period, float minutes_per_period)
+      {
+        float t_offs = std::fmod(t_period - static_cast<float>(real_time_s / 60.) / minutes_per_period, 1.f);
+        return t_offs < 0.f ? t_offs + 1.f : t_offs;
+      };
+      m_sun_day_t_offs = f_offs(m_sun_day_t_offs, m_sun_minutes_per_day);
+      m_sun_year_t_offs = f_offs(m_sun_year_t_offs, m_sun_minutes_per_year);
+      update_sun(static_cast<float>(real_time_s));
+      
+      m_screen_helper->set_screen_size(screen_size);
+      m_screen_helper->focus_on_world_pos_mid_screen(m_player.pos);
+      
+      // Without a delta the save is the checkpoint. With one, the next autosave writes a full save,
+      //   since the next delta replaces this one.
+      m_fow_dirty_rooms.assign(bsp_tree->get_num_rooms(), false);
+      m_fow_dirty_corridors.assign(bsp_tree->get_num_corridors(), false);
+      if (!has_delta)
+      {
+        // No fog of war is dirty, so none is copied.
+        auto checkpoint = std::make_shared<Checkpoint>(make_checkpoint(make_save_state(true)));
+        checkpoint->file_path = file_path;
+        checkpoint->save_id = header.save_id;
+        checkpoint->file_size = file.size();
+        m_checkpoint = std::move(checkpoint);
+        m_delta_size = 0;
+      }
+      return true;
+    }
+    
+    // num_threads : Total number of threads used for updating the NPCs.
+    //   0 (the default) means one per hardware thread.
+    void set_num_npc_update_threads(int num_threads)
+    {
+      m_npc_thread_pool.set_num_threads(num_threads);
+    }
+    
+    // Removes all current blood splats.
+    void set_max_num_blood_splats(int max_num_splats)
+    {
+      m_object_index.clear_blood_splats();
+      m_blood_splat_pool.set_capacity(max_num_splats);
+    }
+    
     void update(int frame_ctr, float fps,
                 double real_time_s, float sim_time_s, float sim_dt_s,
                 float fire_smoke_dt_factor, 
                 const keyboard::KeyPressDataPair& kpdp, bool* game_over)
     {
+      DUNGGINE_PROFILE_SCOPE("update");
+      
       utils::try_set(game_over, m_player.health <= 0);
       if (utils::try_get(game_over))
         return;
@@ -1251,7 +2014,15 @@ namespace dung
       bool do_npc_move = frame_ctr % std::max(1, math::roundI(fps / 4)) == 0;
       bool do_fight = frame_ctr % std::max(1, math::roundI(fps / 3)) == 0;
     
-      update_sun(static_cast<float>(real_time_s));
+      {
+        DUNGGINE_PROFILE_SCOPE("update_sun");
+        update_sun(static_cast<float>(real_time_s));
+        m_environment->update_sun_dirs(m_solar_motion, m_sun_dir,
+                                       m_t_solar_period, m_season,
+                                       m_use_per_room_lat_long_for_sun_dir);
+      }
+      
+      m_environment->update_texture_animation(real_time_s);
       
       auto fow_radius = 5.5f;
       auto* lamp = m_player.get_selected_lamp(m_inventory.get());
@@ -1261,30 +2032,69 @@ namespace dung
         math::minimize(fow_radius, globals::max_fow_radius);
       }
       
-      set_visibilities(fow_radius, m_player.pos);
+      {
+        DUNGGINE_PROFILE_SCOPE("set_visibilities");
+        set_visibilities();
+      }
       
       auto& curr_pos = m_player.pos;
-      m_keyboard->handle_keyboard(kpdp, real_time_s);
+      {
+        DUNGGINE_PROFILE_SCOPE("handle_keyboard");
+        m_keyboard->handle_keyboard(kpdp, real_time_s);
+      }
       
-      update_inventory();
+      {
+        DUNGGINE_PROFILE_SCOPE("update_inventory");
+        update_inventory();
+      }
       
       if (stall_game)
         return;
       
-      // Fog of war
-      if (use_fog_of_war)
-        update_field(curr_pos,
-                     [](auto obj) { return &obj->fog_of_war; },
-                     false, fow_radius, 0.f, Lamp::LightType::Isotropic);
-                  
-      // Light
-      clear_field([](auto obj) { return &obj->light; }, false);
-      if (lamp != nullptr)
       {
-        update_field(curr_pos,
-                     [](auto obj) { return &obj->light; },
-                     true, lamp->radius, lamp->angle_deg,
-                     lamp->light_type);
+        DUNGGINE_PROFILE_SCOPE("update_field");
+        
+        FieldInputs field_inputs;
+        field_inputs.pos = curr_pos;
+        field_inputs.los_r = m_player.los_r;
+        field_inputs.los_c = m_player.los_c;
+        field_inputs.room = m_player.curr_room;
+        field_inputs.corridor = m_player.curr_corridor;
+        field_inputs.use_fog_of_war = use_fog_of_war;
+        field_inputs.fow_radius = fow_radius;
+        field_inputs.lamp = lamp;
+        if (lamp != nullptr)
+        {
+          field_inputs.lamp_radius = lamp->radius;
+          field_inputs.lamp_angle_deg = lamp->angle_deg;
+          field_inputs.lamp_light_type = lamp->light_type;
+        }
+        field_inputs.objects_version = m_object_index.get_version();
+        
+        if (m_field_inputs != field_inputs || m_blood_splat_pool.num_active() > 0)
+        {
+          // Fog of war
+          if (use_fog_of_war)
+          {
+            update_visible_field(curr_pos, fow_radius);
+            update_field(curr_pos,
+                         [](auto obj) { return &obj->fog_of_war; },
+                         false, fow_radius, 0.f, Lamp::LightType::Isotropic);
+            mark_fow_dirty(m_player.curr_room, m_player.curr_corridor);
+          }
+          
+          // Light
+          clear_field([](auto obj) { return &obj->light; }, false);
+          if (lamp != nullptr)
+          {
+            update_field(curr_pos,
+                         [](auto obj) { return &obj->light; },
+                         true, lamp->radius, lamp->angle_deg,
+                         lamp->light_type);
+          }
+          
+          m_field_inputs = field_inputs;
+        }
       }
       
       // Update current room and current corridor.
@@ -1308,30 +2118,40 @@ namespace dung
       }
       
       // PC LOS etc.
-      bool was_alive = m_player.health > 0;
-      m_player.on_terrain = m_environment->get_terrain(m_player.pos);
-      m_player.update(m_screen_helper.get(), m_inventory.get(),
-                      do_los_terrainos,
-                      sim_time_s, sim_dt_s * fire_smoke_dt_factor);
-      if (was_alive && m_player.health <= 0)
-      {
-        message_handler->add_message(static_cast<float>(real_time_s),
-                                     "You died!",
-                                     MessageHandler::Level::Fatal);
-        broadcast([](auto* listener) { listener->on_pc_death(); });
+      {
+        DUNGGINE_PROFILE_SCOPE("update_pc");
+        bool was_alive = m_player.health > 0;
+        m_player.on_terrain = m_environment->get_terrain(m_player.pos);
+        m_player.update(m_screen_helper.get(), m_inventory.get(),
+                        do_los_terrainos,
+                        sim_time_s, sim_dt_s * fire_smoke_dt_factor);
+        if (was_alive && m_player.health <= 0)
+        {
+          message_handler->add_message(static_cast<float>(real_time_s),
+                                       "You died!",
+                                       MessageHandler::Level::Fatal);
+          broadcast([](auto* listener) { listener->on_pc_death(); });
+        }
       }
       
       // NPCs
       {
+        DUNGGINE_PROFILE_SCOPE("update_npcs");
         BSPNode* pc_room = m_player.is_inside_curr_room() ? m_player.curr_room : nullptr;
         Corridor* pc_corr = m_player.is_inside_curr_corridor() ? m_player.curr_corridor : nullptr;
-        for (auto& npc : all_npcs)
+        // NPCs only modify their own state here and only read the environment.
+        m_npc_thread_pool.parallel_for(stlutils::sizeI(all_npcs), [&](int npc_idx)
         {
+          auto& npc = all_npcs[npc_idx];
           npc.on_terrain = m_environment->get_terrain(npc.pos);
           npc.update(curr_pos, pc_room, pc_corr, m_environment.get(),
                      do_los_terrainos, do_npc_move,
                      sim_time_s, sim_dt_s);
+        });
         
+        // Listeners are notified afterwards on this thread, in NPC order.
+        for (auto& npc : all_npcs)
+        {
           if (npc.is_hostile && !npc.was_hostile)
             broadcast([&npc](auto* listener) { listener->on_fight_begin(&npc); });
           else if (!npc.is_hostile && npc.was_hostile)
@@ -1340,7 +2160,10 @@ namespace dung
       }
       
       if (do_fight)
+      {
+        DUNGGINE_PROFILE_SCOPE("update_fighting");
         update_fighting(static_cast<float>(real_time_s));
+      }
       
       m_screen_helper->update_scrolling(curr_pos);
     }
@@ -1355,8 +2178,10 @@ namespace dung
               bool framed_mode = false,
               bool gore = false)
     {
-      const auto& room_corridor_map = m_environment->get_room_corridor_map();
-      const auto& door_vec = m_environment->fetch_doors();
+      DUNGGINE_PROFILE_SCOPE("draw");
+      
+      // Everything below only touches what is on screen.
+      const auto& visible_set = m_environment->update_visible_set(m_screen_helper->get_screen_rect());
       
       MessageBoxDrawingArgs mb_args;
       mb_args.v_align = mb_v_align;
@@ -1377,13 +2202,12 @@ namespace dung
       
       auto pc_scr_pos = m_screen_helper->get_screen_pos(m_player.pos);
       
-      draw_fighting(sh, pc_scr_pos, anim_ctr_fight % 2 == 0, static_cast<float>(real_time_s), sim_time_s);
-      
-      for (auto& bs : m_player.blood_splats)
-        bs.update(sim_time_s);
-      for (auto& npc : all_npcs)
-        for (auto& bs : npc.blood_splats)
-          bs.update(sim_time_s);
+      {
+        DUNGGINE_PROFILE_SCOPE("draw_fighting");
+        draw_fighting(sh, pc_scr_pos, anim_ctr_fight % 2 == 0, static_cast<float>(real_time_s), sim_time_s);
+        
+        m_blood_splat_pool.update(sim_time_s);
+      }
 
       if (debug)
       {
@@ -1429,7 +2253,7 @@ namespace dung
       // Items and NPCs
       auto f_render_item = [&](const auto& obj)
       {
-        if (!obj.visible)
+        if (!obj.visible || !m_screen_helper->is_on_screen(obj.pos))
           return;
         auto scr_pos = m_screen_helper->get_screen_pos(obj.pos);
         sh.write_buffer(std::string(1, obj.character), scr_pos.r, scr_pos.c, obj.style);
@@ -1437,6 +2261,10 @@ namespace dung
       
       for (const auto& npc : all_npcs)
       {
+        // The death animation reaches two cells out from the NPC.
+        if (!npc.debug && !m_screen_helper->is_on_screen(npc.pos, 2))
+          continue;
+      
         //bool swimming = is_wet(npc.on_terrain) && npc.can_swim && !npc.can_fly;
         bool dead_on_liquid = npc.health <= 0 && is_wet(npc.on_terrain); //&& swimming;
         if (!dead_on_liquid || sim_time_s - npc.death_time_s < 1.5f + (npc.can_fly ? 0.5f : 0.f))
@@ -1520,8 +2348,9 @@ namespace dung
         }
       }
       
-      for (auto* door : door_vec)
+      for (int door_id : visible_set.door_ids)
       {
+        auto* door = m_environment->fetch_door(door_id);
         auto door_pos = door->pos;
         auto door_scr_pos = m_screen_helper->get_screen_pos(door_pos);
         std::string door_ch = "^";
@@ -1537,23 +2366,27 @@ namespace dung
         sh.write_buffer(door_ch, door_scr_pos.r, door_scr_pos.c, Color::Black, (use_fog_of_war && door->fog_of_war) ? Color::Black : (door->light ? Color::Yellow : Color::DarkYellow));
       }
       
-      for (const auto& key : all_keys)
-        f_render_item(key);
-      
-      for (const auto& lamp : all_lamps)
-        f_render_item(lamp);
+      // Only the objects in the rooms and corridors on screen.
+      auto f_for_each_visible_bucket = [&](auto f)
+      {
+        for (int room_id : visible_set.room_ids)
+          if (const auto* bucket = m_object_index.fetch_room_bucket(room_id); bucket != nullptr)
+            f(*bucket);
+        for (int corr_id : visible_set.corridor_ids)
+          if (const auto* bucket = m_object_index.fetch_corridor_bucket(corr_id); bucket != nullptr)
+            f(*bucket);
+        f(m_object_index.get_unlocated_bucket());
+      };
       
-      for (const auto& weapon : all_weapons)
-        f_render_item(*weapon);
-        
-      for (const auto& potion : all_potions)
-        f_render_item(potion);
-        
-      for (const auto& armour : all_armour)
-        f_render_item(*armour);
+      f_for_each_visible_bucket([&](const ObjectIndex::Bucket& bucket)
+      {
+        for (const auto* item : bucket.items)
+          f_render_item(*item);
+      });
         
       if (gore)
       {
+        DUNGGINE_PROFILE_SCOPE("draw_blood");
         auto f_draw_blood_splat = [&sh](const RC& scr_pos, const BloodSplat& bs)
         {
           if (is_wet(bs.terrain) && !bs.alive)
@@ -1569,28 +2402,26 @@ namespace dung
           auto style = styles::make_shaded_style(Color::Red, bs.visible ? color::ShadeType::Bright : color::ShadeType::Dark);
           sh.write_buffer(str, scr_pos.r, scr_pos.c, style);
         };
-        for (const auto& bs : m_player.blood_splats)
-        {
-          auto bs_scr_pos = m_screen_helper->get_screen_pos(bs.pos);
-          f_draw_blood_splat(bs_scr_pos, bs);
-        }
-        for (const auto& npc : all_npcs)
+        f_for_each_visible_bucket([&](const ObjectIndex::Bucket& bucket)
         {
-          for (const auto& bs : npc.blood_splats)
+          for (const auto* bs : bucket.blood_splats)
           {
-            auto bs_scr_pos = m_screen_helper->get_screen_pos(bs.pos);
-            f_draw_blood_splat(bs_scr_pos, bs);
+            if (!m_screen_helper->is_on_screen(bs->pos))
+              continue;
+            auto bs_scr_pos = m_screen_helper->get_screen_pos(bs->pos);
+            f_draw_blood_splat(bs_scr_pos, *bs);
           }
-        }
+        });
       }
       
-      m_environment->draw_environment(sh, real_time_s,
-                                      use_fog_of_war,
-                                      m_sun_dir, m_solar_motion,
-                                      m_t_solar_period, m_season,
-                                      m_use_per_room_lat_long_for_sun_dir,
-                                      m_screen_helper.get(),
-                                      debug);
+      {
+        DUNGGINE_PROFILE_SCOPE("draw_environment");
+        m_environment->draw_environment(sh,
+                                        use_fog_of_war,
+                                        m_sun_dir,
+                                        m_screen_helper.get(),
+                                        debug);
+      }
     }
     
   };
@@ -0,0 +1,277 @@
+//
+//  DungeonSnapshot.h
+//  DungGine
+//
+
+#pragma once
+#include "BinaryStream.h"
+#include "BSPTree.h"
+#include "Items.h"
+#include "NPC.h"
+#include <memory>
+#include <cstdint>
+
+
+namespace dung
+{
+
+  // Binary dungeon snapshot format (.dsnap), see DungGine::save_dungeon_snapshot():
+  //   SnapshotHeader (magic "DGSN", version), then
+  //   BSPTree::write_snapshot(), Environment::write_snapshot() and the keys, lamps,
+  //   weapons, potions, armour and NPCs, each as a count followed by the records.
+  // Pointers to rooms, corridors, doors and weapons are stored as ids / indices.
+  // Native-endian, like the binary textures.
+  namespace snapshot
+  {
+
+    struct SnapshotHeader
+    {
+      char magic[4] = { 'D', 'G', 'S', 'N' };
+      uint32_t version = 2;
+    };
+
+    // Reads a header with a magic and a version and checks them against a default constructed one.
+    template<typename Header>
+    bool read_header(BinaryReader& reader, Header& header)
+    {
+      const Header ref_header;
+      return reader.read(header)
+        && std::memcmp(header.magic, ref_header.magic, sizeof(header.magic)) == 0
+        && header.version == ref_header.version;
+    }
+
+    void write_style(BinaryWriter& writer, const Style& style)
+    {
+      writer.write<int32_t>(static_cast<int32_t>(style.fg_color));
+      writer.write<int32_t>(static_cast<int32_t>(style.bg_color));
+    }
+
+    bool read_style(BinaryReader& reader, Style& style)
+    {
+      int32_t fg = 0, bg = 0;
+      reader.read(fg);
+      reader.read(bg);
+      style = { static_cast<Color>(fg), static_cast<Color>(bg) };
+      return reader.ok();
+    }
+
+    void write_location(BinaryWriter& writer, const BSPTree& bsp_tree,
+                        const BSPNode* room, const Corridor* corr)
+    {
+      writer.write<int32_t>(bsp_tree.get_room_id(room));
+      writer.write<int32_t>(bsp_tree.get_corridor_id(corr));
+    }
+
+    bool read_location(BinaryReader& reader, BSPTree& bsp_tree,
+                       BSPNode*& room, Corridor*& corr)
+    {
+      int32_t room_id = -1, corr_id = -1;
+      reader.read(room_id);
+      reader.read(corr_id);
+      if (!reader.ok() || room_id >= bsp_tree.get_num_rooms() || corr_id >= bsp_tree.get_num_corridors())
+        return false;
+      room = room_id >= 0 ? bsp_tree.fetch_room(room_id) : nullptr;
+      corr = corr_id >= 0 ? bsp_tree.fetch_corridor(corr_id) : nullptr;
+      return true;
+    }
+
+    // The state shared by all items.
+    void write_item(BinaryWriter& writer, const BSPTree& bsp_tree, const Item& item)
+    {
+      writer.write_rc(item.pos);
+      write_location(writer, bsp_tree, item.curr_room, item.curr_corridor);
+      writer.write<bool>(item.fog_of_war);
+      writer.write<bool>(item.is_underground);
+      writer.write<bool>(item.picked_up);
+      write_style(writer, item.style);
+      writer.write<char>(item.character);
+      writer.write<float>(item.weight);
+      writer.write<float>(item.price);
+    }
+
+    bool read_item(BinaryReader& reader, BSPTree& bsp_tree, Item& item)
+    {
+      reader.read_rc(item.pos);
+      if (!read_location(reader, bsp_tree, item.curr_room, item.curr_corridor))
+        return false;
+      reader.read(item.fog_of_war);
+      reader.read(item.is_underground);
+      reader.read(item.picked_up);
+      read_style(reader, item.style);
+      reader.read(item.character);
+      reader.read(item.weight);
+      reader.read(item.price);
+      return reader.ok();
+    }
+
+    void write_key(BinaryWriter& writer, const BSPTree& bsp_tree, const Key& key)
+    {
+      write_item(writer, bsp_tree, key);
+      writer.write<int32_t>(key.key_id);
+    }
+
+    bool read_key(BinaryReader& reader, BSPTree& bsp_tree, Key& key)
+    {
+      read_item(reader, bsp_tree, key);
+      reader.read(key.key_id);
+      return reader.ok();
+    }
+
+    void write_lamp(BinaryWriter& writer, const BSPTree& bsp_tree, const Lamp& lamp)
+    {
+      write_item(writer, bsp_tree, lamp);
+      writer.write<int32_t>(static_cast<int32_t>(lamp.light_type));
+      writer.write<int32_t>(static_cast<int32_t>(lamp.lamp_type));
+      writer.write<float>(lamp.radius);
+      writer.write<float>(lamp.radius_0);
+      writer.write<float>(lamp.angle_deg);
+      writer.write<float>(lamp.life_time_s);
+      writer.write<float>(lamp.t_life_time);
+      writer.write<float>(lamp.time_used_s);
+    }
+
+    bool read_lamp(BinaryReader& reader, BSPTree& bsp_tree, Lamp& lamp)
+    {
+      int32_t light_type = 0, lamp_type = 0;
+      read_item(reader, bsp_tree, lamp);
+      reader.read(light_type);
+      reader.read(lamp_type);
+      reader.read(lamp.radius);
+      reader.read(lamp.radius_0);
+      reader.read(lamp.angle_deg);
+      reader.read(lamp.life_time_s);
+      reader.read(lamp.t_life_time);
+      reader.read(lamp.time_used_s);
+      lamp.light_type = static_cast<Lamp::LightType>(light_type);
+      lamp.lamp_type = static_cast<Lamp::LampType>(lamp_type);
+      return reader.ok();
+    }
+
+    void write_weapon(BinaryWriter& writer, const BSPTree& bsp_tree, const Weapon& weapon)
+    {
+      writer.write_string(weapon.type);
+      write_item(writer, bsp_tree, weapon);
+      writer.write<int32_t>(weapon.damage);
+      writer.write<bool>(weapon.rusty);
+      writer.write<bool>(weapon.sharpened);
+      writer.write<bool>(weapon.poisonous);
+    }
+
+    std::unique_ptr<Weapon> read_weapon(BinaryReader& reader, BSPTree& bsp_tree)
+    {
+      std::string type;
+      if (!reader.read_string(type))
+        return nullptr;
+      auto weapon = make_weapon(type);
+      if (weapon == nullptr || !read_item(reader, bsp_tree, *weapon))
+        return nullptr;
+      reader.read(weapon->damage);
+      reader.read(weapon->rusty);
+      reader.read(weapon->sharpened);
+      reader.read(weapon->poisonous);
+      return reader.ok() ? std::move(weapon) : nullptr;
+    }
+
+    void write_potion(BinaryWriter& writer, const BSPTree& bsp_tree, const Potion& potion)
+    {
+      write_item(writer, bsp_tree, potion);
+      writer.write<int32_t>(potion.health);
+      writer.write<bool>(potion.poison);
+    }
+
+    bool read_potion(BinaryReader& reader, BSPTree& bsp_tree, Potion& potion)
+    {
+      read_item(reader, bsp_tree, potion);
+      reader.read(potion.health);
+      reader.read(potion.poison);
+      return reader.ok();
+    }
+
+    void write_armour(BinaryWriter& writer, const BSPTree& bsp_tree, const Armour& armour)
+    {
+      writer.write_string(armour.type);
+      write_item(writer, bsp_tree, armour);
+      writer.write<int32_t>(armour.protection);
+    }
+
+    std::unique_ptr<Armour> read_armour(BinaryReader& reader, BSPTree& bsp_tree)
+    {
+      std::string type;
+      if (!reader.read_string(type))
+        return nullptr;
+      auto armour = make_armour(type);
+      if (armour == nullptr || !read_item(reader, bsp_tree, *armour))
+        return nullptr;
+      reader.read(armour->protection);
+      return reader.ok() ? std::move(armour) : nullptr;
+    }
+
+    // weapon_idx : Index of the NPC's weapon among the stored weapons, -1 if it has none.
+    void write_npc(BinaryWriter& writer, const BSPTree& bsp_tree, const NPC& npc, int weapon_idx)
+    {
+      writer.write_rc(npc.pos);
+      write_location(writer, bsp_tree, npc.curr_room, npc.curr_corridor);
+      writer.write<bool>(npc.is_underground);
+      writer.write<char>(npc.character);
+      write_style(writer, npc.style);
+      writer.write<int32_t>(static_cast<int32_t>(npc.npc_race));
+      writer.write<int32_t>(static_cast<int32_t>(npc.npc_class));
+      writer.write<int32_t>(npc.health);
+      writer.write<int32_t>(npc.strength);
+      writer.write<int32_t>(npc.dexterity);
+      writer.write<int32_t>(npc.endurance);
+      writer.write<int32_t>(npc.weakness);
+      writer.write<int32_t>(npc.thac0);
+      writer.write<int32_t>(npc.armor_class);
+      writer.write<bool>(npc.can_swim);
+      writer.write<bool>(npc.can_fly);
+      writer.write<bool>(npc.enemy);
+      writer.write<float>(npc.acc_step);
+      writer.write<float>(npc.acc_lim);
+      writer.write<float>(npc.vel_lim);
+      writer.write<int32_t>(npc.prob_change_acc);
+      writer.write<int32_t>(npc.prob_slow_fast);
+      writer.write<uint64_t>(npc.rand_stream.get_state());
+      writer.write<int32_t>(weapon_idx);
+    }
+
+    bool read_npc(BinaryReader& reader, BSPTree& bsp_tree, NPC& npc, int& weapon_idx)
+    {
+      int32_t race = 0, npc_class = 0;
+      uint64_t rand_state = 0;
+      reader.read_rc(npc.pos);
+      if (!read_location(reader, bsp_tree, npc.curr_room, npc.curr_corridor))
+        return false;
+      reader.read(npc.is_underground);
+      reader.read(npc.character);
+      read_style(reader, npc.style);
+      reader.read(race);
+      reader.read(npc_class);
+      reader.read(npc.health);
+      reader.read(npc.strength);
+      reader.read(npc.dexterity);
+      reader.read(npc.endurance);
+      reader.read(npc.weakness);
+      reader.read(npc.thac0);
+      reader.read(npc.armor_class);
+      reader.read(npc.can_swim);
+      reader.read(npc.can_fly);
+      reader.read(npc.enemy);
+      reader.read(npc.acc_step);
+      reader.read(npc.acc_lim);
+      reader.read(npc.vel_lim);
+      reader.read(npc.prob_change_acc);
+      reader.read(npc.prob_slow_fast);
+      reader.read(rand_state);
+      reader.read(weapon_idx);
+      npc.npc_race = static_cast<Race>(race);
+      npc.npc_class = static_cast<Class>(npc_class);
+      npc.rand_stream.seed(rand_state);
+      npc.pos_r = static_cast<float>(npc.pos.r);
+      npc.pos_c = static_cast<float>(npc.pos.c);
+      return reader.ok();
+    }
+
+  }
+
+}
@@ -10,6 +10,8 @@
 #include "RoomStyle.h"
 #include "Terrain.h"
 #include "ScreenHelper.h"
+#include "SpatialGrid.h"
+#include "TextureIO.h"
 #include <Termin8or/ScreenHandler.h>
 #include <optional>
 
@@ -17,6 +19,8 @@
 namespace dung
 {
 
+  // File names ending in .btex are loaded as binary textures (see TextureIO.h),
+  //   all other file names as text textures.
   struct DungGineTextureParams
   {
     double dt_anim_s = 0.1;
@@ -26,13 +30,23 @@ namespace dung
     std::vector<std::string> texture_file_names_underground_shadow;
   };
 
+  // Ids (see BSPTree::get_room_id() etc) of the rooms, corridors and doors that overlap the screen.
+  struct VisibleSet
+  {
+    std::vector<int> room_ids;
+    std::vector<int> corridor_ids;
+    std::vector<int> door_ids;
+  };
+
   class Environment final
   {
     BSPTree* m_bsp_tree;
     std::vector<BSPNode*> m_leaves;
     
-    std::map<BSPNode*, RoomStyle> m_room_styles;
-    std::map<Corridor*, RoomStyle> m_corridor_styles;
+    // Indexed by room / corridor id (see BSPTree::get_room_id() etc).
+    // Empty until style_dungeon() has been called.
+    std::vector<RoomStyle> m_room_styles;
+    std::vector<RoomStyle> m_corridor_styles;
     
     double dt_texture_anim_s = 0.1;
     double texture_anim_time_stamp = 0.;
@@ -43,6 +57,178 @@ namespace dung
     std::vector<drawing::Texture> texture_ug_shadow;
     drawing::Texture texture_empty;
     
+    // Terrain baked for every world cell so that terrain queries become array reads.
+    // When texture_anim_ctr advances, only the cells listed in the diff list
+    //   of the corresponding animation frame are rewritten.
+    RC m_world_size;
+    std::vector<Terrain> m_terrain_raster;
+    std::vector<std::vector<std::pair<int, Terrain>>> m_terrain_diffs_sl;
+    std::vector<std::vector<std::pair<int, Terrain>>> m_terrain_diffs_ug;
+    unsigned short m_terrain_raster_anim_ctr = 0;
+    
+    // Spatial index used for viewport culling.
+    static constexpr int c_visibility_grid_bucket_size = 16;
+    SpatialGrid m_room_grid;
+    SpatialGrid m_corridor_grid;
+    SpatialGrid m_door_grid;
+    VisibleSet m_visible_set;
+    std::vector<int> m_room_stamps, m_corridor_stamps, m_door_stamps;
+    int m_visible_set_stamp = 0;
+    
+    // The light of the room or corridor being drawn, unpacked from the lit plane.
+    bool_vector m_light_cells;
+    
+    // Solar direction of each styled room and corridor, by id. Only recomputed when the
+    //   solar phase, the season or the sun settings change.
+    std::vector<SolarDirection> m_room_sun_dirs;
+    std::vector<SolarDirection> m_corridor_sun_dirs;
+    int m_sun_phase_idx = -1;
+    Season m_sun_season = Season::NUM_ITEMS;
+    SolarDirection m_global_sun_dir = SolarDirection::Nadir;
+    bool m_use_per_room_sun_dir = true;
+    
+    void build_visibility_grids()
+    {
+      m_room_grid.reset(m_world_size, c_visibility_grid_bucket_size);
+      for (auto* leaf : m_leaves)
+        m_room_grid.insert(m_bsp_tree->get_room_id(leaf), leaf->bb_leaf_room);
+      m_room_stamps.assign(m_leaves.size(), -1);
+      
+      m_corridor_grid.reset(m_world_size, c_visibility_grid_bucket_size);
+      const auto& room_corridor_map = m_bsp_tree->get_room_corridor_map();
+      for (const auto& cp : room_corridor_map)
+        m_corridor_grid.insert(m_bsp_tree->get_corridor_id(cp.second), cp.second->bb);
+      m_corridor_stamps.assign(room_corridor_map.size(), -1);
+      
+      m_door_grid.reset(m_world_size, c_visibility_grid_bucket_size);
+      const auto& doors = m_bsp_tree->fetch_doors();
+      for (auto* door : doors)
+        m_door_grid.insert(m_bsp_tree->get_door_id(door), { door->pos.r, door->pos.c, 1, 1 });
+      m_door_stamps.assign(doors.size(), -1);
+    }
+    
+    static void query_visible(const SpatialGrid& grid, const ttl::Rectangle& rect,
+                              std::vector<int>& stamps, int stamp,
+                              const auto& f_get_bb,
+                              std::vector<int>& ids)
+    {
+      ids.clear();
+      grid.any_of(rect, [&](int id)
+      {
+        if (stamps[id] != stamp)
+        {
+          stamps[id] = stamp;
+          if (SpatialGrid::overlaps(f_get_bb(id), rect))
+            ids.emplace_back(id);
+        }
+        return false;
+      });
+      // Keep the drawing order the same as when all were drawn.
+      std::sort(ids.begin(), ids.end());
+    }
+    
+    static Terrain floor_type_to_terrain(FloorType floor_type)
+    {
+      switch (floor_type)
+      {
+        case FloorType::None: return Terrain::Default;
+        case FloorType::Sand: return Terrain::Sand;
+        case FloorType::Grass: return Terrain::Grass;
+        case FloorType::Stone: return Terrain::Stone;
+        case FloorType::Stone2: return Terrain::Stone;
+        case FloorType::Water: return Terrain::Water;
+        case FloorType::Wood: return Terrain::Wood;
+        default: return Terrain::Default;
+      }
+    }
+    
+    // local_pos is relative to the top-left corner of the unwalled area of the room.
+    Terrain calc_terrain(const RoomStyle& room_style, const RC& local_pos,
+                         unsigned short anim_ctr) const
+    {
+      const auto& fill_textures = room_style.is_underground ? texture_ug_fill : texture_sl_fill;
+      if (fill_textures.empty())
+        return floor_type_to_terrain(room_style.floor_type);
+      const auto& texture = fill_textures[anim_ctr % fill_textures.size()];
+      return material_to_terrain(texture(room_style.tex_pos + local_pos).mat);
+    }
+    
+    template<typename F>
+    void for_each_room_cell(BSPNode* room, F&& f) const
+    {
+      const auto& bb = room->bb_leaf_room;
+      for (int r = 1; r < bb.r_len - 1; ++r)
+        for (int c = 1; c < bb.c_len - 1; ++c)
+          f((bb.r + r) * m_world_size.c + bb.c + c, RC { r - 1, c - 1 });
+    }
+    
+    void bake_terrain_raster()
+    {
+      m_terrain_raster.assign(m_world_size.r * m_world_size.c, Terrain::Default);
+      for (int room_id = 0; room_id < stlutils::sizeI(m_room_styles); ++room_id)
+      {
+        const auto& room_style = m_room_styles[room_id];
+        for_each_room_cell(m_bsp_tree->fetch_room(room_id), [&](int idx, const RC& local_pos)
+        {
+          m_terrain_raster[idx] = calc_terrain(room_style, local_pos, texture_anim_ctr);
+        });
+      }
+      m_terrain_raster_anim_ctr = texture_anim_ctr;
+    }
+    
+    // Diff list k holds the cells that change when going from animation frame k to frame k + 1.
+    void bake_terrain_diffs(bool underground)
+    {
+      const auto& fill_textures = underground ? texture_ug_fill : texture_sl_fill;
+      auto& diffs = underground ? m_terrain_diffs_ug : m_terrain_diffs_sl;
+      diffs.clear();
+      auto num_frames = stlutils::sizeI(fill_textures);
+      if (num_frames < 2)
+        return;
+      diffs.resize(num_frames);
+      for (int room_id = 0; room_id < stlutils::sizeI(m_room_styles); ++room_id)
+      {
+        const auto& room_style = m_room_styles[room_id];
+        if (room_style.is_underground != underground)
+          continue;
+        for_each_room_cell(m_bsp_tree->fetch_room(room_id), [&](int idx, const RC& local_pos)
+        {
+          for (int k = 0; k < num_frames; ++k)
+          {
+            auto t0 = calc_terrain(room_style, local_pos, k);
+            auto t1 = calc_terrain(room_style, local_pos, (k + 1) % num_frames);
+            if (t0 != t1)
+              diffs[k].emplace_back(idx, t1);
+          }
+        });
+      }
+    }
+    
+    bool apply_terrain_diffs(const std::vector<std::vector<std::pair<int, Terrain>>>& diffs)
+    {
+      if (diffs.empty())
+        return true;
+      auto num_frames = diffs.size();
+      auto frame_prev = m_terrain_raster_anim_ctr % num_frames;
+      auto frame_curr = texture_anim_ctr % num_frames;
+      if (frame_curr == frame_prev)
+        return true;
+      if (frame_curr != (frame_prev + 1) % num_frames)
+        return false;
+      for (const auto& [idx, terrain] : diffs[frame_prev])
+        m_terrain_raster[idx] = terrain;
+      return true;
+    }
+    
+    void update_terrain_raster()
+    {
+      if (m_terrain_raster.empty() || m_terrain_raster_anim_ctr == texture_anim_ctr)
+        return;
+      // Counter wrap-around or a skipped frame: re-bake instead.
+      if (!apply_terrain_diffs(m_terrain_diffs_sl) || !apply_terrain_diffs(m_terrain_diffs_ug))
+        bake_terrain_raster();
+      m_terrain_raster_anim_ctr = texture_anim_ctr;
+    }
     
   public:
     Environment() = default;
@@ -51,13 +237,13 @@ namespace dung
     void load_textures(const std::string& exe_folder, DungGineTextureParams texture_params)
     {
       for (const auto& fn : texture_params.texture_file_names_surface_level_fill)
-        texture_sl_fill.emplace_back().load(folder::join_path({ exe_folder, fn }));
+        texture_io::load_texture(texture_sl_fill.emplace_back(), folder::join_path({ exe_folder, fn }));
       for (const auto& fn : texture_params.texture_file_names_surface_level_shadow)
-        texture_sl_shadow.emplace_back().load(folder::join_path({ exe_folder, fn }));
+        texture_io::load_texture(texture_sl_shadow.emplace_back(), folder::join_path({ exe_folder, fn }));
       for (const auto& fn : texture_params.texture_file_names_underground_fill)
-        texture_ug_fill.emplace_back().load(folder::join_path({ exe_folder, fn }));
+        texture_io::load_texture(texture_ug_fill.emplace_back(), folder::join_path({ exe_folder, fn }));
       for (const auto& fn : texture_params.texture_file_names_underground_shadow)
-        texture_ug_shadow.emplace_back().load(folder::join_path({ exe_folder, fn }));
+        texture_io::load_texture(texture_ug_shadow.emplace_back(), folder::join_path({ exe_folder, fn }));
         
       dt_texture_anim_s = texture_params.dt_anim_s;
     }
@@ -66,6 +252,8 @@ namespace dung
     {
       m_bsp_tree = bsp_tree;
       m_leaves = m_bsp_tree->fetch_leaves();
+      m_world_size = m_bsp_tree->get_world_size();
+      build_visibility_grids();
     }
     
     void style_dungeon(Latitude latitude_0, Longitude longitude_0)
@@ -87,9 +275,11 @@ namespace dung
         room_style.longitude = static_cast<Longitude>((long_offs + long_idx) % num_long);
       };
       
+      m_room_styles.clear();
+      m_room_styles.reserve(m_leaves.size());
       for (auto* leaf : m_leaves)
       {
-        RoomStyle room_style;
+        auto& room_style = m_room_styles.emplace_back();
         room_style.init_rand();
         
         const auto& fill_textures = room_style.is_underground ? texture_ug_fill : texture_sl_fill;
@@ -105,23 +295,187 @@ namespace dung
         }
         
         f_calc_lat_long(room_style, leaf->bb_leaf_room);
-        
-        m_room_styles[leaf] = room_style;
       }
       
+      // Every corridor connects a pair of rooms.
+      m_corridor_styles.assign(m_bsp_tree->get_num_corridors(), RoomStyle {});
       const auto& room_corridor_map = m_bsp_tree->get_room_corridor_map();
       for (const auto& cp : room_corridor_map)
       {
-        RoomStyle room_style;
+        auto& room_style = m_corridor_styles[m_bsp_tree->get_corridor_id(cp.second)];
         room_style.is_underground = is_underground(cp.first.first) || is_underground(cp.first.second);
         room_style.wall_type = WallType::Masonry4;
         room_style.wall_style = { Color::LightGray, Color::Black }; //wall_palette[WallBasicType::Masonry]
         room_style.floor_type = FloorType::Stone2;
         
         f_calc_lat_long(room_style, cp.second->bb);
-        
-        m_corridor_styles[cp.second] = room_style;
       }
+      
+      bake_terrain_raster();
+      bake_terrain_diffs(false);
+      bake_terrain_diffs(true);
+      
+      m_sun_phase_idx = -1;
+    }
+    
+    // The room and corridor styles and the terrain raster. Call after load_dungeon().
+    void write_snapshot(BinaryWriter& writer) const
+    {
+      auto f_write_style = [&writer](const RoomStyle& rs)
+      {
+        writer.write<int32_t>(static_cast<int32_t>(rs.wall_type));
+        writer.write<int32_t>(static_cast<int32_t>(rs.wall_style.fg_color));
+        writer.write<int32_t>(static_cast<int32_t>(rs.wall_style.bg_color));
+        writer.write<int32_t>(static_cast<int32_t>(rs.floor_type));
+        writer.write<bool>(rs.is_underground);
+        writer.write_rc(rs.tex_pos);
+        writer.write<int32_t>(static_cast<int32_t>(rs.latitude));
+        writer.write<int32_t>(static_cast<int32_t>(rs.longitude));
+      };
+      writer.write(static_cast<uint32_t>(m_room_styles.size()));
+      for (const auto& rs : m_room_styles)
+        f_write_style(rs);
+      writer.write(static_cast<uint32_t>(m_corridor_styles.size()));
+      for (const auto& cs : m_corridor_styles)
+        f_write_style(cs);
+      
+      // The raster is only valid for the same textures, so store what it was baked from.
+      writer.write<uint32_t>(texture_anim_ctr);
+      for (const auto* fill_textures : { &texture_sl_fill, &texture_ug_fill })
+      {
+        writer.write(static_cast<uint32_t>(fill_textures->size()));
+        writer.write_rc(fill_textures->empty() ? RC { 0, 0 } : fill_textures->front().size);
+      }
+      writer.write_vector(m_terrain_raster);
+    }
+    
+    // Instead of style_dungeon(). Call after load_dungeon().
+    bool read_snapshot(BinaryReader& reader)
+    {
+      auto f_fail = [this](const char* err_msg)
+      {
+        std::cerr << "ERROR in Environment::read_snapshot() : " << err_msg << std::endl;
+        m_room_styles.clear();
+        m_corridor_styles.clear();
+        m_terrain_raster.clear();
+        return false;
+      };
+      
+      auto f_read_styles = [&reader](std::vector<RoomStyle>& styles, int num_expected)
+      {
+        uint32_t num_styles = 0;
+        if (!reader.read_count(num_styles, 33) || static_cast<int>(num_styles) != num_expected)
+          return false;
+        styles.resize(num_styles);
+        for (auto& rs : styles)
+        {
+          int32_t wall_type = 0, wall_fg = 0, wall_bg = 0, floor_type = 0, latitude = 0, longitude = 0;
+          reader.read(wall_type);
+          reader.read(wall_fg);
+          reader.read(wall_bg);
+          reader.read(floor_type);
+          reader.read(rs.is_underground);
+          reader.read_rc(rs.tex_pos);
+          reader.read(latitude);
+          reader.read(longitude);
+          rs.wall_type = static_cast<WallType>(wall_type);
+          rs.wall_style = { static_cast<Color>(wall_fg), static_cast<Color>(wall_bg) };
+          rs.floor_type = static_cast<FloorType>(floor_type);
+          rs.latitude = static_cast<Latitude>(latitude);
+          rs.longitude = static_cast<Longitude>(longitude);
+        }
+        return reader.ok();
+      };
+      if (!f_read_styles(m_room_styles, stlutils::sizeI(m_leaves)))
+        return f_fail("Invalid room styles.");
+      if (!f_read_styles(m_corridor_styles, m_bsp_tree->get_num_corridors()))
+        return f_fail("Invalid corridor styles.");
+      
+      uint32_t anim_ctr = 0;
+      bool same_textures = reader.read(anim_ctr);
+      for (const auto* fill_textures : { &texture_sl_fill, &texture_ug_fill })
+      {
+        uint32_t num_textures = 0;
+        RC tex_size;
+        reader.read(num_textures);
+        reader.read_rc(tex_size);
+        same_textures = same_textures && num_textures == fill_textures->size()
+          && tex_size == (fill_textures->empty() ? RC { 0, 0 } : fill_textures->front().size);
+      }
+      if (!reader.read_vector(m_terrain_raster))
+        return f_fail("Truncated terrain.");
+      
+      if (same_textures && stlutils::sizeI(m_terrain_raster) == m_world_size.r * m_world_size.c)
+      {
+        texture_anim_ctr = static_cast<unsigned short>(anim_ctr);
+        m_terrain_raster_anim_ctr = texture_anim_ctr;
+      }
+      else
+        bake_terrain_raster();
+      bake_terrain_diffs(false);
+      bake_terrain_diffs(true);
+      
+      m_sun_phase_idx = -1;
+      return true;
+    }
+    
+    void update_sun_dirs(SolarMotionPatterns& solar_motion, SolarDirection sun_dir,
+                         float t_solar_period, Season season,
+                         bool use_per_room_lat_long_for_sun_dir)
+    {
+      auto phase_idx = SolarMotionPatterns::get_phase_idx(t_solar_period);
+      if (phase_idx == m_sun_phase_idx && season == m_sun_season
+          && sun_dir == m_global_sun_dir
+          && use_per_room_lat_long_for_sun_dir == m_use_per_room_sun_dir)
+        return;
+      m_sun_phase_idx = phase_idx;
+      m_sun_season = season;
+      m_global_sun_dir = sun_dir;
+      m_use_per_room_sun_dir = use_per_room_lat_long_for_sun_dir;
+      
+      auto f_calc_sun_dir = [&](const RoomStyle& rs)
+      {
+        if (use_per_room_lat_long_for_sun_dir)
+          return solar_motion.get_solar_direction(rs.latitude, rs.longitude, season, t_solar_period);
+        return sun_dir;
+      };
+      
+      m_room_sun_dirs.clear();
+      for (const auto& room_style : m_room_styles)
+        m_room_sun_dirs.emplace_back(f_calc_sun_dir(room_style));
+      
+      m_corridor_sun_dirs.clear();
+      for (const auto& corr_style : m_corridor_styles)
+        m_corridor_sun_dirs.emplace_back(f_calc_sun_dir(corr_style));
+    }
+    
+    // As of the last call to update_sun_dirs().
+    std::optional<SolarDirection> find_sun_dir(const BSPNode* room) const
+    {
+      auto room_id = m_bsp_tree->get_room_id(room);
+      if (0 <= room_id && room_id < stlutils::sizeI(m_room_sun_dirs))
+        return m_room_sun_dirs[room_id];
+      return std::nullopt;
+    }
+    
+    std::optional<SolarDirection> find_sun_dir(const Corridor* corr) const
+    {
+      auto corr_id = m_bsp_tree->get_corridor_id(corr);
+      if (0 <= corr_id && corr_id < stlutils::sizeI(m_corridor_sun_dirs))
+        return m_corridor_sun_dirs[corr_id];
+      return std::nullopt;
+    }
+    
+    // Uses the room if styled, otherwise the corridor.
+    // With per room sun directions, objects outside of both are never in the night.
+    bool is_night(const BSPNode* room, const Corridor* corr) const
+    {
+      auto sun_dir = find_sun_dir(room);
+      if (!sun_dir.has_value())
+        sun_dir = find_sun_dir(corr);
+      if (!sun_dir.has_value() && !m_use_per_room_sun_dir)
+        sun_dir = m_global_sun_dir;
+      return sun_dir == SolarDirection::Nadir;
     }
     
     RC get_world_size() const
@@ -129,58 +483,93 @@ namespace dung
       return m_bsp_tree->get_world_size();
     }
     
-    std::map<std::pair<BSPNode*, BSPNode*>, Corridor*> get_room_corridor_map() const
+    const std::map<std::pair<BSPNode*, BSPNode*>, Corridor*>& get_room_corridor_map() const
     {
       return m_bsp_tree->get_room_corridor_map();
     }
     
-    std::vector<Door*> fetch_doors() const
+    const std::vector<Door*>& fetch_doors() const
     {
       return m_bsp_tree->fetch_doors();
     }
     
+    const AdjacencyGraph& get_adjacency_graph() const
+    {
+      return m_bsp_tree->get_adjacency_graph();
+    }
+    
+    // Finds the rooms, corridors and doors overlapping screen_rect (world coordinates).
+    // Cost scales with the size of screen_rect rather than the size of the world.
+    const VisibleSet& update_visible_set(const ttl::Rectangle& screen_rect)
+    {
+      int stamp = m_visible_set_stamp++;
+      query_visible(m_room_grid, screen_rect, m_room_stamps, stamp,
+                    [this](int id) -> const ttl::Rectangle& { return m_bsp_tree->fetch_room(id)->bb_leaf_room; },
+                    m_visible_set.room_ids);
+      query_visible(m_corridor_grid, screen_rect, m_corridor_stamps, stamp,
+                    [this](int id) -> const ttl::Rectangle& { return m_bsp_tree->fetch_corridor(id)->bb; },
+                    m_visible_set.corridor_ids);
+      query_visible(m_door_grid, screen_rect, m_door_stamps, stamp,
+                    [this](int id) { const auto& pos = m_bsp_tree->fetch_door(id)->pos; return ttl::Rectangle { pos.r, pos.c, 1, 1 }; },
+                    m_visible_set.door_ids);
+      return m_visible_set;
+    }
+    
+    const VisibleSet& get_visible_set() const
+    {
+      return m_visible_set;
+    }
+    
+    Door* fetch_door(int door_id) const
+    {
+      return m_bsp_tree->fetch_door(door_id);
+    }
+    
     // #NOTE: Only for unwalled area!
     bool is_inside_any_room(const RC& pos, BSPNode** room_node = nullptr) const
     {
-      for (auto* leaf : m_leaves)
-        if (leaf->bb_leaf_room.is_inside_offs(pos, -1))
-        {
-          utils::try_set(room_node, leaf);
-          return true;
-        }
+      // The BSP regions are disjoint and each room lies within its region,
+      //   so the leaf found by descent is the only candidate.
+      auto* leaf = m_bsp_tree->find_leaf(pos);
+      if (leaf != nullptr && leaf->bb_leaf_room.is_inside_offs(pos, -1))
+      {
+        utils::try_set(room_node, leaf);
+        return true;
+      }
       return false;
     }
     
-    bool is_underground(BSPNode* room) const
+    // nullptr if the dungeon has not been styled yet.
+    const RoomStyle* find_room_style(const BSPNode* room) const
     {
-      auto it = m_room_styles.find(room);
-      if (it != m_room_styles.end())
-        return it->second.is_underground;
-      return false;
+      auto room_id = m_bsp_tree->get_room_id(room);
+      if (0 <= room_id && room_id < stlutils::sizeI(m_room_styles))
+        return &m_room_styles[room_id];
+      return nullptr;
     }
     
-    bool is_underground(Corridor* corr) const
+    const RoomStyle* find_corridor_style(const Corridor* corridor) const
     {
-      auto it = m_corridor_styles.find(corr);
-      if (it != m_corridor_styles.end())
-        return it->second.is_underground;
-      return false;
+      auto corr_id = m_bsp_tree->get_corridor_id(corridor);
+      if (0 <= corr_id && corr_id < stlutils::sizeI(m_corridor_styles))
+        return &m_corridor_styles[corr_id];
+      return nullptr;
     }
     
-    std::optional<RoomStyle> find_room_style(BSPNode* room) const
+    // By id. Only valid after style_dungeon().
+    const RoomStyle& get_room_style(int room_id) const { return m_room_styles[room_id]; }
+    const RoomStyle& get_corridor_style(int corr_id) const { return m_corridor_styles[corr_id]; }
+    
+    bool is_underground(const BSPNode* room) const
     {
-      auto itr = m_room_styles.find(room);
-      if (itr != m_room_styles.end())
-        return itr->second;
-      return std::nullopt;
+      const auto* room_style = find_room_style(room);
+      return room_style != nullptr && room_style->is_underground;
     }
     
-    std::optional<RoomStyle> find_corridor_style(Corridor* corridor) const
+    bool is_underground(const Corridor* corr) const
     {
-      auto itc = m_corridor_styles.find(corridor);
-      if (itc != m_corridor_styles.end())
-        return itc->second;
-      return std::nullopt;
+      const auto* corr_style = find_corridor_style(corr);
+      return corr_style != nullptr && corr_style->is_underground;
     }
     
     std::optional<const drawing::Texture*> fetch_texture(const auto& texture_vector) const
@@ -206,72 +595,11 @@ namespace dung
     
     Terrain get_terrain(const RC& pos) const
     {
-      BSPNode* room = nullptr;
-      if (!is_inside_any_room(pos, &room))
+      if (m_terrain_raster.empty()
+          || pos.r < 0 || pos.r >= m_world_size.r
+          || pos.c < 0 || pos.c >= m_world_size.c)
         return Terrain::Default;
-      const auto& bb = room->bb_leaf_room;
-      if (bb.is_inside_offs(pos, -1))
-      {
-        auto its = m_room_styles.find(room);
-        if (its == m_room_styles.end())
-          return Terrain::Default;
-        const auto& room_style = its->second;
-        auto local_pos = pos - bb.pos() - RC { 1, 1 };
-        auto tex_pos = room_style.tex_pos + local_pos;
-        auto texture = fetch_curr_fill_texture(room_style);
-        if (texture.has_value())
-        {
-          int curr_mat = (*texture.value())(tex_pos).mat;
-          // #FIXME: Canonize material idcs.
-          switch (curr_mat)
-          {
-            case 0: return Terrain::Void;
-            case 1: return Terrain::Tile;
-            case 2: return Terrain::Water;
-            case 3: return Terrain::Sand;
-            case 4: return Terrain::Stone;
-            case 5: return Terrain::Masonry;
-            case 6: return Terrain::Brick;
-            case 7: return Terrain::Grass;
-            case 8: return Terrain::Shrub;
-            case 9: return Terrain::Tree;
-            case 10: return Terrain::Metal;
-            case 11: return Terrain::Wood;
-            case 12: return Terrain::Ice;
-            case 13: return Terrain::Mountain;
-            case 14: return Terrain::Lava;
-            case 15: return Terrain::Cave;
-            case 16: return Terrain::Swamp;
-            case 17: return Terrain::Poison;
-            case 18: return Terrain::Path;
-            case 19: return Terrain::Mine;
-            case 20: return Terrain::Gold;
-            case 21: return Terrain::Silver;
-            case 22: return Terrain::Gravel;
-            case 23: return Terrain::Bone;
-            case 24: return Terrain::Acid;
-            case 25: return Terrain::Column;
-            case 26: return Terrain::Tar;
-            case 27: return Terrain::Rope;
-            default: return Terrain::Default;
-          }
-        }
-        else
-        {
-          switch (room_style.floor_type)
-          {
-            case FloorType::None: return Terrain::Default;
-            case FloorType::Sand: return Terrain::Sand;
-            case FloorType::Grass: return Terrain::Grass;
-            case FloorType::Stone: return Terrain::Stone;
-            case FloorType::Stone2: return Terrain::Stone;
-            case FloorType::Water: return Terrain::Water;
-            case FloorType::Wood: return Terrain::Wood;
-            default: return Terrain::Default;
-          }
-        }
-      }
-      return Terrain::Default;
+      return m_terrain_raster[pos.r * m_world_size.c + pos.c];
     }
     
     Terrain get_terrain(int r, int c) const
@@ -286,30 +614,46 @@ namespace dung
       return dung::allow_move_to(terrain);
     }
     
+    // Advances the texture animation (and with it the terrain) every dt_anim_s seconds.
+    void update_texture_animation(double real_time_s)
+    {
+      if (!texture_sl_fill.empty() || !texture_ug_fill.empty())
+      {
+        if (real_time_s - texture_anim_time_stamp > dt_texture_anim_s)
+        {
+          texture_anim_ctr++;
+          texture_anim_time_stamp = real_time_s;
+          update_terrain_raster();
+        }
+      }
+    }
+    
     template<int NR, int NC>
-    void draw_environment(ScreenHandler<NR, NC>& sh, double real_time_s,
+    void draw_environment(ScreenHandler<NR, NC>& sh,
                           bool use_fog_of_war,
-                          SolarDirection sun_dir, SolarMotionPatterns& solar_motion,
-                          float t_solar_period, Season season,
-                          bool use_per_room_lat_long_for_sun_dir,
+                          SolarDirection sun_dir,
                           ScreenHelper* screen_helper,
                           bool debug)
     {
-      auto shadow_type = sun_dir;
-      for (const auto& room_pair : m_room_styles)
+      // Only the rooms and corridors found by the last call to update_visible_set().
+      // Shadows use the solar directions found by the last call to update_sun_dirs().
+      for (int room_id : m_visible_set.room_ids)
       {
-        auto* room = room_pair.first;
+        if (room_id >= stlutils::sizeI(m_room_styles))
+          continue;
+        auto* room = m_bsp_tree->fetch_room(room_id);
         const auto& bb = room->bb_leaf_room;
-        const auto& room_style = room_pair.second;
+        const auto& room_style = m_room_styles[room_id];
         auto bb_scr_pos = screen_helper->get_screen_pos(bb.pos());
-        if (use_per_room_lat_long_for_sun_dir)
-          shadow_type = solar_motion.get_solar_direction(room_style.latitude, room_style.longitude, season, t_solar_period);
+        auto shadow_type = find_sun_dir(room).value_or(sun_dir);
         
         if (debug)
         {
           sh.write_buffer(std::to_string(room_style.is_underground), bb_scr_pos.r + 1, bb_scr_pos.c + 1, Color::White, Color::Black);
         }
         
+        room->light.copy_to(m_light_cells);
+        
         // Fog of war
         if (use_fog_of_war)
         {
@@ -317,7 +661,7 @@ namespace dung
           {
             for (int c = 0; c < bb.c_len; ++c)
             {
-              if (room->fog_of_war[r * bb.c_len + c])
+              if (room->fog_of_war.get(bb.r + r, bb.c + c))
                 sh.write_buffer(".", bb_scr_pos.r + r, bb_scr_pos.c + c, Color::Black, Color::Black);
             }
           }
@@ -327,7 +671,7 @@ namespace dung
                                   bb_scr_pos.r, bb_scr_pos.c, bb.r_len, bb.c_len,
                                   room_style.wall_type,
                                   room_style.wall_style,
-                                  room->light);
+                                  m_light_cells);
                                   
         if (room_style.is_underground ? texture_ug_fill.empty() : texture_sl_fill.empty())
         {
@@ -338,16 +682,10 @@ namespace dung
                             room_style.is_underground ? SolarDirection::Nadir : shadow_type,
                             styles::shade_style(room_style.get_fill_style(), color::ShadeType::Dark),
                             room_style.get_fill_char(),
-                            room->light);
+                            m_light_cells);
         }
         else
         {
-          if (real_time_s - texture_anim_time_stamp > dt_texture_anim_s)
-          {
-            texture_anim_ctr++;
-            texture_anim_time_stamp = real_time_s;
-          }
-          
           const auto& texture_fill = *(fetch_curr_fill_texture(room_style).value_or(&texture_empty));
           const auto& texture_shadow = *(fetch_curr_shadow_texture(room_style).value_or(&texture_empty));
         
@@ -356,49 +694,68 @@ namespace dung
                                      room_style.is_underground ? SolarDirection::Nadir : shadow_type,
                                      texture_fill,
                                      texture_shadow,
-                                     room->light,
+                                     m_light_cells,
                                      room_style.is_underground,
                                      room_style.tex_pos);
         }
       }
       
-      shadow_type = sun_dir;
-      for (const auto& corr_pair : m_corridor_styles)
+      for (int corr_id : m_visible_set.corridor_ids)
       {
-        auto* corr = corr_pair.first;
-        const auto& bb = corr->bb;
-        const auto& corr_style = corr_pair.second;
-        auto bb_scr_pos = screen_helper->get_screen_pos(bb.pos());
-        if (use_per_room_lat_long_for_sun_dir)
-          shadow_type = solar_motion.get_solar_direction(corr_style.latitude, corr_style.longitude, season, t_solar_period);
+        if (corr_id >= stlutils::sizeI(m_corridor_styles))
+          continue;
+        auto* corr = m_bsp_tree->fetch_corridor(corr_id);
+        const auto& corr_style = m_corridor_styles[corr_id];
+        auto shadow_type = find_sun_dir(corr).value_or(sun_dir);
         
         // Fog of war
         if (use_fog_of_war)
         {
-          for (int r = 0; r < bb.r_len; ++r)
+          for (const auto& bb : corr->get_legs())
           {
-            for (int c = 0; c < bb.c_len; ++c)
+            auto bb_scr_pos = screen_helper->get_screen_pos(bb.pos());
+            for (int r = 0; r < bb.r_len; ++r)
             {
-              if (corr->fog_of_war[r * bb.c_len + c])
-                sh.write_buffer(".", bb_scr_pos.r + r, bb_scr_pos.c + c, Color::Black, Color::Black);
+              for (int c = 0; c < bb.c_len; ++c)
+              {
+                if (corr->fog_of_war.get(bb.r + r, bb.c + c))
+                  sh.write_buffer(".", bb_scr_pos.r + r, bb_scr_pos.c + c, Color::Black, Color::Black);
+              }
             }
           }
         }
         
+        auto f_draw_fill = [&](const ttl::Rectangle& bb)
+        {
+          auto bb_scr_pos = screen_helper->get_screen_pos(bb.pos());
+          corr->light.sub_view(bb).copy_to(m_light_cells);
+          drawing::draw_box(sh,
+                            bb_scr_pos.r, bb_scr_pos.c, bb.r_len, bb.c_len,
+                            corr_style.get_fill_style(),
+                            corr_style.get_fill_char(),
+                            corr_style.is_underground ? SolarDirection::Nadir : shadow_type,
+                            styles::shade_style(corr_style.get_fill_style(), color::ShadeType::Dark, true),
+                            corr_style.get_fill_char(),
+                            m_light_cells);
+        };
         
-        drawing::draw_box_outline(sh,
-                                  bb_scr_pos.r, bb_scr_pos.c, bb.r_len, bb.c_len,
-                                  corr_style.wall_type,
-                                  corr_style.wall_style,
-                                  corr->light);
-        drawing::draw_box(sh,
-                          bb_scr_pos.r, bb_scr_pos.c, bb.r_len, bb.c_len,
-                          corr_style.get_fill_style(),
-                          corr_style.get_fill_char(),
-                          corr_style.is_underground ? SolarDirection::Nadir : shadow_type,
-                          styles::shade_style(corr_style.get_fill_style(), color::ShadeType::Dark, true),
-                          corr_style.get_fill_char(),
-                          corr->light);
+        // The first drawn character of a cell stays. For bent corridors, the insides
+        //   go first so that the walls of one leg don't cut across the other leg.
+        if (corr->is_bent())
+          for (const auto& bb : corr->get_legs())
+            f_draw_fill(bb);
+        for (const auto& bb : corr->get_legs())
+        {
+          auto bb_scr_pos = screen_helper->get_screen_pos(bb.pos());
+          corr->light.sub_view(bb).copy_to(m_light_cells);
+          drawing::draw_box_outline(sh,
+                                    bb_scr_pos.r, bb_scr_pos.c, bb.r_len, bb.c_len,
+                                    corr_style.wall_type,
+                                    corr_style.wall_style,
+                                    m_light_cells);
+          if (!corr->is_bent())
+            f_draw_fill(bb);
+        }
       }
     }
   };
@@ -0,0 +1,150 @@
+//
+//  FieldStencil.h
+//  DungGine
+//
+
+#pragma once
+#include "BitPlane.h"
+#include <Termin8or/RC.h>
+#include <Termin8or/Drawing.h>
+#include <Core/bool_vector.h>
+#include <Core/Math.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+
+namespace dung
+{
+
+  // The cells covered by a light source or by the FOW radius,
+  //   stored as row spans relative to the position of the source.
+  struct FieldStencil
+  {
+    struct RowSpan
+    {
+      int r = 0;
+      int c0 = 0;
+      int c1 = 0; // Inclusive.
+    };
+    std::vector<RowSpan> spans;
+
+    void build(std::vector<RC> offsets)
+    {
+      spans.clear();
+      std::sort(offsets.begin(), offsets.end(), [](const RC& a, const RC& b)
+      {
+        return a.r < b.r || (a.r == b.r && a.c < b.c);
+      });
+      for (const auto& offs : offsets)
+      {
+        if (!spans.empty() && spans.back().r == offs.r && offs.c <= spans.back().c1 + 1)
+          spans.back().c1 = std::max(spans.back().c1, offs.c);
+        else
+          spans.push_back({ offs.r, offs.c, offs.c });
+      }
+    }
+
+    // field : Row-major field of size size, e.g. the light of a room.
+    // local_pos : Position of the source relative to the top-left corner of the field.
+    void apply(bool_vector& field, const RC& size, const RC& local_pos, bool set_val) const
+    {
+      const int num_cells = static_cast<int>(field.size());
+      for (const auto& span : spans)
+      {
+        int r = local_pos.r + span.r;
+        if (r < 0 || r >= size.r || (r + 1) * size.c > num_cells)
+          continue;
+        int c0 = std::max(local_pos.c + span.c0, 0);
+        int c1 = std::min(local_pos.c + span.c1, size.c - 1);
+        int row_offs = r * size.c;
+        for (int c = c0; c <= c1; ++c)
+          field[row_offs + c] = set_val;
+      }
+    }
+
+    // Word-wide, one span at a time. local_pos is relative to the top-left corner of the view.
+    void apply(BitPlaneView& view, const RC& local_pos, bool set_val) const
+    {
+      for (const auto& span : spans)
+        view.fill_span(local_pos.r + span.r, local_pos.c + span.c0, local_pos.c + span.c1, set_val);
+    }
+  };
+
+  // Stencils keyed by quantized radius, arc angle, look direction and pixel aspect ratio.
+  // Stencils are generated by the Termin8or drawing functions on first use
+  //   and then reused for every source with the same parameters.
+  class FieldStencilCache final
+  {
+    static constexpr size_t c_max_num_stencils = 4096;
+    static constexpr int c_num_dir_bins = 256;
+    static constexpr uint64_t c_isotropic_dir = 0xFFFF;
+
+    std::unordered_map<uint64_t, FieldStencil> m_stencils;
+
+    static uint64_t quantize(float val, float scale)
+    {
+      return static_cast<uint64_t>(math::clamp(math::roundI(val * scale), 0, 0xFFFF));
+    }
+
+    static float dequantize(uint64_t q, float scale)
+    {
+      return static_cast<float>(q) / scale;
+    }
+
+    static uint64_t make_key(uint64_t radius_q, uint64_t angle_q, uint64_t dir_q, uint64_t aspect_q)
+    {
+      return (radius_q << 48) | (angle_q << 32) | (dir_q << 16) | aspect_q;
+    }
+
+    template<typename BuildFunc>
+    const FieldStencil& fetch(uint64_t key, BuildFunc&& build_offsets)
+    {
+      auto it = m_stencils.find(key);
+      if (it != m_stencils.end())
+        return it->second;
+      // Shrinking lamps produce a steady trickle of new radii, so keep the cache bounded.
+      if (m_stencils.size() >= c_max_num_stencils)
+        m_stencils.clear();
+      auto& stencil = m_stencils[key];
+      stencil.build(build_offsets());
+      return stencil;
+    }
+
+  public:
+    // Radius is quantized to 1/8 cell and pixel aspect ratio to 1/256.
+    const FieldStencil& get_circle(float radius, float px_aspect)
+    {
+      auto radius_q = quantize(radius, 8.f);
+      auto aspect_q = quantize(px_aspect, 256.f);
+      return fetch(make_key(radius_q, 0, c_isotropic_dir, aspect_q), [&]()
+      {
+        return drawing::filled_circle_positions({ 0, 0 },
+          dequantize(radius_q, 8.f), dequantize(aspect_q, 256.f));
+      });
+    }
+
+    // Arc angle is quantized to 0.5 deg and look direction to 1/256 of a turn.
+    const FieldStencil& get_arc(float radius, float angle_deg, float dir_r, float dir_c, float px_aspect)
+    {
+      auto radius_q = quantize(radius, 8.f);
+      auto angle_q = quantize(angle_deg, 2.f);
+      auto aspect_q = quantize(px_aspect, 256.f);
+      float dir_ang = std::atan2(dir_r, dir_c);
+      if (dir_ang < 0.f)
+        dir_ang += math::c_2pi;
+      auto dir_q = static_cast<uint64_t>(math::roundI(dir_ang / math::c_2pi * c_num_dir_bins) % c_num_dir_bins);
+      return fetch(make_key(radius_q, angle_q, dir_q, aspect_q), [&]()
+      {
+        float dir_q_ang = static_cast<float>(dir_q) / c_num_dir_bins * math::c_2pi;
+        return drawing::filled_arc_positions({ 0, 0 },
+          dequantize(radius_q, 8.f), math::deg2rad(dequantize(angle_q, 2.f)),
+          std::sin(dir_q_ang), std::cos(dir_q_ang), dequantize(aspect_q, 256.f));
+      });
+    }
+
+    void clear() { m_stencils.clear(); }
+  };
+
+}
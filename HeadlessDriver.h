@@ -0,0 +1,105 @@
+//
+//  HeadlessDriver.h
+//  DungGine
+//
+
+#pragma once
+#include "DungGine.h"
+#include <Termin8or/Keyboard.h>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+
+namespace dung
+{
+
+  struct HeadlessRunStats
+  {
+    int num_ticks = 0;
+    bool game_over = false;
+    double total_ms = 0.;
+    double min_tick_ms = 0.;
+    double max_tick_ms = 0.;
+    double mean_tick_ms = 0.;
+    // Wall clock time of each tick.
+    std::vector<double> tick_ms;
+
+    double ticks_per_second() const
+    {
+      return total_ms > 0. ? 1e3 * num_ticks / total_ms : 0.;
+    }
+  };
+
+  // Drives DungGine::update() without a terminal, GameEngine or ScreenHandler.
+  // Time advances by a fixed step per tick (not by the wall clock) so runs are reproducible.
+  // Nothing is drawn, so only the simulation is exercised and timed.
+  class HeadlessDriver final
+  {
+    DungGine& m_engine;
+    float m_fps = 30.f;
+    float m_sim_dt_s = 1.f/30.f;
+    float m_fire_smoke_dt_factor = 0.5f;
+
+    int m_frame_ctr = 0;
+    double m_real_time_s = 0.;
+    float m_sim_time_s = 0.f;
+
+  public:
+    // Returns the input for a given tick. An empty KeyPressDataPair means no key pressed.
+    using InputScript = std::function<keyboard::KeyPressDataPair(int tick)>;
+
+    HeadlessDriver(DungGine& engine, float fps = 30.f, float fire_smoke_dt_factor = 0.5f)
+      : m_engine(engine)
+      , m_fps(fps)
+      , m_sim_dt_s(1.f / fps)
+      , m_fire_smoke_dt_factor(fire_smoke_dt_factor)
+    {}
+
+    int get_frame_ctr() const { return m_frame_ctr; }
+    double get_time_s() const { return m_real_time_s; }
+
+    // Advances the world by num_ticks ticks, or until the PC dies if stop_on_game_over is set.
+    HeadlessRunStats run(int num_ticks, const InputScript& input_script = nullptr,
+                         bool stop_on_game_over = true)
+    {
+      HeadlessRunStats stats;
+      stats.tick_ms.reserve(std::max(num_ticks, 0));
+
+      using Clock = std::chrono::steady_clock;
+      for (int tick = 0; tick < num_ticks; ++tick)
+      {
+        auto kpdp = input_script ? input_script(tick) : keyboard::KeyPressDataPair {};
+
+        auto t0 = Clock::now();
+        m_engine.update(m_frame_ctr, m_fps,
+                        m_real_time_s, m_sim_time_s, m_sim_dt_s,
+                        m_fire_smoke_dt_factor,
+                        kpdp, &stats.game_over);
+        auto t1 = Clock::now();
+
+        stats.tick_ms.emplace_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        stats.num_ticks++;
+        m_frame_ctr++;
+        m_real_time_s += m_sim_dt_s;
+        m_sim_time_s += m_sim_dt_s;
+
+        if (stop_on_game_over && stats.game_over)
+          break;
+      }
+
+      if (!stats.tick_ms.empty())
+      {
+        const auto [it_min, it_max] = std::minmax_element(stats.tick_ms.begin(), stats.tick_ms.end());
+        stats.min_tick_ms = *it_min;
+        stats.max_tick_ms = *it_max;
+        for (auto ms : stats.tick_ms)
+          stats.total_ms += ms;
+        stats.mean_tick_ms = stats.total_ms / stats.tick_ms.size();
+      }
+      return stats;
+    }
+  };
+
+}
@@ -82,6 +82,19 @@ namespace dung
       return nullptr;
     }
     
+    // Makes the row of i the selected one. Returns false if i has no row.
+    bool select_item(Item* i)
+    {
+      auto it = stlutils::find_if(m_items, [i](const auto& ii) { return ii.item == i; });
+      if (it == m_items.end())
+        return false;
+      for (auto& ii : m_items)
+        ii.selected = false;
+      it->selected = true;
+      selection_idx = static_cast<int>(it - m_items.begin());
+      return true;
+    }
+    
     InvItem* get_selected_item()
     {
       auto it = stlutils::find_if(m_items, [](const auto& ii) { return ii.selected; });
@@ -279,20 +292,47 @@ namespace dung
     int cb0_items = 2; // col box-relative-pos start items.
     int hilite_idx = 0;
     
+    // Bumped whenever the set of selected items may have changed.
+    unsigned int m_selection_version = 1;
+    
   public:
     void set_bounding_box(const ttl::Rectangle& bb) { m_bb = bb; }
     
     void add_group(const InvGroup& group)
     {
       m_groups.emplace_back(group);
+      m_selection_version++;
     }
     
+    // Use this rather than InvSubGroup::remove_item() so that the selection version is updated.
     void remove_item(Item* item)
     {
       for (auto& g : m_groups)
         g.remove_item(item);
+      m_selection_version++;
     }
     
+    // Use this rather than InvSubGroup::select_item() so that the selection version is updated.
+    void select_item(Item* item)
+    {
+      for (auto& g : m_groups)
+        for (auto& sg : g)
+          sg.select_item(item);
+      m_selection_version++;
+    }
+    
+    bool is_selected(const Item* item) const
+    {
+      for (const auto& g : m_groups)
+        for (const auto& sg : g)
+          for (const auto& ii : sg)
+            if (ii.item == item)
+              return ii.selected;
+      return false;
+    }
+    
+    unsigned int get_selection_version() const { return m_selection_version; }
+    
     InvGroup* fetch_group(const std::string& group_title)
     {
       auto it = stlutils::find_if(m_groups,
@@ -317,6 +357,7 @@ namespace dung
     void clear()
     {
       m_groups.clear();
+      m_selection_version++;
     }
     
     InvItem get_item(int idx) const
@@ -342,6 +383,8 @@ namespace dung
           g.toggle_state(rel_idx, state);
         cum_idx += g.size();
       }
+      if (state == InvItemState::SWITCH_SELECTION)
+        m_selection_version++;
     }
     
     void inc_hilite()
@@ -8,6 +8,7 @@
 #pragma once
 #include "Globals.h"
 #include "DungObject.h"
+#include <memory>
 
 namespace dung
 {
@@ -219,7 +220,8 @@ namespace dung
     ARMOUR_PlatedBodyArmour,
     ARMOUR_PaddedCoif,
     ARMOUR_ChainMailleCoif,
-    ARMOUR_Helmet
+    ARMOUR_Helmet,
+    NUM_ARMOUR_TYPES
   };
   
   struct Armour : Item
@@ -314,4 +316,37 @@ namespace dung
       weight = protection * 0.087f * (1.f + 0.4f*(rnd::rand() - 0.6f));
     }
   };
+  
+  // By Weapon::type. nullptr if the type is unknown.
+  std::unique_ptr<Weapon> make_weapon(const std::string& type)
+  {
+    if (type == "sword")
+      return std::make_unique<Sword>();
+    if (type == "dagger")
+      return std::make_unique<Dagger>();
+    if (type == "flail")
+      return std::make_unique<Flail>();
+    return nullptr;
+  }
+  
+  // By Armour::type. nullptr if the type is unknown.
+  std::unique_ptr<Armour> make_armour(const std::string& type)
+  {
+    if (type == "shield")
+      return std::make_unique<Shield>();
+    if (type == "gambeson")
+      return std::make_unique<Gambeson>();
+    if (type == "chain maille hauberk")
+      return std::make_unique<ChainMailleHauberk>();
+    if (type == "plated body armour")
+      return std::make_unique<PlatedBodyArmour>();
+    if (type == "padded coif")
+      return std::make_unique<PaddedCoif>();
+    if (type == "chain maille coif")
+      return std::make_unique<ChainMailleCoif>();
+    if (type == "helmet")
+      return std::make_unique<Helmet>();
+    return nullptr;
+  }
+  
 }
@@ -8,6 +8,8 @@
 #pragma once
 #include "Environment.h"
 #include "Inventory.h"
+#include "SlotMap.h"
+#include "ObjectIndex.h"
 #include "PC.h"
 #include "Items.h"
 #include <Termin8or/MessageHandler.h>
@@ -24,18 +26,20 @@ namespace dung
     
     PC& m_player;
     
-    std::vector<Key>& m_all_keys;
+    SlotMap<Key>& m_all_keys;
     // Lamps illuminate items and NPCs. If you've already discovered an item or
     //   NPC using a lamp (and after FOW been cleared),
     //   then they will still be visible when the room is not lit.
     // Lamps will not work in surface level rooms.
-    std::vector<Lamp>& m_all_lamps;
-    std::vector<std::unique_ptr<Weapon>>& m_all_weapons;
-    std::vector<Potion>& m_all_potions;
-    std::vector<std::unique_ptr<Armour>>& m_all_armour;
+    SlotMap<Lamp>& m_all_lamps;
+    SlotMap<std::unique_ptr<Weapon>>& m_all_weapons;
+    SlotMap<Potion>& m_all_potions;
+    SlotMap<std::unique_ptr<Armour>>& m_all_armour;
     
     std::vector<NPC>& m_all_npcs;
     
+    ObjectIndex& m_object_index;
+    
     ui::TextBoxDebug& m_tbd;
     
     bool& m_debug;
@@ -43,12 +47,13 @@ namespace dung
   public:
     Keyboard(Environment* environment, Inventory* inventory, MessageHandler* msg_handler,
              PC& pc,
-             std::vector<Key>& all_keys,
-             std::vector<Lamp>& all_lamps,
-             std::vector<std::unique_ptr<Weapon>>& all_weapons,
-             std::vector<Potion>& all_potions,
-             std::vector<std::unique_ptr<Armour>>& all_armour,
+             SlotMap<Key>& all_keys,
+             SlotMap<Lamp>& all_lamps,
+             SlotMap<std::unique_ptr<Weapon>>& all_weapons,
+             SlotMap<Potion>& all_potions,
+             SlotMap<std::unique_ptr<Armour>>& all_armour,
              std::vector<NPC>& all_npcs,
+             ObjectIndex& object_index,
              ui::TextBoxDebug& tbd, bool& debug)
       : m_environment(environment)
       , m_inventory(inventory)
@@ -60,6 +65,7 @@ namespace dung
       , m_all_potions(all_potions)
       , m_all_armour(all_armour)
       , m_all_npcs(all_npcs)
+      , m_object_index(object_index)
       , m_tbd(tbd)
       , m_debug(debug)
     {}
@@ -127,14 +133,17 @@ namespace dung
               auto* key = dynamic_cast<Key*>(selected_inv_item->item);
               if (key != nullptr)
               {
-                auto idx = stlutils::find_if_idx(m_all_keys, [key](const auto& o) { return &o == key; });
+                auto handle = find_handle_if(m_player.key_handles, m_all_keys, [key](const auto& o) { return &o == key; });
                 msg += "key:" + std::to_string(key->key_id) + "!";
                 f_drop_item(key);
-                stlutils::erase(m_player.key_idcs, idx);
-                keys_subgroup->remove_item(key);
+                stlutils::erase_if(m_player.key_handles, [handle](const auto& h) { return h == handle; });
+                m_inventory->remove_item(key);
+                m_player.on_item_removed(key);
                 to_drop_found = true;
                 if (dropped_over_liquid)
-                  stlutils::erase_if(m_all_keys, [key](const auto& o) { return &o == key; });
+                  m_all_keys.erase(handle);
+                else
+                  m_object_index.add_item(key, handle);
               }
             }
           }
@@ -148,14 +157,17 @@ namespace dung
               auto* lamp = dynamic_cast<Lamp*>(selected_inv_item->item);
               if (lamp != nullptr)
               {
-                auto idx = stlutils::find_if_idx(m_all_lamps, [lamp](const auto& o) { return &o == lamp; });
-                msg += "lamp:" + std::to_string(idx) + "!";
+                auto handle = find_handle_if(m_player.lamp_handles, m_all_lamps, [lamp](const auto& o) { return &o == lamp; });
+                msg += "lamp:" + std::to_string(handle.idx) + "!";
                 f_drop_item(lamp);
-                stlutils::erase(m_player.lamp_idcs, idx);
-                lamps_subgroup->remove_item(lamp);
+                stlutils::erase_if(m_player.lamp_handles, [handle](const auto& h) { return h == handle; });
+                m_inventory->remove_item(lamp);
+                m_player.on_item_removed(lamp);
                 to_drop_found = true;
                 if (dropped_over_liquid)
-                  stlutils::erase_if(m_all_lamps, [lamp](const auto& o) { return &o == lamp; });
+                  m_all_lamps.erase(handle);
+                else
+                  m_object_index.add_item(lamp, handle);
               }
             }
           }
@@ -169,15 +181,18 @@ namespace dung
               auto* weapon = dynamic_cast<Weapon*>(selected_inv_item->item);
               if (weapon != nullptr)
               {
-                auto idx = stlutils::find_if_idx(m_all_weapons,
+                auto handle = find_handle_if(m_player.weapon_handles, m_all_weapons,
                   [weapon](const auto& o) { return o.get() == weapon; });
-                msg += weapon->type +":" + std::to_string(idx) + "!";
+                msg += weapon->type +":" + std::to_string(handle.idx) + "!";
                 f_drop_item(weapon);
-                stlutils::erase(m_player.weapon_idcs, idx);
-                weapons_subgroup_melee->remove_item(weapon);
+                stlutils::erase_if(m_player.weapon_handles, [handle](const auto& h) { return h == handle; });
+                m_inventory->remove_item(weapon);
+                m_player.on_item_removed(weapon);
                 to_drop_found = true;
                 if (dropped_over_liquid)
-                  stlutils::erase_if(m_all_weapons, [weapon](const auto& o) { return o.get() == weapon; });
+                  m_all_weapons.erase(handle);
+                else
+                  m_object_index.add_item(weapon, handle);
               }
             }
           }
@@ -191,22 +206,25 @@ namespace dung
               auto* potion = dynamic_cast<Potion*>(selected_inv_item->item);
               if (potion != nullptr)
               {
-                auto idx = stlutils::find_if_idx(m_all_potions,
+                auto handle = find_handle_if(m_player.potion_handles, m_all_potions,
                   [potion](const auto& o) { return &o == potion; });
-                msg += "potion:" + std::to_string(idx) + "!";
+                msg += "potion:" + std::to_string(handle.idx) + "!";
                 f_drop_item(potion);
-                stlutils::erase(m_player.potion_idcs, idx);
-                potions_subgroup->remove_item(potion);
+                stlutils::erase_if(m_player.potion_handles, [handle](const auto& h) { return h == handle; });
+                m_inventory->remove_item(potion);
+                m_player.on_item_removed(potion);
                 to_drop_found = true;
                 if (dropped_over_liquid)
-                  stlutils::erase_if(m_all_potions, [potion](const auto& o) { return &o == potion; });
+                  m_all_potions.erase(handle);
+                else
+                  m_object_index.add_item(potion, handle);
               }
             }
           }
           if (!to_drop_found)
           {
-            auto f_try_drop_armour = [&msg, &f_drop_item, &to_drop_found, dropped_over_liquid]
-                                    (auto* subgroup, auto& all_armour, auto& pc_armour_idcs)
+            auto f_try_drop_armour = [this, &msg, &f_drop_item, &to_drop_found, dropped_over_liquid]
+                                    (auto* subgroup, auto& all_armour, auto& pc_armour_handles)
             {
               if (to_drop_found)
                 return false;
@@ -216,14 +234,17 @@ namespace dung
                 auto* armour = dynamic_cast<Armour*>(selected_inv_item->item);
                 if (armour != nullptr)
                 {
-                  auto idx = stlutils::find_if_idx(all_armour, [armour](const auto& o) { return o.get() == armour; });
-                  msg += armour->type +":" + std::to_string(idx) + "!";
+                  auto handle = find_handle_if(pc_armour_handles, all_armour, [armour](const auto& o) { return o.get() == armour; });
+                  msg += armour->type +":" + std::to_string(handle.idx) + "!";
                   f_drop_item(armour);
-                  stlutils::erase(pc_armour_idcs, idx);
-                  subgroup->remove_item(armour);
+                  stlutils::erase_if(pc_armour_handles, [handle](const auto& h) { return h == handle; });
+                  m_inventory->remove_item(armour);
+                  m_player.on_item_removed(armour);
                   to_drop_found = true;
                   if (dropped_over_liquid)
-                    stlutils::erase_if(all_armour, [armour](const auto& o) { return o.get() == armour; });
+                    all_armour.erase(handle);
+                  else
+                    m_object_index.add_item(armour, handle);
                   return true;
                 }
               }
@@ -232,19 +253,19 @@ namespace dung
             
             auto* armour_group = m_inventory->fetch_group("Armour:");
             if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_Shield),
-                                   m_all_armour, m_player.armour_idcs))
+                                   m_all_armour, m_player.armour_handles))
               if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_Gambeson),
-                                     m_all_armour, m_player.armour_idcs))
+                                     m_all_armour, m_player.armour_handles))
                 if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_ChainMailleHauberk),
-                                       m_all_armour, m_player.armour_idcs))
+                                       m_all_armour, m_player.armour_handles))
                   if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_PlatedBodyArmour),
-                                         m_all_armour, m_player.armour_idcs))
+                                         m_all_armour, m_player.armour_handles))
                     if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_PaddedCoif),
-                                           m_all_armour, m_player.armour_idcs))
+                                           m_all_armour, m_player.armour_handles))
                       if (!f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_ChainMailleCoif),
-                                             m_all_armour, m_player.armour_idcs))
+                                             m_all_armour, m_player.armour_handles))
                         f_try_drop_armour(armour_group->fetch_subgroup(ARMOUR_Helmet),
-                                          m_all_armour, m_player.armour_idcs);
+                                          m_all_armour, m_player.armour_handles);
           }
           if (!to_drop_found)
           {
@@ -369,98 +390,56 @@ namespace dung
           
           std::string too_heavy_msg_template = " is too heavy to carry.\nYou need to drop items from your inventory!";
           
-          for (size_t key_idx = 0; key_idx < m_all_keys.size(); ++key_idx)
+          // Copy, since picking up an item removes it from the cell.
+          auto cell_items = m_object_index.fetch_items_at(curr_pos);
+          for (const auto& ci : cell_items)
           {
-            auto& key = m_all_keys[key_idx];
-            if (key.pos == curr_pos && !key.picked_up)
+            auto* item = ci.item;
+            if (item->picked_up)
+              continue;
+            std::string item_name;
+            std::vector<SlotHandle>* pc_handles = nullptr;
+            if (auto* key = dynamic_cast<Key*>(item); key != nullptr)
             {
-              if (m_player.has_weight_capacity(key.weight))
-              {
-                m_player.key_idcs.emplace_back(static_cast<int>(key_idx));
-                key.picked_up = true;
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "You picked up a key!", MessageHandler::Level::Guide);
-              }
-              else
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "Key" + too_heavy_msg_template,
-                                             MessageHandler::Level::Warning);
+              item_name = "key";
+              pc_handles = &m_player.key_handles;
             }
-          }
-          for (size_t lamp_idx = 0; lamp_idx < m_all_lamps.size(); ++lamp_idx)
-          {
-            auto& lamp = m_all_lamps[lamp_idx];
-            if (lamp.pos == curr_pos && !lamp.picked_up)
+            else if (auto* lamp = dynamic_cast<Lamp*>(item); lamp != nullptr)
             {
-              auto lamp_type = lamp.get_type_str();
-              if (m_player.has_weight_capacity(lamp.weight))
-              {
-                m_player.lamp_idcs.emplace_back(static_cast<int>(lamp_idx));
-                lamp.picked_up = true;
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "You picked up " + str::indef_art(lamp_type) + "!",
-                                             MessageHandler::Level::Guide);
-              }
-              else
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             str::anfangify(lamp_type) + too_heavy_msg_template,
-                                             MessageHandler::Level::Warning);
+              item_name = lamp->get_type_str();
+              pc_handles = &m_player.lamp_handles;
             }
-          }
-          for (size_t wpn_idx = 0; wpn_idx < m_all_weapons.size(); ++wpn_idx)
-          {
-            auto& weapon = m_all_weapons[wpn_idx];
-            if (weapon->pos == curr_pos && !weapon->picked_up)
+            else if (auto* weapon = dynamic_cast<Weapon*>(item); weapon != nullptr)
             {
-              if (m_player.has_weight_capacity(weapon->weight))
-              {
-                m_player.weapon_idcs.emplace_back(static_cast<int>(wpn_idx));
-                weapon->picked_up = true;
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "You picked up " + str::indef_art(weapon->type) + "!", MessageHandler::Level::Guide);
-              }
-              else
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             str::anfangify(weapon->type) + too_heavy_msg_template,
-                                             MessageHandler::Level::Warning);
+              item_name = weapon->type;
+              pc_handles = &m_player.weapon_handles;
             }
-          }
-          for (size_t pot_idx = 0; pot_idx < m_all_potions.size(); ++pot_idx)
-          {
-            auto& potion = m_all_potions[pot_idx];
-            if (potion.pos == curr_pos && !potion.picked_up)
+            else if (auto* potion = dynamic_cast<Potion*>(item); potion != nullptr)
             {
-              if (m_player.has_weight_capacity(potion.weight))
-              {
-                m_player.potion_idcs.emplace_back(static_cast<int>(pot_idx));
-                potion.picked_up = true;
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "You picked up a potion!", MessageHandler::Level::Guide);
-              }
-              else
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "Potion" + too_heavy_msg_template,
-                                             MessageHandler::Level::Warning);
+              item_name = "potion";
+              pc_handles = &m_player.potion_handles;
             }
-          }
-          for (size_t a_idx = 0; a_idx < m_all_armour.size(); ++a_idx)
-          {
-            auto& armour = m_all_armour[a_idx];
-            if (armour->pos == curr_pos && !armour->picked_up)
+            else if (auto* armour = dynamic_cast<Armour*>(item); armour != nullptr)
             {
-              if (m_player.has_weight_capacity(armour->weight))
-              {
-                m_player.armour_idcs.emplace_back(static_cast<int>(a_idx));
-                armour->picked_up = true;
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             "You picked up " + str::indef_art(armour->type) + "!",
-                                             MessageHandler::Level::Guide);
-              }
-              else
-                message_handler->add_message(static_cast<float>(real_time_s),
-                                             str::anfangify(armour->type) + too_heavy_msg_template,
-                                             MessageHandler::Level::Warning);
+              item_name = armour->type;
+              pc_handles = &m_player.armour_handles;
             }
+            else
+              continue;
+            
+            if (m_player.has_weight_capacity(item->weight))
+            {
+              m_object_index.remove_item(item);
+              pc_handles->emplace_back(ci.handle);
+              m_player.on_item_picked_up(item);
+              message_handler->add_message(static_cast<float>(real_time_s),
+                                           "You picked up " + str::indef_art(item_name) + "!",
+                                           MessageHandler::Level::Guide);
+            }
+            else
+              message_handler->add_message(static_cast<float>(real_time_s),
+                                           str::anfangify(item_name) + too_heavy_msg_template,
+                                           MessageHandler::Level::Warning);
           }
         }
       }
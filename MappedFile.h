@@ -0,0 +1,120 @@
+//
+//  MappedFile.h
+//  DungGine
+//
+
+#pragma once
+#include <string>
+#include <cstddef>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace dung
+{
+
+  // Read-only memory mapping of a whole file. The mapping is released on destruction.
+  class MappedFile final
+  {
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+
+  public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& file_path)
+    {
+      open(file_path);
+    }
+    ~MappedFile()
+    {
+      close();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& file_path)
+    {
+      close();
+#ifdef _WIN32
+      m_file = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+      LARGE_INTEGER file_size;
+      if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart == 0)
+      {
+        close();
+        return false;
+      }
+      m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (m_mapping == nullptr)
+      {
+        close();
+        return false;
+      }
+      m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+      if (m_data == nullptr)
+      {
+        close();
+        return false;
+      }
+      m_size = static_cast<size_t>(file_size.QuadPart);
+#else
+      int fd = ::open(file_path.c_str(), O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || st.st_size == 0)
+      {
+        ::close(fd);
+        return false;
+      }
+      void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      // The mapping stays valid after the descriptor is closed.
+      ::close(fd);
+      if (addr == MAP_FAILED)
+        return false;
+      m_data = static_cast<const unsigned char*>(addr);
+      m_size = static_cast<size_t>(st.st_size);
+#endif
+      return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+      if (m_data != nullptr)
+        UnmapViewOfFile(m_data);
+      if (m_mapping != nullptr)
+        CloseHandle(m_mapping);
+      if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+      m_mapping = nullptr;
+      m_file = INVALID_HANDLE_VALUE;
+#else
+      if (m_data != nullptr)
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+      m_data = nullptr;
+      m_size = 0;
+    }
+
+    bool is_open() const { return m_data != nullptr; }
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+  };
+
+}
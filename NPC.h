@@ -9,6 +9,7 @@
 #include "Items.h"
 #include "Globals.h"
 #include "PlayerBase.h"
+#include "SlotMap.h"
 #include <Core/OneShot.h>
 
 
@@ -95,7 +96,7 @@ namespace dung
     
     Race npc_race = Race::Ogre;
     Class npc_class = Class::Warrior_Barbarian;
-    int weapon_idx = -1;
+    SlotHandle weapon_handle;
     
     const float c_dist_fight = 2.f + 1e-2f;
     const float c_dist_pursue = 7.f + 1e-2f;
@@ -122,10 +123,10 @@ namespace dung
           wall_coll_resolve = false;
         }
       }
-      else if (rnd::one_in(prob_change_acc))
+      else if (rand_stream.one_in(prob_change_acc))
       {
-        acc_r += rnd::randn_range(-acc_step, +acc_step);
-        acc_c += rnd::randn_range(-acc_step*px_aspect, +acc_step*px_aspect);
+        acc_r += rand_stream.randn_range(-acc_step, +acc_step);
+        acc_c += rand_stream.randn_range(-acc_step*px_aspect, +acc_step*px_aspect);
         acc_r = math::clamp<float>(acc_r, -acc_lim*acc_factor, +acc_lim*acc_factor);
         acc_c = math::clamp<float>(acc_c, -acc_lim*acc_factor*px_aspect, +acc_lim*acc_factor*px_aspect);
       }
@@ -187,7 +188,7 @@ namespace dung
         wall_coll_resolve_ctr = 0;
         wall_coll_resolve = false;
       }
-      else if (!wall_coll_resolve && rnd::one_in(6))
+      else if (!wall_coll_resolve && rand_stream.one_in(6))
       {
         auto location = ttl::BBLocation::None;
         if (location_room != ttl::BBLocation::None && location_corr != ttl::BBLocation::None)
@@ -266,7 +267,7 @@ namespace dung
       style = { Color::Green, Color::DarkYellow };
     }
   
-    void init(const std::vector<std::unique_ptr<Weapon>>& all_weapons)
+    void init(SlotMap<std::unique_ptr<Weapon>>& all_weapons)
     {
       pos_r = static_cast<float>(pos.r);
       pos_c = static_cast<float>(pos.c);
@@ -275,16 +276,17 @@ namespace dung
       npc_class = rnd::rand_enum<Class>();
       
       int ctr = 0;
-      const int num_weapons = stlutils::sizeI(all_weapons);
+      const int num_weapon_slots = all_weapons.num_slots();
       if (!all_weapons.empty() && !rnd::one_in(4))
       {
         do
         {
-          int idx = rnd::rand_idx(num_weapons);
-          if (!all_weapons[idx]->picked_up)
+          auto handle = all_weapons.get_handle(rnd::rand_idx(num_weapon_slots));
+          auto* weapon = all_weapons.get(handle);
+          if (weapon != nullptr && !(*weapon)->picked_up)
           {
-            weapon_idx = idx;
-            all_weapons[idx]->picked_up = true;
+            weapon_handle = handle;
+            (*weapon)->picked_up = true;
             break;
           }
         } while (ctr++ < 10);
@@ -667,7 +669,7 @@ namespace dung
         update_terrain();
       }
       
-      if (rnd::one_in(prob_slow_fast))
+      if (rand_stream.one_in(prob_slow_fast))
       {
         math::toggle(slow);
         if (slow)
@@ -0,0 +1,193 @@
+//
+//  ObjectIndex.h
+//  DungGine
+//
+
+#pragma once
+#include "BSPTree.h"
+#include "Items.h"
+#include "PlayerBase.h"
+#include "SlotMap.h"
+#include <Core/StlUtils.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+
+namespace dung
+{
+
+  // The items lying in the world and the blood splats, bucketed by the room and
+  //   corridor they are in. Items are also bucketed by cell for pick-up.
+  // Carried items are not in the index: remove an item when it is picked up and
+  //   add it again when it is dropped. An object that has both a room and a corridor
+  //   is in both buckets.
+  // Blood splats drift on liquids but never change room / corridor, so their
+  //   buckets stay valid while they move. Remove a splat before it is recycled
+  //   by the BloodSplatPool.
+  class ObjectIndex final
+  {
+  public:
+    struct Bucket
+    {
+      std::vector<Item*> items;
+      std::vector<BloodSplat*> blood_splats;
+
+      bool empty() const { return items.empty() && blood_splats.empty(); }
+    };
+
+    struct CellItem
+    {
+      Item* item = nullptr;
+      SlotHandle handle;
+    };
+
+  private:
+    const BSPTree* m_bsp_tree = nullptr;
+    std::vector<Bucket> m_room_buckets;
+    std::vector<Bucket> m_corridor_buckets;
+    // Objects that are neither in a room nor in a corridor.
+    Bucket m_unlocated_bucket;
+
+    int m_world_cols = 0;
+    std::unordered_map<int, std::vector<CellItem>> m_items_by_cell;
+    const std::vector<CellItem> m_empty_cell;
+    
+    unsigned int m_version = 0;
+
+    Bucket* fetch_bucket(std::vector<Bucket>& buckets, int id)
+    {
+      if (id < 0)
+        return nullptr;
+      if (id >= stlutils::sizeI(buckets))
+        buckets.resize(id + 1);
+      return &buckets[id];
+    }
+
+    template<typename Lambda>
+    void for_each_bucket_of(const DungObject* obj, Lambda f)
+    {
+      auto* room_bucket = fetch_bucket(m_room_buckets, m_bsp_tree->get_room_id(obj->curr_room));
+      auto* corr_bucket = fetch_bucket(m_corridor_buckets, m_bsp_tree->get_corridor_id(obj->curr_corridor));
+      if (room_bucket != nullptr)
+        f(*room_bucket);
+      if (corr_bucket != nullptr)
+        f(*corr_bucket);
+      if (room_bucket == nullptr && corr_bucket == nullptr)
+        f(m_unlocated_bucket);
+    }
+
+    template<typename T>
+    static void erase_ptr(std::vector<T*>& ptrs, const T* ptr)
+    {
+      auto it = std::find(ptrs.begin(), ptrs.end(), ptr);
+      if (it != ptrs.end())
+      {
+        *it = ptrs.back();
+        ptrs.pop_back();
+      }
+    }
+
+    int get_cell_key(const RC& pos) const
+    {
+      return pos.r * m_world_cols + pos.c;
+    }
+
+  public:
+    void reset(const BSPTree* bsp_tree)
+    {
+      m_bsp_tree = bsp_tree;
+      m_room_buckets.clear();
+      m_room_buckets.resize(bsp_tree->fetch_leaves().size());
+      m_corridor_buckets.clear();
+      m_unlocated_bucket = {};
+      m_world_cols = bsp_tree->get_world_size().c;
+      m_items_by_cell.clear();
+      m_version++;
+    }
+    
+    // Changes whenever an object is added or removed.
+    unsigned int get_version() const { return m_version; }
+
+    // Call after the item's pos, curr_room and curr_corridor have been set.
+    void add_item(Item* item, const SlotHandle& handle)
+    {
+      for_each_bucket_of(item, [item](Bucket& bucket) { bucket.items.emplace_back(item); });
+      m_items_by_cell[get_cell_key(item->pos)].push_back({ item, handle });
+      m_version++;
+    }
+
+    // Call before the item's pos, curr_room or curr_corridor are changed.
+    void remove_item(const Item* item)
+    {
+      for_each_bucket_of(item, [item](Bucket& bucket) { erase_ptr(bucket.items, item); });
+      auto it = m_items_by_cell.find(get_cell_key(item->pos));
+      if (it != m_items_by_cell.end())
+      {
+        stlutils::erase_if(it->second, [item](const auto& ci) { return ci.item == item; });
+        if (it->second.empty())
+          m_items_by_cell.erase(it);
+      }
+      m_version++;
+    }
+
+    void add_blood_splat(BloodSplat* bs)
+    {
+      for_each_bucket_of(bs, [bs](Bucket& bucket) { bucket.blood_splats.emplace_back(bs); });
+      m_version++;
+    }
+
+    void remove_blood_splat(const BloodSplat* bs)
+    {
+      for_each_bucket_of(bs, [bs](Bucket& bucket) { erase_ptr(bucket.blood_splats, bs); });
+      m_version++;
+    }
+
+    void clear_blood_splats()
+    {
+      for (auto& bucket : m_room_buckets)
+        bucket.blood_splats.clear();
+      for (auto& bucket : m_corridor_buckets)
+        bucket.blood_splats.clear();
+      m_unlocated_bucket.blood_splats.clear();
+      m_version++;
+    }
+
+    // The items lying on a given cell.
+    const std::vector<CellItem>& fetch_items_at(const RC& pos) const
+    {
+      auto it = m_items_by_cell.find(get_cell_key(pos));
+      if (it != m_items_by_cell.end())
+        return it->second;
+      return m_empty_cell;
+    }
+
+    // By the ids used by BSPTree / Environment::VisibleSet.
+    const Bucket* fetch_room_bucket(int room_id) const
+    {
+      if (0 <= room_id && room_id < stlutils::sizeI(m_room_buckets))
+        return &m_room_buckets[room_id];
+      return nullptr;
+    }
+
+    const Bucket* fetch_corridor_bucket(int corr_id) const
+    {
+      if (0 <= corr_id && corr_id < stlutils::sizeI(m_corridor_buckets))
+        return &m_corridor_buckets[corr_id];
+      return nullptr;
+    }
+
+    const Bucket* fetch_room_bucket(const BSPNode* room) const
+    {
+      return m_bsp_tree != nullptr ? fetch_room_bucket(m_bsp_tree->get_room_id(room)) : nullptr;
+    }
+
+    const Bucket* fetch_corridor_bucket(const Corridor* corr) const
+    {
+      return m_bsp_tree != nullptr ? fetch_corridor_bucket(m_bsp_tree->get_corridor_id(corr)) : nullptr;
+    }
+
+    const Bucket& get_unlocated_bucket() const { return m_unlocated_bucket; }
+  };
+
+}
@@ -12,8 +12,10 @@
 #include "PlayerBase.h"
 #include "Inventory.h"
 #include "ScreenHelper.h"
+#include "SlotMap.h"
 #include <Core/StlUtils.h>
 #include <Termin8or/ParticleSystem.h>
+#include <array>
 
 //#define DEBUG_FIRE_SMOKE
 
@@ -27,15 +29,74 @@ namespace dung
     
     int base_ac = 10;
         
-    std::vector<int> key_idcs;
-    std::vector<int> lamp_idcs;
-    std::vector<int> weapon_idcs;
-    std::vector<int> potion_idcs;
-    std::vector<int> armour_idcs;
+    // Handles into DungGine's item stores of the items carried.
+    std::vector<SlotHandle> key_handles;
+    std::vector<SlotHandle> lamp_handles;
+    std::vector<SlotHandle> weapon_handles;
+    std::vector<SlotHandle> potion_handles;
+    std::vector<SlotHandle> armour_handles;
     bool show_inventory = false;
     float weight_capacity_soft = 50.f;
     float weight_capacity_hard = 70.f;
     float curr_tot_inv_weight = 0.f;
+    // Items picked up since the last inventory update. Their rows are added to
+    //   the inventory by DungGine::update_inventory().
+    std::vector<Item*> inv_items_added;
+    
+  private:
+    // The selected items in the inventory. Only re-read from the inventory when
+    //   its selection version changes (see Inventory::get_selection_version()).
+    struct Equipment
+    {
+      const Inventory* inventory = nullptr;
+      unsigned int selection_version = 0;
+      Key* key = nullptr;
+      Lamp* lamp = nullptr;
+      Weapon* melee_weapon = nullptr;
+      Potion* potion = nullptr;
+      std::array<Armour*, NUM_ARMOUR_TYPES> armour {};
+      int tot_protection = 0;
+      int melee_damage = 1; // Fists when no weapon is selected.
+    };
+    mutable Equipment m_equipment;
+    
+    const Equipment& fetch_equipment(Inventory* inventory) const
+    {
+      if (m_equipment.inventory == inventory
+          && m_equipment.selection_version == inventory->get_selection_version())
+        return m_equipment;
+        
+      auto f_get_selected = [inventory](const std::string& group_title, int subgroup_idx) -> Item*
+      {
+        auto* group = inventory->fetch_group(group_title);
+        auto* subgroup = group->fetch_subgroup(subgroup_idx);
+        auto* selected_inv_item = subgroup->get_selected_item();
+        if (selected_inv_item != nullptr)
+          return selected_inv_item->item;
+        return nullptr;
+      };
+      
+      m_equipment = {};
+      m_equipment.key = dynamic_cast<Key*>(f_get_selected("Keys:", 0));
+      m_equipment.lamp = dynamic_cast<Lamp*>(f_get_selected("Lamps:", 0));
+      m_equipment.melee_weapon = dynamic_cast<Weapon*>(f_get_selected("Weapons:", 0));
+      m_equipment.potion = dynamic_cast<Potion*>(f_get_selected("Potions:", 0));
+      if (m_equipment.melee_weapon != nullptr)
+        m_equipment.melee_damage = m_equipment.melee_weapon->damage;
+      for (int type = 0; type < NUM_ARMOUR_TYPES; ++type)
+      {
+        auto* armour = dynamic_cast<Armour*>(f_get_selected("Armour:", type));
+        m_equipment.armour[type] = armour;
+        if (armour != nullptr)
+          m_equipment.tot_protection += armour->protection;
+      }
+      // Read after fetching, since fetching may create missing groups.
+      m_equipment.inventory = inventory;
+      m_equipment.selection_version = inventory->get_selection_version();
+      return m_equipment;
+    }
+    
+  public:
     
     ParticleHandler fire_smoke_engine { 500 };
     
@@ -183,20 +244,23 @@ namespace dung
       return curr_tot_inv_weight + item_weight <= weight_capacity_hard;
     }
     
+    void on_item_picked_up(Item* item)
+    {
+      item->picked_up = true;
+      curr_tot_inv_weight += item->weight;
+      inv_items_added.emplace_back(item);
+    }
+    
+    // Call before the item is destroyed.
+    void on_item_removed(Item* item)
+    {
+      curr_tot_inv_weight = std::max(curr_tot_inv_weight - item->weight, 0.f);
+      stlutils::erase_if(inv_items_added, [item](const auto* i) { return i == item; });
+    }
+    
     int calc_armour_class(Inventory* inventory) const
     {
-      int tot_protection = 0;
-      auto* armour_group = inventory->fetch_group("Armour:");
-      for (auto& armour_subgroup : *armour_group)
-      {
-        auto* selected_inv_item = armour_subgroup.get_selected_item();
-        if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-        {
-          auto* armour = dynamic_cast<Armour*>(selected_inv_item->item);
-          if (armour != nullptr)
-            tot_protection += armour->protection;
-        }
-      }
+      int tot_protection = fetch_equipment(inventory).tot_protection;
       return base_ac + tot_protection + (dexterity / 2); // Example: Include dexterity bonus
     }
     
@@ -212,30 +276,30 @@ namespace dung
       return strength / 2; // Example: Strength bonus to damage
     }
     
+    int calc_melee_damage(Inventory* inventory) const
+    {
+      return fetch_equipment(inventory).melee_damage + get_melee_damage_bonus();
+    }
+    
     bool using_key_id(Inventory* inventory, int key_id) const
     {
-      auto* group = inventory->fetch_group("Keys:");
-      auto* subgroup = group->fetch_subgroup(0);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* key = dynamic_cast<Key*>(selected_inv_item->item);
-        if (key != nullptr)
-          return key->key_id == key_id;
-      }
-      return false;
+      const auto* key = fetch_equipment(inventory).key;
+      return key != nullptr && key->key_id == key_id;
     }
     
-    void remove_key_by_key_id(Inventory* inventory, std::vector<Key>& all_keys, int key_id)
+    void remove_key_by_key_id(Inventory* inventory, SlotMap<Key>& all_keys, int key_id)
     {
-      auto it = stlutils::find_if(all_keys, [key_id](const auto& key) { return key.key_id == key_id; });
-      if (it != all_keys.end())
-        inventory->remove_item(&(*it));
-      stlutils::erase_if(key_idcs, [&](int key_idx) { return all_keys[key_idx].key_id == key_id; });
-      stlutils::erase_if(all_keys, [&](const auto& key) { return key.key_id == key_id; });
+      auto handle = find_handle_if(key_handles, all_keys, [key_id](const auto& key) { return key.key_id == key_id; });
+      if (auto* key = all_keys.get(handle); key != nullptr)
+      {
+        inventory->remove_item(key);
+        on_item_removed(key);
+        stlutils::erase_if(key_handles, [handle](const auto& h) { return h == handle; });
+        all_keys.erase(handle);
+      }
     }
     
-    void remove_selected_potion(Inventory* inventory, std::vector<Potion>& all_potions)
+    void remove_selected_potion(Inventory* inventory, SlotMap<Potion>& all_potions)
     {
       auto* group = inventory->fetch_group("Potions:");
       auto* subgroup = group->fetch_subgroup(0);
@@ -245,81 +309,40 @@ namespace dung
         auto* potion = dynamic_cast<Potion*>(selected_inv_item->item);
         if (potion != nullptr)
         {
-          auto idx = stlutils::find_if_idx(all_potions, [potion](const auto& p) { return &p == potion; });
-          subgroup->remove_item(potion);
-          stlutils::erase(potion_idcs, idx);
-          stlutils::erase_if(all_potions, [potion](const auto& p) { return &p == potion; });
+          auto handle = find_handle_if(potion_handles, all_potions, [potion](const auto& p) { return &p == potion; });
+          inventory->remove_item(potion);
+          on_item_removed(potion);
+          stlutils::erase_if(potion_handles, [handle](const auto& h) { return h == handle; });
+          all_potions.erase(handle);
         }
       }
     }
     
     Key* get_selected_key(Inventory* inventory) const
     {
-      auto* group = inventory->fetch_group("Keys:");
-      auto* subgroup = group->fetch_subgroup(0);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* key = dynamic_cast<Key*>(selected_inv_item->item);
-        if (key != nullptr)
-          return key;
-      }
-      return nullptr;
+      return fetch_equipment(inventory).key;
     }
     
     Lamp* get_selected_lamp(Inventory* inventory) const
     {
-      auto* group = inventory->fetch_group("Lamps:");
-      auto* subgroup = group->fetch_subgroup(0);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* lamp = dynamic_cast<Lamp*>(selected_inv_item->item);
-        if (lamp != nullptr)
-          return lamp;
-      }
-      return nullptr;
+      return fetch_equipment(inventory).lamp;
     }
     
-    Weapon* get_selected_melee_weapon(Inventory* inventory)
+    Weapon* get_selected_melee_weapon(Inventory* inventory) const
     {
-     auto* group = inventory->fetch_group("Weapons:");
-      auto* subgroup = group->fetch_subgroup(0);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* weapon = dynamic_cast<Weapon*>(selected_inv_item->item);
-        if (weapon != nullptr)
-          return weapon;
-      }
-      return nullptr;
+      return fetch_equipment(inventory).melee_weapon;
     }
     
-    Potion* get_selected_potion(Inventory* inventory)
+    Potion* get_selected_potion(Inventory* inventory) const
     {
-      auto* group = inventory->fetch_group("Potions:");
-      auto* subgroup = group->fetch_subgroup(0);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* potion = dynamic_cast<Potion*>(selected_inv_item->item);
-        if (potion != nullptr)
-          return potion;
-      }
-      return nullptr;
+      return fetch_equipment(inventory).potion;
     }
     
-    Armour* get_selected_armour(Inventory* inventory, ArmourType type)
+    Armour* get_selected_armour(Inventory* inventory, ArmourType type) const
     {
-      auto* group = inventory->fetch_group("Armour:");
-      auto* subgroup = group->fetch_subgroup(type);
-      auto* selected_inv_item = subgroup->get_selected_item();
-      if (selected_inv_item != nullptr && selected_inv_item->item != nullptr)
-      {
-        auto* armour = dynamic_cast<Armour*>(selected_inv_item->item);
-        if (armour != nullptr)
-          return armour;
-      }
+      const auto& armour = fetch_equipment(inventory).armour;
+      if (0 <= type && type < stlutils::sizeI(armour))
+        return armour[type];
       return nullptr;
     }
     
@@ -0,0 +1,154 @@
+//
+//  PlacementEngine.h
+//  DungGine
+//
+
+#pragma once
+#include "Environment.h"
+#include <Core/Rand.h>
+#include <Core/StlUtils.h>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <optional>
+
+
+namespace dung
+{
+
+  enum class PlacementRule
+  {
+    Anywhere,     // Any cell inside a room.
+    DryLand,      // Cells with dry terrain.
+    DryWalkable,  // Cells with dry terrain that can be walked on.
+    NUM_ITEMS
+  };
+
+  // Picks random cells for items, NPCs and the PC without rejection sampling.
+  // For each rule, the valid room interior cells are listed room by room, so a uniform
+  //   pick among them is a pick of a room weighted by its number of valid cells
+  //   followed by a uniform pick of a cell in that room.
+  // Build after the dungeon has been styled, since the rules depend on the terrain.
+  class PlacementEngine final
+  {
+    struct CellList
+    {
+      std::vector<RC> cells;
+      // cells[room_offsets[i] .. room_offsets[i + 1]) belong to m_rooms[i].
+      std::vector<int> room_offsets;
+    };
+
+    const BSPTree* m_bsp_tree = nullptr;
+    std::vector<BSPNode*> m_rooms;
+    std::array<CellList, static_cast<int>(PlacementRule::NUM_ITEMS)> m_cell_lists;
+    bool m_built = false;
+
+    const CellList& get_cell_list(PlacementRule rule) const
+    {
+      return m_cell_lists[static_cast<int>(rule)];
+    }
+
+    BSPNode* find_room(const CellList& cl, int cell_idx) const
+    {
+      auto it = std::upper_bound(cl.room_offsets.begin(), cl.room_offsets.end(), cell_idx);
+      return m_rooms[static_cast<int>(it - cl.room_offsets.begin()) - 1];
+    }
+
+  public:
+    struct Placement
+    {
+      RC pos;
+      BSPNode* room = nullptr;
+    };
+
+    void reset(const BSPTree* bsp_tree)
+    {
+      m_bsp_tree = bsp_tree;
+      m_built = false;
+    }
+
+    // Call when the terrain has changed.
+    void invalidate() { m_built = false; }
+    bool is_built() const { return m_built; }
+
+    void build(const Environment& environment)
+    {
+      m_rooms = m_bsp_tree->fetch_leaves();
+      for (auto& cl : m_cell_lists)
+      {
+        cl.cells.clear();
+        cl.room_offsets.assign(1, 0);
+      }
+      for (auto* room : m_rooms)
+      {
+        // Same interior as Environment::is_inside_any_room().
+        const auto& bb = room->bb_leaf_room;
+        for (int r = bb.r + 1; r < bb.r + bb.r_len - 1; ++r)
+          for (int c = bb.c + 1; c < bb.c + bb.c_len - 1; ++c)
+          {
+            RC pos { r, c };
+            m_cell_lists[static_cast<int>(PlacementRule::Anywhere)].cells.emplace_back(pos);
+            if (is_dry(environment.get_terrain(pos)))
+            {
+              m_cell_lists[static_cast<int>(PlacementRule::DryLand)].cells.emplace_back(pos);
+              if (environment.allow_move_to(r, c))
+                m_cell_lists[static_cast<int>(PlacementRule::DryWalkable)].cells.emplace_back(pos);
+            }
+          }
+        for (auto& cl : m_cell_lists)
+          cl.room_offsets.emplace_back(stlutils::sizeI(cl.cells));
+      }
+      m_built = true;
+    }
+
+    int num_cells(PlacementRule rule) const
+    {
+      return stlutils::sizeI(get_cell_list(rule).cells);
+    }
+
+    // Uniformly random valid cell. std::nullopt if there are no valid cells.
+    std::optional<Placement> sample_room_cell(PlacementRule rule) const
+    {
+      const auto& cl = get_cell_list(rule);
+      if (cl.cells.empty())
+        return std::nullopt;
+      int cell_idx = rnd::rand_int(0, stlutils::sizeI(cl.cells) - 1);
+      return Placement { cl.cells[cell_idx], find_room(cl, cell_idx) };
+    }
+
+    // Uniformly random valid cell within the square of half side half_size around center.
+    std::optional<Placement> sample_room_cell_near(PlacementRule rule, const RC& center, int half_size) const
+    {
+      const auto& cl = get_cell_list(rule);
+      ttl::Rectangle window { center.r - half_size, center.c - half_size, 2*half_size + 1, 2*half_size + 1 };
+      std::vector<int> cell_idcs;
+      for (int room_idx = 0; room_idx < stlutils::sizeI(m_rooms); ++room_idx)
+      {
+        if (!SpatialGrid::overlaps(m_rooms[room_idx]->bb_leaf_room, window))
+          continue;
+        for (int cell_idx = cl.room_offsets[room_idx]; cell_idx < cl.room_offsets[room_idx + 1]; ++cell_idx)
+          if (window.is_inside(cl.cells[cell_idx]))
+            cell_idcs.emplace_back(cell_idx);
+      }
+      if (cell_idcs.empty())
+        return std::nullopt;
+      int cell_idx = cell_idcs[rnd::rand_int(0, stlutils::sizeI(cell_idcs) - 1)];
+      return Placement { cl.cells[cell_idx], find_room(cl, cell_idx) };
+    }
+
+    // Uniformly random cell inside the corridor. std::nullopt if it has no inside.
+    static std::optional<RC> sample_corridor_cell(const Corridor* corridor)
+    {
+      const auto& bb = corridor->bb;
+      std::vector<RC> cells;
+      for (int r = bb.top(); r <= bb.bottom(); ++r)
+        for (int c = bb.left(); c <= bb.right(); ++c)
+          if (corridor->is_inside_corridor({ r, c }))
+            cells.push_back({ r, c });
+      if (cells.empty())
+        return std::nullopt;
+      return cells[rnd::rand_int(0, stlutils::sizeI(cells) - 1)];
+    }
+  };
+
+}
@@ -7,6 +7,7 @@
 
 #pragma once
 #include "DungObject.h"
+#include "RandStream.h"
 
 
 namespace dung
@@ -20,7 +21,7 @@ namespace dung
     RC dir { 0, 0 };
     float pos_r = 0.f;
     float pos_c = 0.f;
-    const float life_time = 5.f;
+    float life_time = 5.f;
     float time_stamp = 0.f;
     float speed = 0.05f;
     bool alive = true;
@@ -94,27 +95,28 @@ namespace dung
     bool can_swim = true;
     bool can_fly = false;
     
-    std::vector<BloodSplat> blood_splats;
-    
     RC cached_fight_offs { 0, 0 };
     styles::Style cached_fight_style;
     std::string cached_fight_str;
     
+    // Used instead of the global rnd state when updating, see RandStream.h.
+    RandStream rand_stream;
+    
     bool allow_move()
     {
       bool can_move_base = true;
       if (weakness > 0)
-        can_move_base = !rnd::one_in(2 + strength - weakness);
+        can_move_base = !rand_stream.one_in(2 + strength - weakness);
         
       if (can_move_base)
       {
         auto dry_resistance = get_dry_resistance(on_terrain);
         if (dry_resistance.has_value())
-          return rnd::rand() >= dry_resistance.value();
+          return rand_stream.rand() >= dry_resistance.value();
         
         auto wet_viscosity = get_wet_viscosity(on_terrain);
         if (wet_viscosity.has_value())
-          return rnd::rand() >= wet_viscosity.value();
+          return rand_stream.rand() >= wet_viscosity.value();
       }
         
       return false;
@@ -154,10 +156,10 @@ namespace dung
       
       if (is_wet(on_terrain) && can_swim && !can_fly)
       {
-        if (rnd::one_in(endurance) && weakness < strength)
+        if (rand_stream.one_in(endurance) && weakness < strength)
           weakness++;
         
-        if (rnd::one_in(1 + strength - weakness))
+        if (rand_stream.one_in(1 + strength - weakness))
           health -= math::roundI(globals::max_health*fluid_damage);
       }
       else if (weight_strain > 0.f)
@@ -166,7 +168,7 @@ namespace dung
       }
       else
       {
-        if (rnd::one_in(2) && 0 < weakness)
+        if (rand_stream.one_in(2) && 0 < weakness)
           weakness--;
       }
     }
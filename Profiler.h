@@ -0,0 +1,186 @@
+//
+//  Profiler.h
+//  DungGine
+//
+
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+
+
+// Scoped timers for the phases of DungGine::update() and DungGine::draw().
+// Define DUNGGINE_PROFILING before including DungGine.h to enable them,
+//   otherwise DUNGGINE_PROFILE_SCOPE() expands to nothing.
+#ifdef DUNGGINE_PROFILING
+#define DUNGGINE_PROFILE_CONCAT_IMPL(a, b) a##b
+#define DUNGGINE_PROFILE_CONCAT(a, b) DUNGGINE_PROFILE_CONCAT_IMPL(a, b)
+#define DUNGGINE_PROFILE_SCOPE(name) \
+  dung::profiling::ScopedTimer DUNGGINE_PROFILE_CONCAT(profile_scope_, __LINE__) { name }
+#else
+#define DUNGGINE_PROFILE_SCOPE(name) ((void)0)
+#endif
+
+
+namespace dung
+{
+
+  namespace profiling
+  {
+
+    struct ProfileEvent
+    {
+      const char* name = nullptr; // Must be a string literal.
+      int64_t start_ns = 0;
+      int64_t duration_ns = 0;
+      uint32_t thread_id = 0;
+    };
+
+    // Records timing events into a fixed size ring buffer. Recording is lock-free and
+    //   wait-free; the oldest events are overwritten when the buffer is full.
+    // Export and summary functions should be called when no frame is running.
+    class Profiler final
+    {
+      static constexpr size_t c_capacity = 1 << 16;
+      std::vector<ProfileEvent> m_events;
+      std::atomic<uint64_t> m_write_idx { 0 };
+      const std::chrono::steady_clock::time_point m_t0 = std::chrono::steady_clock::now();
+
+      std::vector<ProfileEvent> fetch_events() const
+      {
+        uint64_t write_idx = m_write_idx.load(std::memory_order_acquire);
+        uint64_t num_events = std::min<uint64_t>(write_idx, c_capacity);
+        std::vector<ProfileEvent> events;
+        events.reserve(num_events);
+        for (uint64_t i = write_idx - num_events; i < write_idx; ++i)
+          events.emplace_back(m_events[i & (c_capacity - 1)]);
+        return events;
+      }
+
+    public:
+      Profiler() : m_events(c_capacity) {}
+
+      int64_t now_ns() const
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - m_t0).count();
+      }
+
+      void record(const char* name, int64_t start_ns, int64_t duration_ns)
+      {
+        auto idx = m_write_idx.fetch_add(1, std::memory_order_relaxed);
+        auto& event = m_events[idx & (c_capacity - 1)];
+        event.name = name;
+        event.start_ns = start_ns;
+        event.duration_ns = duration_ns;
+        event.thread_id = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+      }
+
+      void clear()
+      {
+        m_write_idx.store(0, std::memory_order_release);
+      }
+
+      // Writes the recorded events as "complete" events in the Chrome trace event format.
+      // Open the file in chrome://tracing or https://ui.perfetto.dev .
+      bool export_chrome_trace(const std::string& file_path) const
+      {
+        std::ofstream file { file_path };
+        if (!file)
+        {
+          std::cerr << "ERROR in Profiler::export_chrome_trace() : Unable to open \"" << file_path << "\" for writing!" << std::endl;
+          return false;
+        }
+        file << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& event : fetch_events())
+        {
+          if (event.name == nullptr)
+            continue;
+          if (!first)
+            file << ",\n";
+          first = false;
+          file << "{\"name\":\"" << event.name << "\",\"cat\":\"DungGine\",\"ph\":\"X\""
+               << ",\"ts\":" << std::fixed << std::setprecision(3) << event.start_ns * 1e-3
+               << ",\"dur\":" << event.duration_ns * 1e-3
+               << ",\"pid\":0,\"tid\":" << event.thread_id << "}";
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return static_cast<bool>(file);
+      }
+
+      // Per-phase count, mean, p50, p90, p99 and max in milliseconds.
+      void print_summary(std::ostream& os = std::cout) const
+      {
+        std::map<std::string, std::vector<double>> phase_ms;
+        for (const auto& event : fetch_events())
+          if (event.name != nullptr)
+            phase_ms[event.name].emplace_back(event.duration_ns * 1e-6);
+
+        auto f_percentile = [](const std::vector<double>& sorted, double p)
+        {
+          auto idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+          return sorted[std::min(idx, sorted.size() - 1)];
+        };
+
+        os << std::left << std::setw(24) << "phase"
+           << std::right << std::setw(8) << "count"
+           << std::setw(10) << "mean" << std::setw(10) << "p50"
+           << std::setw(10) << "p90" << std::setw(10) << "p99"
+           << std::setw(10) << "max" << "  [ms]\n";
+        os << std::fixed << std::setprecision(3);
+        for (auto& [name, durations] : phase_ms)
+        {
+          std::sort(durations.begin(), durations.end());
+          double sum = 0.;
+          for (auto d : durations)
+            sum += d;
+          os << std::left << std::setw(24) << name
+             << std::right << std::setw(8) << durations.size()
+             << std::setw(10) << sum / durations.size()
+             << std::setw(10) << f_percentile(durations, 0.5)
+             << std::setw(10) << f_percentile(durations, 0.9)
+             << std::setw(10) << f_percentile(durations, 0.99)
+             << std::setw(10) << durations.back() << "\n";
+        }
+      }
+    };
+
+    inline Profiler& get_profiler()
+    {
+      static Profiler profiler;
+      return profiler;
+    }
+
+    class ScopedTimer final
+    {
+      const char* m_name = nullptr;
+      int64_t m_start_ns = 0;
+
+    public:
+      explicit ScopedTimer(const char* name)
+        : m_name(name)
+        , m_start_ns(get_profiler().now_ns())
+      {}
+
+      ~ScopedTimer()
+      {
+        auto& profiler = get_profiler();
+        profiler.record(m_name, m_start_ns, profiler.now_ns() - m_start_ns);
+      }
+
+      ScopedTimer(const ScopedTimer&) = delete;
+      ScopedTimer& operator=(const ScopedTimer&) = delete;
+    };
+
+  }
+
+}
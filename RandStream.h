@@ -0,0 +1,85 @@
+//
+//  RandStream.h
+//  DungGine
+//
+
+#pragma once
+#include <Core/Math.h>
+#include <cstdint>
+#include <cmath>
+
+
+namespace dung
+{
+
+  // Small self-contained random number stream (splitmix64).
+  // Each player / NPC owns one so that their updates don't touch the global rnd state
+  //   and give the same results no matter in which order or on which thread they run.
+  // Mirrors the subset of the rnd functions used when updating players and NPCs.
+  class RandStream final
+  {
+    uint64_t m_state = 0x9E3779B97F4A7C15ull;
+
+  public:
+    RandStream() = default;
+    explicit RandStream(uint64_t seed) { this->seed(seed); }
+
+    void seed(uint64_t seed) { m_state = seed; }
+    // seed(get_state()) resumes the stream where it was.
+    uint64_t get_state() const { return m_state; }
+
+    // Combines a base seed and a stream index into a well separated seed.
+    static uint64_t make_seed(uint64_t base_seed, uint64_t stream_idx)
+    {
+      RandStream rs { base_seed ^ (stream_idx * 0xD1B54A32D192ED03ull) };
+      return rs.next_u64();
+    }
+
+    uint64_t next_u64()
+    {
+      uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+    // [0, 1).
+    float rand()
+    {
+      return static_cast<float>(next_u64() >> 40) * (1.f / 16777216.f);
+    }
+
+    // [lo, hi).
+    float rand_float(float lo, float hi)
+    {
+      return lo + (hi - lo)*rand();
+    }
+
+    // [lo, hi].
+    int rand_int(int lo, int hi)
+    {
+      if (hi <= lo)
+        return lo;
+      auto range = static_cast<uint64_t>(static_cast<int64_t>(hi) - lo + 1);
+      return lo + static_cast<int>(next_u64() % range);
+    }
+
+    bool one_in(int n)
+    {
+      if (n <= 1)
+        return true;
+      return next_u64() % static_cast<uint64_t>(n) == 0;
+    }
+
+    // Normal distribution centred in the middle of [lo, hi] with sigma = (hi - lo)/2.
+    float randn_range(float lo, float hi)
+    {
+      // Box-Muller.
+      float u1 = 1.f - rand();
+      float u2 = rand();
+      float z = std::sqrt(-2.f*std::log(u1)) * std::cos(math::c_2pi*u2);
+      return 0.5f*(lo + hi) + 0.5f*(hi - lo)*z;
+    }
+  };
+
+}
@@ -0,0 +1,240 @@
+//
+//  SaveGame.h
+//  DungGine
+//
+
+#pragma once
+#include "DungeonSnapshot.h"
+#include "PC.h"
+#include "BitPlane.h"
+#include <cstdint>
+
+
+namespace dung
+{
+
+  // Save game format (.dsave), see DungGine::save_game():
+  //   SaveHeader (magic "DGSV", version, save id), then the same body as a dungeon
+  //   snapshot (see DungeonSnapshot.h) followed by a runtime block.
+  // Autosave delta (<save file>.delta), see DungGine::autosave():
+  //   DeltaHeader (magic "DGSD", version, id of the save it applies to) followed by
+  //   a runtime block with only what has changed since that save.
+  // Items are referred to by their order in the save, the checkpoint index.
+  namespace savegame
+  {
+
+    struct SaveHeader
+    {
+      char magic[4] = { 'D', 'G', 'S', 'V' };
+      uint32_t version = 4;
+      uint64_t save_id = 0;
+    };
+
+    struct DeltaHeader
+    {
+      char magic[4] = { 'D', 'G', 'S', 'D' };
+      uint32_t version = 4;
+      uint64_t save_id = 0;
+    };
+
+    // FNV-1a. Tells which records have changed since the last save.
+    uint64_t hash_bytes(const std::vector<char>& bytes)
+    {
+      uint64_t hash = 14695981039346656037ull;
+      for (char b : bytes)
+      {
+        hash ^= static_cast<unsigned char>(b);
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+    // A copy of a field, taken on the frame and written by the autosave thread.
+    //   64 cells per word, see BitPlaneView::copy_words(). No words if the field
+    //   only holds the default value.
+    struct FieldCopy
+    {
+      uint32_t num_cells = 0;
+      std::vector<uint64_t> words;
+    };
+
+    FieldCopy copy_field(const BitPlaneView& field)
+    {
+      FieldCopy copy;
+      copy.num_cells = static_cast<uint32_t>(field.size());
+      if (!field.is_default())
+        field.copy_words(copy.words);
+      return copy;
+    }
+
+    void write_field(BinaryWriter& writer, const FieldCopy& field)
+    {
+      writer.write(field.num_cells);
+      writer.write<bool>(!field.words.empty());
+      if (!field.words.empty())
+        writer.write_vector(field.words);
+    }
+
+    // The stored field must have the same size as field.
+    bool read_field(BinaryReader& reader, BitPlaneView& field)
+    {
+      uint32_t num_cells = 0;
+      bool has_cells = false;
+      if (!reader.read(num_cells) || !reader.read(has_cells)
+          || num_cells != static_cast<uint32_t>(field.size()))
+        return false;
+      if (!has_cells)
+      {
+        field.fill(field.get_default());
+        return true;
+      }
+      std::vector<uint64_t> words;
+      if (!reader.read_vector(words) || stlutils::sizeI(words) != field.num_words())
+        return false;
+      field.set_words(words);
+      return true;
+    }
+
+    void write_door_state(BinaryWriter& writer, const Door& door)
+    {
+      writer.write<bool>(door.is_open);
+      writer.write<bool>(door.is_locked);
+      writer.write<bool>(door.fog_of_war);
+    }
+
+    bool read_door_state(BinaryReader& reader, Door& door)
+    {
+      reader.read(door.is_open);
+      reader.read(door.is_locked);
+      reader.read(door.fog_of_war);
+      return reader.ok();
+    }
+
+    // The state shared by the PC and the NPCs that a dungeon snapshot does not hold.
+    void write_player_state(BinaryWriter& writer, const PlayerBase& player)
+    {
+      writer.write_rc(player.last_pos);
+      writer.write<float>(player.los_r);
+      writer.write<float>(player.los_c);
+      writer.write<float>(player.last_los_r);
+      writer.write<float>(player.last_los_c);
+      writer.write<float>(player.weight_strain);
+      writer.write<int32_t>(static_cast<int32_t>(player.on_terrain));
+    }
+
+    bool read_player_state(BinaryReader& reader, PlayerBase& player)
+    {
+      int32_t on_terrain = 0;
+      reader.read_rc(player.last_pos);
+      reader.read(player.los_r);
+      reader.read(player.los_c);
+      reader.read(player.last_los_r);
+      reader.read(player.last_los_c);
+      reader.read(player.weight_strain);
+      reader.read(on_terrain);
+      player.on_terrain = static_cast<Terrain>(on_terrain);
+      return reader.ok();
+    }
+
+    // Kinematics and behaviour. Stored after snapshot::write_npc().
+    void write_npc_state(BinaryWriter& writer, const NPC& npc)
+    {
+      write_player_state(writer, npc);
+      writer.write<float>(npc.pos_r);
+      writer.write<float>(npc.pos_c);
+      writer.write<float>(npc.vel_r);
+      writer.write<float>(npc.vel_c);
+      writer.write<float>(npc.acc_r);
+      writer.write<float>(npc.acc_c);
+      writer.write<float>(npc.acc_factor);
+      writer.write<float>(npc.vel_factor);
+      writer.write<bool>(npc.slow);
+      writer.write<int32_t>(static_cast<int32_t>(npc.state));
+      writer.write<bool>(npc.wall_coll_resolve);
+      writer.write<int32_t>(npc.wall_coll_resolve_ctr);
+      writer.write<bool>(npc.fog_of_war);
+      writer.write<bool>(npc.is_hostile);
+      writer.write<bool>(npc.was_hostile);
+      writer.write<float>(npc.death_time_s);
+    }
+
+    bool read_npc_state(BinaryReader& reader, NPC& npc)
+    {
+      int32_t state = 0;
+      read_player_state(reader, npc);
+      reader.read(npc.pos_r);
+      reader.read(npc.pos_c);
+      reader.read(npc.vel_r);
+      reader.read(npc.vel_c);
+      reader.read(npc.acc_r);
+      reader.read(npc.acc_c);
+      reader.read(npc.acc_factor);
+      reader.read(npc.vel_factor);
+      reader.read(npc.slow);
+      reader.read(state);
+      reader.read(npc.wall_coll_resolve);
+      reader.read(npc.wall_coll_resolve_ctr);
+      reader.read(npc.fog_of_war);
+      reader.read(npc.is_hostile);
+      reader.read(npc.was_hostile);
+      reader.read(npc.death_time_s);
+      if (!reader.ok() || state < 0 || state >= static_cast<int32_t>(State::NUM_ITEMS))
+        return false;
+      npc.state = static_cast<State>(state);
+      return true;
+    }
+
+    // Stats and kinematics. The carried items are stored separately.
+    void write_pc(BinaryWriter& writer, const BSPTree& bsp_tree, const PC& pc)
+    {
+      writer.write_rc(pc.pos);
+      snapshot::write_location(writer, bsp_tree, pc.curr_room, pc.curr_corridor);
+      write_player_state(writer, pc);
+      writer.write<char>(pc.character);
+      snapshot::write_style(writer, pc.style);
+      writer.write<int32_t>(pc.health);
+      writer.write<int32_t>(pc.strength);
+      writer.write<int32_t>(pc.dexterity);
+      writer.write<int32_t>(pc.endurance);
+      writer.write<int32_t>(pc.weakness);
+      writer.write<int32_t>(pc.thac0);
+      writer.write<bool>(pc.can_swim);
+      writer.write<bool>(pc.can_fly);
+      writer.write<uint64_t>(pc.rand_stream.get_state());
+      writer.write<bool>(pc.is_spawned);
+      writer.write<int32_t>(pc.base_ac);
+      writer.write<float>(pc.weight_capacity_soft);
+      writer.write<float>(pc.weight_capacity_hard);
+      writer.write<float>(pc.curr_tot_inv_weight);
+    }
+
+    bool read_pc(BinaryReader& reader, BSPTree& bsp_tree, PC& pc)
+    {
+      uint64_t rand_state = 0;
+      reader.read_rc(pc.pos);
+      if (!snapshot::read_location(reader, bsp_tree, pc.curr_room, pc.curr_corridor))
+        return false;
+      read_player_state(reader, pc);
+      reader.read(pc.character);
+      snapshot::read_style(reader, pc.style);
+      reader.read(pc.health);
+      reader.read(pc.strength);
+      reader.read(pc.dexterity);
+      reader.read(pc.endurance);
+      reader.read(pc.weakness);
+      reader.read(pc.thac0);
+      reader.read(pc.can_swim);
+      reader.read(pc.can_fly);
+      reader.read(rand_state);
+      reader.read(pc.is_spawned);
+      reader.read(pc.base_ac);
+      reader.read(pc.weight_capacity_soft);
+      reader.read(pc.weight_capacity_hard);
+      reader.read(pc.curr_tot_inv_weight);
+      pc.rand_stream.seed(rand_state);
+      return reader.ok();
+    }
+
+  }
+
+}
@@ -48,6 +48,18 @@ namespace dung
       return m_screen_in_world.size();
     }
     
+    // The part of the world currently covered by the screen.
+    const ttl::Rectangle& get_screen_rect() const
+    {
+      return m_screen_in_world;
+    }
+    
+    // margin : Extra cells around the screen, for things drawn next to world_pos.
+    bool is_on_screen(const RC& world_pos, int margin = 0) const
+    {
+      return m_screen_in_world.is_inside_offs(world_pos, margin);
+    }
+    
     void focus_on_world_pos_mid_screen(const RC& world_pos)
     {
       m_screen_in_world.set_pos(world_pos - m_screen_in_world.size()/2);
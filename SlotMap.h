@@ -0,0 +1,237 @@
+//
+//  SlotMap.h
+//  DungGine
+//
+
+#pragma once
+#include <Core/StlUtils.h>
+#include <deque>
+#include <vector>
+#include <optional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+
+namespace dung
+{
+
+  // Refers to an element of a SlotMap. A handle goes stale when its element is removed,
+  //   even if the slot is later reused by another element.
+  struct SlotHandle
+  {
+    static constexpr uint32_t c_invalid_idx = ~0u;
+    uint32_t idx = c_invalid_idx;
+    uint32_t generation = 0;
+
+    bool is_valid() const { return idx != c_invalid_idx; }
+
+    bool operator==(const SlotHandle& other) const
+    {
+      return idx == other.idx && generation == other.generation;
+    }
+    bool operator!=(const SlotHandle& other) const { return !(*this == other); }
+  };
+
+  // Element store with O(1) insert, erase and lookup through generational handles.
+  // Elements never move, so pointers to them (e.g. the Item* held by the Inventory)
+  //   stay valid until the element itself is erased.
+  // Iteration visits the live elements in slot order.
+  template<typename T>
+  class SlotMap final
+  {
+    struct Slot
+    {
+      std::optional<T> value;
+      uint32_t generation = 0;
+    };
+    std::deque<Slot> m_slots;
+    std::vector<uint32_t> m_free_idcs;
+    int m_size = 0;
+
+    template<typename U>
+    friend class SlotMap;
+
+    template<typename SlotMapT, typename ValueT>
+    class Iterator
+    {
+      SlotMapT* m_slot_map = nullptr;
+      uint32_t m_idx = 0;
+
+      void skip_empty()
+      {
+        while (m_idx < m_slot_map->m_slots.size() && !m_slot_map->m_slots[m_idx].value.has_value())
+          ++m_idx;
+      }
+
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = ValueT*;
+      using reference = ValueT&;
+
+      Iterator() = default;
+      Iterator(SlotMapT* slot_map, uint32_t idx)
+        : m_slot_map(slot_map)
+        , m_idx(idx)
+      {
+        skip_empty();
+      }
+
+      reference operator*() const { return *m_slot_map->m_slots[m_idx].value; }
+      pointer operator->() const { return &*m_slot_map->m_slots[m_idx].value; }
+
+      Iterator& operator++()
+      {
+        ++m_idx;
+        skip_empty();
+        return *this;
+      }
+      Iterator operator++(int)
+      {
+        auto it = *this;
+        ++(*this);
+        return it;
+      }
+
+      bool operator==(const Iterator& other) const { return m_idx == other.m_idx; }
+      bool operator!=(const Iterator& other) const { return m_idx != other.m_idx; }
+
+      SlotHandle handle() const { return { m_idx, m_slot_map->m_slots[m_idx].generation }; }
+    };
+
+  public:
+    using iterator = Iterator<SlotMap, T>;
+    using const_iterator = Iterator<const SlotMap, const T>;
+
+    template<typename... Args>
+    SlotHandle emplace(Args&&... args)
+    {
+      uint32_t idx = 0;
+      if (m_free_idcs.empty())
+      {
+        idx = static_cast<uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+      }
+      else
+      {
+        idx = m_free_idcs.back();
+        m_free_idcs.pop_back();
+      }
+      auto& slot = m_slots[idx];
+      slot.value.emplace(std::forward<Args>(args)...);
+      m_size++;
+      return { idx, slot.generation };
+    }
+
+    SlotHandle insert(T value)
+    {
+      return emplace(std::move(value));
+    }
+
+    // Returns false if the handle is stale.
+    bool erase(const SlotHandle& handle)
+    {
+      if (!contains(handle))
+        return false;
+      auto& slot = m_slots[handle.idx];
+      slot.value.reset();
+      slot.generation++;
+      m_free_idcs.emplace_back(handle.idx);
+      m_size--;
+      return true;
+    }
+
+    bool contains(const SlotHandle& handle) const
+    {
+      return handle.idx < m_slots.size()
+        && m_slots[handle.idx].generation == handle.generation
+        && m_slots[handle.idx].value.has_value();
+    }
+
+    // Returns nullptr if the handle is stale.
+    T* get(const SlotHandle& handle)
+    {
+      if (!contains(handle))
+        return nullptr;
+      return &*m_slots[handle.idx].value;
+    }
+
+    const T* get(const SlotHandle& handle) const
+    {
+      if (!contains(handle))
+        return nullptr;
+      return &*m_slots[handle.idx].value;
+    }
+
+    // Handle of the element in slot slot_idx, or an invalid handle if the slot is empty.
+    SlotHandle get_handle(int slot_idx) const
+    {
+      if (slot_idx < 0 || slot_idx >= stlutils::sizeI(m_slots)
+          || !m_slots[slot_idx].value.has_value())
+        return {};
+      return { static_cast<uint32_t>(slot_idx), m_slots[slot_idx].generation };
+    }
+
+    // Number of slots including the free ones. Use with get_handle().
+    int num_slots() const { return stlutils::sizeI(m_slots); }
+
+    // A copy whose elements are func(element), under the same handles.
+    //   E.g. for copying a map of unique_ptrs.
+    template<typename Func>
+    auto transform(Func func) const
+    {
+      SlotMap<std::decay_t<decltype(func(std::declval<const T&>()))>> copy;
+      copy.m_slots.resize(m_slots.size());
+      for (size_t idx = 0; idx < m_slots.size(); ++idx)
+      {
+        if (m_slots[idx].value.has_value())
+          copy.m_slots[idx].value.emplace(func(*m_slots[idx].value));
+        copy.m_slots[idx].generation = m_slots[idx].generation;
+      }
+      copy.m_free_idcs = m_free_idcs;
+      copy.m_size = m_size;
+      return copy;
+    }
+
+    int size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    void clear()
+    {
+      for (uint32_t idx = 0; idx < m_slots.size(); ++idx)
+      {
+        auto& slot = m_slots[idx];
+        if (slot.value.has_value())
+        {
+          slot.value.reset();
+          slot.generation++;
+          m_free_idcs.emplace_back(idx);
+        }
+      }
+      m_size = 0;
+    }
+
+    iterator begin() { return { this, 0 }; }
+    iterator end() { return { this, static_cast<uint32_t>(m_slots.size()) }; }
+    const_iterator begin() const { return { this, 0 }; }
+    const_iterator end() const { return { this, static_cast<uint32_t>(m_slots.size()) }; }
+  };
+
+  // Returns the first handle in handles whose element in slot_map satisfies pred,
+  //   or an invalid handle if there is none.
+  template<typename T, typename Pred>
+  SlotHandle find_handle_if(const std::vector<SlotHandle>& handles, const SlotMap<T>& slot_map, Pred pred)
+  {
+    for (const auto& handle : handles)
+    {
+      const auto* value = slot_map.get(handle);
+      if (value != nullptr && pred(*value))
+        return handle;
+    }
+    return {};
+  }
+
+}
@@ -313,10 +313,16 @@ namespace dung
     
   public:
   
+    // get_solar_direction() only changes its result when this or the season changes.
+    static int get_phase_idx(float sun_t)
+    {
+      return static_cast<int>(std::floor(c_num_phases*sun_t));
+    }
+  
     SolarDirection get_solar_direction(Latitude latitude, Longitude longitude, Season season, float sun_t)
     {
       int long_offs = static_cast<int>(longitude);
-      int idx = static_cast<int>(std::floor(c_num_phases*sun_t) + long_offs) % c_num_phases;
+      int idx = (get_phase_idx(sun_t) + long_offs) % c_num_phases;
       switch (latitude)
       {
         case Latitude::NorthPole:
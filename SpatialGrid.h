@@ -0,0 +1,109 @@
+//
+//  SpatialGrid.h
+//  DungGine
+//
+
+#pragma once
+#include <Termin8or/RC.h>
+#include <Termin8or/Rectangle.h>
+#include <Core/Math.h>
+#include <vector>
+
+
+namespace dung
+{
+
+  // Uniform grid of square buckets covering the world.
+  // Each bucket holds the ids of all rectangles that overlap it, so that
+  //   overlap queries only need to visit the buckets covered by the query.
+  class SpatialGrid final
+  {
+    int m_bucket_size = 16;
+    int m_num_bucket_rows = 0;
+    int m_num_bucket_cols = 0;
+    std::vector<std::vector<int>> m_buckets;
+
+    // Returns false if bb lies entirely outside of the grid.
+    bool calc_bucket_range(const ttl::Rectangle& bb,
+                           int& br0, int& br1, int& bc0, int& bc1) const
+    {
+      // Treat degenerate rectangles as covering their top-left cell.
+      int r_last = bb.r + std::max(bb.r_len, 1) - 1;
+      int c_last = bb.c + std::max(bb.c_len, 1) - 1;
+      if (r_last < 0 || c_last < 0)
+        return false;
+      br0 = math::clamp(bb.r / m_bucket_size, 0, m_num_bucket_rows - 1);
+      br1 = math::clamp(r_last / m_bucket_size, 0, m_num_bucket_rows - 1);
+      bc0 = math::clamp(bb.c / m_bucket_size, 0, m_num_bucket_cols - 1);
+      bc1 = math::clamp(c_last / m_bucket_size, 0, m_num_bucket_cols - 1);
+      return !m_buckets.empty();
+    }
+
+  public:
+    SpatialGrid() = default;
+    SpatialGrid(const RC& world_size, int bucket_size)
+    {
+      reset(world_size, bucket_size);
+    }
+
+    void reset(const RC& world_size, int bucket_size)
+    {
+      m_bucket_size = std::max(bucket_size, 1);
+      m_num_bucket_rows = std::max((world_size.r + m_bucket_size - 1) / m_bucket_size, 1);
+      m_num_bucket_cols = std::max((world_size.c + m_bucket_size - 1) / m_bucket_size, 1);
+      m_buckets.clear();
+      m_buckets.resize(m_num_bucket_rows * m_num_bucket_cols);
+    }
+
+    void clear()
+    {
+      for (auto& bucket : m_buckets)
+        bucket.clear();
+    }
+
+    void insert(int id, const ttl::Rectangle& bb)
+    {
+      int br0 = 0, br1 = 0, bc0 = 0, bc1 = 0;
+      if (!calc_bucket_range(bb, br0, br1, bc0, bc1))
+        return;
+      for (int br = br0; br <= br1; ++br)
+        for (int bc = bc0; bc <= bc1; ++bc)
+          m_buckets[br * m_num_bucket_cols + bc].emplace_back(id);
+    }
+
+    static bool overlaps(const ttl::Rectangle& bb_a, const ttl::Rectangle& bb_b)
+    {
+      return bb_a.top() <= bb_b.bottom() && bb_b.top() <= bb_a.bottom()
+        && bb_a.left() <= bb_b.right() && bb_b.left() <= bb_a.right();
+    }
+
+    int get_bucket_size() const { return m_bucket_size; }
+    int num_bucket_rows() const { return m_num_bucket_rows; }
+    int num_bucket_cols() const { return m_num_bucket_cols; }
+
+    int to_bucket_row(int r) const { return math::clamp(r / m_bucket_size, 0, m_num_bucket_rows - 1); }
+    int to_bucket_col(int c) const { return math::clamp(c / m_bucket_size, 0, m_num_bucket_cols - 1); }
+
+    const std::vector<int>& get_bucket(int br, int bc) const
+    {
+      return m_buckets[br * m_num_bucket_cols + bc];
+    }
+
+    // Calls pred for the ids in the buckets overlapped by bb until pred returns true.
+    // An id spanning several buckets may be visited more than once.
+    template<typename Pred>
+    bool any_of(const ttl::Rectangle& bb, Pred&& pred) const
+    {
+      int br0 = 0, br1 = 0, bc0 = 0, bc1 = 0;
+      if (!calc_bucket_range(bb, br0, br1, bc0, bc1))
+        return false;
+      for (int br = br0; br <= br1; ++br)
+        for (int bc = bc0; bc <= bc1; ++bc)
+          for (int id : m_buckets[br * m_num_bucket_cols + bc])
+            if (pred(id))
+              return true;
+      return false;
+    }
+  };
+
+}
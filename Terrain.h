@@ -10,7 +10,7 @@
 namespace dung
 {
 
-  enum class Terrain
+  enum class Terrain : unsigned char
   {
     Default,
     Void,
@@ -43,6 +43,43 @@ namespace dung
     Rope,
   };
   
+  // #FIXME: Canonize material idcs.
+  Terrain material_to_terrain(int mat)
+  {
+    switch (mat)
+    {
+      case 0: return Terrain::Void;
+      case 1: return Terrain::Tile;
+      case 2: return Terrain::Water;
+      case 3: return Terrain::Sand;
+      case 4: return Terrain::Stone;
+      case 5: return Terrain::Masonry;
+      case 6: return Terrain::Brick;
+      case 7: return Terrain::Grass;
+      case 8: return Terrain::Shrub;
+      case 9: return Terrain::Tree;
+      case 10: return Terrain::Metal;
+      case 11: return Terrain::Wood;
+      case 12: return Terrain::Ice;
+      case 13: return Terrain::Mountain;
+      case 14: return Terrain::Lava;
+      case 15: return Terrain::Cave;
+      case 16: return Terrain::Swamp;
+      case 17: return Terrain::Poison;
+      case 18: return Terrain::Path;
+      case 19: return Terrain::Mine;
+      case 20: return Terrain::Gold;
+      case 21: return Terrain::Silver;
+      case 22: return Terrain::Gravel;
+      case 23: return Terrain::Bone;
+      case 24: return Terrain::Acid;
+      case 25: return Terrain::Column;
+      case 26: return Terrain::Tar;
+      case 27: return Terrain::Rope;
+      default: return Terrain::Default;
+    }
+  }
+  
   bool is_dry(Terrain terrain)
   {
     switch (terrain)
@@ -0,0 +1,187 @@
+//
+//  TextureIO.h
+//  DungGine
+//
+
+#pragma once
+#include "MappedFile.h"
+#include <Termin8or/Drawing.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+
+
+namespace dung
+{
+
+  // Binary texture format (.btex):
+  //   Header (magic "DGTX", version, rows, cols as native-endian 32 bit ints),
+  //   followed by four planes of rows*cols bytes each in row-major order:
+  //   glyphs, fg colors, bg colors and materials.
+  // The planes are read straight out of a memory mapped file so there is no parsing.
+  namespace texture_io
+  {
+
+    struct BinaryTextureHeader
+    {
+      char magic[4] = { 'D', 'G', 'T', 'X' };
+      uint32_t version = 1;
+      int32_t rows = 0;
+      int32_t cols = 0;
+    };
+
+    static const std::string c_binary_texture_ext = ".btex";
+
+    bool is_binary_texture_path(const std::string& file_path)
+    {
+      auto N = c_binary_texture_ext.size();
+      return file_path.size() >= N
+        && file_path.compare(file_path.size() - N, N, c_binary_texture_ext) == 0;
+    }
+
+    bool load_binary_texture(drawing::Texture& texture, const std::string& file_path)
+    {
+      MappedFile file { file_path };
+      if (!file.is_open())
+      {
+        std::cerr << "ERROR in load_binary_texture() : Unable to open \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+      BinaryTextureHeader header;
+      const BinaryTextureHeader ref_header;
+      if (file.size() < sizeof(header))
+      {
+        std::cerr << "ERROR in load_binary_texture() : Truncated header in \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+      std::memcpy(&header, file.data(), sizeof(header));
+      if (std::memcmp(header.magic, ref_header.magic, sizeof(header.magic)) != 0
+          || header.version != ref_header.version
+          || header.rows < 0 || header.cols < 0)
+      {
+        std::cerr << "ERROR in load_binary_texture() : Invalid header in \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+      size_t area = static_cast<size_t>(header.rows) * static_cast<size_t>(header.cols);
+      if (file.size() < sizeof(header) + 4*area)
+      {
+        std::cerr << "ERROR in load_binary_texture() : Truncated planes in \"" << file_path << "\"!" << std::endl;
+        return false;
+      }
+
+      const auto* glyphs = file.data() + sizeof(header);
+      const auto* fg_colors = glyphs + area;
+      const auto* bg_colors = fg_colors + area;
+      const auto* materials = bg_colors + area;
+
+      texture = drawing::Texture { header.rows, header.cols };
+      size_t idx = 0;
+      for (int r = 0; r < header.rows; ++r)
+        for (int c = 0; c < header.cols; ++c, ++idx)
+        {
+          drawing::Textel textel;
+          textel.ch = static_cast<char>(glyphs[idx]);
+          textel.fg_color = static_cast<Color>(static_cast<int8_t>(fg_colors[idx]));
+          textel.bg_color = static_cast<Color>(static_cast<int8_t>(bg_colors[idx]));
+          textel.mat = materials[idx];
+          texture.set_textel({ r, c }, textel);
+        }
+      return true;
+    }
+
+    bool save_binary_texture(const drawing::Texture& texture, const std::string& file_path)
+    {
+      BinaryTextureHeader header;
+      header.rows = texture.size.r;
+      header.cols = texture.size.c;
+      size_t area = static_cast<size_t>(header.rows) * static_cast<size_t>(header.cols);
+      std::vector<unsigned char> planes(4*area);
+      auto* glyphs = planes.data();
+      auto* fg_colors = glyphs + area;
+      auto* bg_colors = fg_colors + area;
+      auto* materials = bg_colors + area;
+
+      size_t idx = 0;
+      for (int r = 0; r < header.rows; ++r)
+        for (int c = 0; c < header.cols; ++c, ++idx)
+        {
+          const auto& textel = texture({ r, c });
+          int fg = static_cast<int>(textel.fg_color);
+          int bg = static_cast<int>(textel.bg_color);
+          if (fg < INT8_MIN || fg > INT8_MAX || bg < INT8_MIN || bg > INT8_MAX
+              || textel.mat < 0 || textel.mat > UINT8_MAX)
+          {
+            std::cerr << "ERROR in save_binary_texture() : Textel at (" << r << ", " << c
+              << ") does not fit in the binary format!" << std::endl;
+            return false;
+          }
+          glyphs[idx] = static_cast<unsigned char>(textel.ch);
+          fg_colors[idx] = static_cast<unsigned char>(static_cast<int8_t>(fg));
+          bg_colors[idx] = static_cast<unsigned char>(static_cast<int8_t>(bg));
+          materials[idx] = static_cast<unsigned char>(textel.mat);
+        }
+
+      std::ofstream file { file_path, std::ios::binary };
+      if (!file)
+      {
+        std::cerr << "ERROR in save_binary_texture() : Unable to open \"" << file_path << "\" for writing!" << std::endl;
+        return false;
+      }
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(planes.data()), static_cast<std::streamsize>(planes.size()));
+      return static_cast<bool>(file);
+    }
+
+    // Converts a text texture (.tex) into the binary format (.btex).
+    // The written file is read back and compared textel by textel with the text texture,
+    //   so a successful conversion is also a check of the format against Termin8or's parser.
+    bool convert_texture(const std::string& tex_file_path, const std::string& btex_file_path)
+    {
+      drawing::Texture texture;
+      texture.load(tex_file_path);
+      if (texture.size.r <= 0 || texture.size.c <= 0)
+      {
+        std::cerr << "ERROR in convert_texture() : Unable to load \"" << tex_file_path << "\"!" << std::endl;
+        return false;
+      }
+      drawing::Texture converted;
+      if (!save_binary_texture(texture, btex_file_path) || !load_binary_texture(converted, btex_file_path))
+        return false;
+      if (converted.size.r != texture.size.r || converted.size.c != texture.size.c)
+      {
+        std::cerr << "ERROR in convert_texture() : Size mismatch in \"" << btex_file_path << "\"!" << std::endl;
+        return false;
+      }
+      for (int r = 0; r < texture.size.r; ++r)
+        for (int c = 0; c < texture.size.c; ++c)
+        {
+          const auto& textel = texture({ r, c });
+          const auto& textel_converted = converted({ r, c });
+          if (textel.ch != textel_converted.ch
+              || textel.fg_color != textel_converted.fg_color
+              || textel.bg_color != textel_converted.bg_color
+              || textel.mat != textel_converted.mat)
+          {
+            std::cerr << "ERROR in convert_texture() : Textel at (" << r << ", " << c
+              << ") differs between \"" << tex_file_path << "\" and \"" << btex_file_path << "\"!" << std::endl;
+            return false;
+          }
+        }
+      return true;
+    }
+
+    // Loads either format depending on the file extension.
+    bool load_texture(drawing::Texture& texture, const std::string& file_path)
+    {
+      if (is_binary_texture_path(file_path))
+        return load_binary_texture(texture, file_path);
+      texture.load(file_path);
+      return texture.size.r > 0 && texture.size.c > 0;
+    }
+
+  }
+
+}
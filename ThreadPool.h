@@ -0,0 +1,146 @@
+//
+//  ThreadPool.h
+//  DungGine
+//
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+
+namespace dung
+{
+
+  // Fixed set of worker threads for data parallel loops.
+  // The calling thread takes part in the work and parallel_for() returns when all items are done.
+  class ThreadPool final
+  {
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cv_work;
+    std::condition_variable m_cv_done;
+    uint64_t m_generation = 0;
+    int m_num_busy = 0;
+    bool m_quit = false;
+
+    // Current job.
+    void* m_job_ctx = nullptr;
+    void (*m_job_func)(void*, int) = nullptr;
+    int m_num_items = 0;
+    int m_grain_size = 1;
+    std::atomic<int> m_next_item { 0 };
+
+    void run_items()
+    {
+      int start = 0;
+      while ((start = m_next_item.fetch_add(m_grain_size)) < m_num_items)
+      {
+        int end = std::min(start + m_grain_size, m_num_items);
+        for (int i = start; i < end; ++i)
+          m_job_func(m_job_ctx, i);
+      }
+    }
+
+    // generation : The job generation when the worker was started, so that it only wakes for later jobs.
+    void worker_loop(uint64_t generation)
+    {
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_cv_work.wait(lock, [&]() { return m_quit || m_generation != generation; });
+          if (m_quit)
+            return;
+          generation = m_generation;
+        }
+        run_items();
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (--m_num_busy == 0)
+            m_cv_done.notify_one();
+        }
+      }
+    }
+
+    void stop()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+      }
+      m_cv_work.notify_all();
+      for (auto& worker : m_workers)
+        worker.join();
+      m_workers.clear();
+      m_quit = false;
+    }
+
+  public:
+    // num_threads : Total number of threads including the calling thread.
+    //   0 means one per hardware thread.
+    explicit ThreadPool(int num_threads = 0)
+    {
+      set_num_threads(num_threads);
+    }
+
+    ~ThreadPool()
+    {
+      stop();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void set_num_threads(int num_threads)
+    {
+      stop();
+      if (num_threads <= 0)
+        num_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+      uint64_t generation = 0;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        generation = m_generation;
+      }
+      for (int t = 1; t < num_threads; ++t)
+        m_workers.emplace_back([this, generation]() { worker_loop(generation); });
+    }
+
+    int get_num_threads() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    // Calls f(i) for i in [0, num_items), grain_size items at a time per thread.
+    // Runs serially when there are too few items to be worth the hand-over.
+    template<typename F>
+    void parallel_for(int num_items, F&& f, int grain_size = 16)
+    {
+      grain_size = std::max(grain_size, 1);
+      if (m_workers.empty() || num_items <= grain_size)
+      {
+        for (int i = 0; i < num_items; ++i)
+          f(i);
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job_ctx = const_cast<void*>(static_cast<const void*>(&f));
+        m_job_func = [](void* ctx, int i) { (*static_cast<std::remove_reference_t<F>*>(ctx))(i); };
+        m_num_items = num_items;
+        m_grain_size = grain_size;
+        m_next_item = 0;
+        m_num_busy = static_cast<int>(m_workers.size());
+        ++m_generation;
+      }
+      m_cv_work.notify_all();
+      run_items();
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv_done.wait(lock, [&]() { return m_num_busy == 0; });
+    }
+  };
+
+}
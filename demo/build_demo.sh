@@ -20,3 +20,10 @@ cp ../../Termin8or/fonts/* bin/fonts/
 
 mkdir -p bin/textures/
 cp textures/* bin/textures/
+
+# Converts the textures to the binary format and checks them against the text format.
+(cd bin && ./demo --convert-textures)
+if [ $? -ne 0 ]; then
+  echo "Texture conversion failed"
+  exit 1
+fi
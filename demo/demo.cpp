@@ -9,12 +9,39 @@
 #include <DungGine/BSPTree.h>
 #include <DungGine/DungGine.h>
 #include <DungGine/DungGineListener.h>
+#include <DungGine/TextureIO.h>
 
 #include <iostream>
+#include <filesystem>
 
 enum class TestType { DungeonSimple, DungeonRuntime };
 static TestType test_type = TestType::DungeonRuntime;
 
+static const std::vector<std::string> c_texture_names
+{
+  "texture_sl_fill_0",
+  "texture_sl_fill_1",
+  "texture_sl_shadow_0",
+  "texture_sl_shadow_1",
+};
+
+// Converts textures/*.tex to textures/*.btex relative to the working directory.
+// Run by build_demo.sh in bin/ after the textures have been copied there.
+static bool convert_textures()
+{
+  bool ok = true;
+  for (const auto& name : c_texture_names)
+  {
+    auto tex_path = folder::join_path({ "textures", name + ".tex" });
+    auto btex_path = folder::join_path({ "textures", name + dung::texture_io::c_binary_texture_ext });
+    if (dung::texture_io::convert_texture(tex_path, btex_path))
+      std::cout << "Converted \"" << tex_path << "\" to \"" << btex_path << "\"." << std::endl;
+    else
+      ok = false;
+  }
+  return ok;
+}
+
 
 class Game : public GameEngine<>, public dung::DungGineListener
 {
@@ -126,14 +153,18 @@ public:
       bsp_tree.create_doors(50, true);
       
       texture_params.dt_anim_s = 0.5;
-      auto f_tex_path = [](const auto& filename)
+      // The binary textures if build_demo.sh made them, otherwise the text textures.
+      auto f_tex_path = [this](const std::string& name)
       {
-        return folder::join_path({ "textures", filename });
+        auto btex_path = folder::join_path({ "textures", name + dung::texture_io::c_binary_texture_ext });
+        if (std::filesystem::exists(folder::join_path({ get_exe_folder(), btex_path })))
+          return btex_path;
+        return folder::join_path({ "textures", name + ".tex" });
       };
-      texture_params.texture_file_names_surface_level_fill.emplace_back(f_tex_path("texture_sl_fill_0.tex"));
-      texture_params.texture_file_names_surface_level_fill.emplace_back(f_tex_path("texture_sl_fill_1.tex"));
-      texture_params.texture_file_names_surface_level_shadow.emplace_back(f_tex_path("texture_sl_shadow_0.tex"));
-      texture_params.texture_file_names_surface_level_shadow.emplace_back(f_tex_path("texture_sl_shadow_1.tex"));
+      texture_params.texture_file_names_surface_level_fill.emplace_back(f_tex_path(c_texture_names[0]));
+      texture_params.texture_file_names_surface_level_fill.emplace_back(f_tex_path(c_texture_names[1]));
+      texture_params.texture_file_names_surface_level_shadow.emplace_back(f_tex_path(c_texture_names[2]));
+      texture_params.texture_file_names_surface_level_shadow.emplace_back(f_tex_path(c_texture_names[3]));
     
       dungeon_engine = std::make_unique<dung::DungGine>(get_exe_folder(), true, texture_params);
       dungeon_engine->load_dungeon(&bsp_tree);
@@ -197,6 +228,9 @@ private:
 
 int main(int argc, char** argv)
 {
+  if (argc > 1 && std::string(argv[1]) == "--convert-textures")
+    return convert_textures() ? EXIT_SUCCESS : EXIT_FAILURE;
+
   GameEngineParams params;
   params.enable_title_screen = false;
   params.enable_instructions_screen = false;